@@ -0,0 +1,226 @@
+#!/bin/sh
+# make bench, times conversion stages of png2pos over the corpus, as reported by --stats
+#
+# usage: bench.sh PNG2POS CORPUS ITERATIONS RESULTS [BASELINE]
+#
+# RESULTS is a tab separated table, one row per file and mode, with the best time of ITERATIONS runs
+# of each stage and of time to first byte in milliseconds. Given BASELINE (RESULTS of an earlier run), totals are compared
+# and the script fails if any of them got slower by more than BENCH_TOLERANCE percent (10 by default);
+# differences under 1 ms are ignored, short images are dominated by noise. BENCH_OPTIONS are passed to each run
+# (e.g. --printer of the corpus).
+# The whole corpus is converted as one job at each of BENCH_JOBS parallel jobs (-j, 1 2 4 and the number
+# of CPUs by default), the best wall time of ITERATIONS runs is reported with its speedup against -j 1.
+
+set -e
+
+png2pos=$1
+corpus=$2
+iterations=$3
+results=$4
+baseline=$5
+tolerance=${BENCH_TOLERANCE:-10}
+common=${BENCH_OPTIONS:-}
+cpus=$(getconf _NPROCESSORS_ONLN 2>/dev/null || echo 1)
+jobs=${BENCH_JOBS:-1 2 4 $cpus}
+
+printf 'file\tmode\tdecode\tgrey\tequalize\tdither\tpack\temit\ttotal\tttfb\n' > "$results.tmp"
+for file in "$corpus"/*.png "$corpus"/*.pbm; do
+    [ -f "$file" ] || continue
+    # line art, line art and photo mode in low memory mode, photo mode, photo mode with ordered dithering engines
+    # line art turned by 90 degrees (images taller than printer's width fail and are left out)
+    # and line art with blank rows elided; PBM files are B/W already, only line art modes are timed
+    modes="line pipe photo stream bayer4 bayer8 bluenoise turn elide"
+    case $file in
+        *.pbm) modes="line turn elide" ;;
+    esac
+    for mode in $modes; do
+        case $mode in
+            line) options="" ;;
+            pipe) options="-s" ;;
+            photo) options="-p" ;;
+            stream) options="-p -s" ;;
+            turn) options="--rotate 90" ;;
+            elide) options="-e" ;;
+            *) options="-p -d $mode" ;;
+        esac
+
+        i=0
+        while [ $i -lt "$iterations" ]; do
+            "$png2pos" --stats $common $options -o /dev/null "$file" 2>&1 >/dev/null | grep '^{"files"' || true
+            i=$((i + 1))
+        done | awk -v file="${file##*/}" -v mode="$mode" '
+            {
+                # time to first byte and stage times of job: "ttfb_ms":1.234,"ms":{"decode":1.234,...}
+                sub(/.*"job":/, "")
+                ttfb = $0
+                sub(/.*"ttfb_ms":/, "", ttfb)
+                sub(/,.*/, "", ttfb)
+                if (ttfb != "null" && (!("ttfb" in best) || ttfb + 0 < best["ttfb"])) {
+                    best["ttfb"] = ttfb + 0
+                }
+                sub(/.*"ms":[{]/, "")
+                sub(/[}].*/, "")
+                n = split($0, fields, ",")
+                for (i = 1; i <= n; ++i) {
+                    split(fields[i], kv, ":")
+                    gsub(/"/, "", kv[1])
+                    if (!(kv[1] in best) || kv[2] + 0 < best[kv[1]]) {
+                        best[kv[1]] = kv[2] + 0
+                    }
+                }
+            }
+            END {
+                if (NR == 0) {
+                    exit
+                }
+                total = best["decode"] + best["grey"] + best["equalize"] + best["dither"] + best["pack"] + best["emit"]
+                if (total == 0) {
+                    # file was not converted
+                    exit
+                }
+                printf "%s\t%s\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\n", file, mode,
+                    best["decode"], best["grey"], best["equalize"], best["dither"], best["pack"], best["emit"], total, best["ttfb"]
+            }'
+    done
+done >> "$results.tmp"
+mv "$results.tmp" "$results"
+
+# dithering and packing of photo mode (Atkinson) compared with the ordered engines, over the same files
+awk -F '\t' '
+    NR > 1 {
+        time[$2] += $6 + $7
+    }
+    END {
+        if (time["photo"] > 0) {
+            printf "dither + pack: atkinson %.1f ms", time["photo"]
+            split("bayer4 bayer8 bluenoise", engines, " ")
+            for (i = 1; i <= 3; ++i) {
+                if (time[engines[i]] > 0) {
+                    printf ", %s %.1f ms (%.1fx)", engines[i], time[engines[i]], time["photo"] / time[engines[i]]
+                }
+            }
+            printf "\n"
+        }
+    }' "$results"
+
+# time to first byte of line art decoded as a whole and pipelined band by band (-s), over the same files
+awk -F '\t' '
+    NR > 1 && ($2 == "line" || $2 == "pipe") {
+        ttfb[$2] += $10
+    }
+    END {
+        if (ttfb["pipe"] > 0) {
+            printf "time to first byte: line %.1f ms, pipelined %.1f ms (%.1fx)\n", ttfb["line"], ttfb["pipe"], ttfb["line"] / ttfb["pipe"]
+        }
+    }' "$results"
+
+# line art from PNG compared with the same images from PBM, which are not decoded
+awk -F '\t' '
+    NR > 1 && $2 == "line" && $1 ~ /^line-/ {
+        name = $1
+        sub(/[.][a-z]+$/, "", name)
+        if ($1 ~ /[.]pbm$/) {
+            pbm[name] = $9
+        } else {
+            png[name] = $9
+        }
+    }
+    END {
+        for (name in pbm) {
+            if (name in png) {
+                png_total += png[name]
+                pbm_total += pbm[name]
+            }
+        }
+        if (pbm_total > 0) {
+            printf "line art: png %.1f ms, pbm %.1f ms (%.1fx)\n", png_total, pbm_total, png_total / pbm_total
+        }
+    }' "$results"
+
+# the whole corpus as one job of parallel files (-j), wall time of job against -j 1
+files=
+for file in "$corpus"/*.png "$corpus"/*.pbm; do
+    # files the printer does not take would fail the job
+    [ -f "$file" ] && "$png2pos" $common -o /dev/null "$file" 2>/dev/null && files="$files $file"
+done
+if [ -n "$files" ]; then
+    for j in $(echo $jobs | tr ' ' '\n' | sort -n -u); do
+        i=0
+        while [ $i -lt "$iterations" ]; do
+            "$png2pos" --stats $common -j "$j" -o /dev/null $files 2>&1 >/dev/null | grep '^{"files"' || true
+            i=$((i + 1))
+        done | awk -v jobs="$j" '
+            {
+                sub(/.*"job":/, "")
+                sub(/.*"wall":/, "")
+                sub(/[}].*/, "")
+                if (!best || $0 + 0 < best) {
+                    best = $0 + 0
+                }
+            }
+            END {
+                if (best) {
+                    printf "%s\t%.3f\n", jobs, best
+                }
+            }'
+    done | awk -F '\t' -v count="$(echo $files | wc -w)" '
+        {
+            if (NR == 1) {
+                printf "parallel jobs, %d files:", count
+            }
+            if ($1 == 1) {
+                single = $2
+            }
+            printf "%s -j %s %.1f ms", (NR > 1 ? "," : ""), $1, $2
+            if (single > 0) {
+                printf " (%.1fx)", single / $2
+            }
+        }
+        END {
+            if (NR > 0) {
+                printf "\n"
+            }
+        }'
+fi
+
+if [ -z "$baseline" ] || [ ! -f "$baseline" ]; then
+    awk -F '\t' 'NR > 1 { for (i = 3; i <= 9; ++i) sum[i] += $i }
+        END { printf "%d runs, decode %.1f, grey %.1f, equalize %.1f, dither %.1f, pack %.1f, emit %.1f, total %.1f ms\n",
+            NR - 1, sum[3], sum[4], sum[5], sum[6], sum[7], sum[8], sum[9] }' "$results"
+    exit 0
+fi
+
+awk -F '\t' -v tolerance="$tolerance" '
+    FNR == 1 {
+        for (i = 3; i <= 9; ++i) {
+            name[i] = $i
+        }
+        next
+    }
+    NR == FNR {
+        for (i = 3; i <= 9; ++i) {
+            base[$1 FS $2 FS i] = $i
+        }
+        next
+    }
+    ($1 FS $2 FS 9) in base {
+        for (i = 3; i <= 9; ++i) {
+            old[i] += base[$1 FS $2 FS i]
+            new[i] += $i
+        }
+        before = base[$1 FS $2 FS 9]
+        if ($9 > before * (1 + tolerance / 100) && $9 - before > 1) {
+            printf "REGRESSION %s %s: %.3f -> %.3f ms (%+.1f%%)\n", $1, $2, before, $9, 100 * ($9 - before) / before
+            ++regressions
+        }
+    }
+    END {
+        for (i = 3; i <= 9; ++i) {
+            printf "%-9s %12.3f -> %12.3f ms", name[i], old[i], new[i]
+            if (old[i] > 0) {
+                printf " (%+.1f%%)", 100 * (new[i] - old[i]) / old[i]
+            }
+            printf "\n"
+        }
+        exit regressions != 0
+    }' "$baseline" "$results"
@@ -0,0 +1,78 @@
+#!/bin/sh
+# make loadtest, png2pos server (-l) loaded by png2pos client (-C)
+#
+# usage: loadtest.sh PNG2POS JOBS ROUNDS FILES...
+#
+# Starts a server of JOBS workers on a temporary unix socket, checks the response to each of FILES against
+# local conversion of the file, then sends FILES ROUNDS times over by a client of JOBS connections and checks
+# the whole output against local conversion of the same job; the server is stopped at the end.
+# LOADTEST_OPTIONS are given to the server and local conversion (e.g. --printer of the corpus),
+# LOADTEST_REQUEST_OPTIONS to the client and local conversion (options carried by requests, -c, -p, -a, ...).
+# Photo mode shifts the threshold from file to file of a local job, not of requests, so jobs of -p differ.
+# Fails if any response differs or the server could not be started.
+
+set -e
+
+png2pos=$1
+jobs=$2
+rounds=$3
+shift 3
+options=${LOADTEST_OPTIONS:-}
+request=${LOADTEST_REQUEST_OPTIONS:--c}
+
+tmp=$(mktemp -d)
+socket="$tmp/png2pos.sock"
+server=
+cleanup() {
+    if [ -n "$server" ]; then
+        kill "$server" 2>/dev/null || true
+        wait "$server" 2>/dev/null || true
+    fi
+    rm -rf "$tmp"
+}
+trap cleanup EXIT INT TERM
+
+"$png2pos" $options -j "$jobs" -l "$socket" 2>"$tmp/server.log" &
+server=$!
+i=0
+while [ ! -S "$socket" ]; do
+    if [ $i -eq 50 ] || ! kill -0 "$server" 2>/dev/null; then
+        echo "server could not be started:" >&2
+        cat "$tmp/server.log" >&2
+        exit 1
+    fi
+    sleep 0.1
+    i=$((i + 1))
+done
+
+# each response on its own
+failures=0
+for file in "$@"; do
+    "$png2pos" $options $request -o "$tmp/local.pos" "$file" 2>/dev/null || continue
+    if ! "$png2pos" $request -C "$socket" -o "$tmp/client.pos" "$file" 2>/dev/null || ! cmp -s "$tmp/local.pos" "$tmp/client.pos"; then
+        echo "DIFFERS ${file##*/}"
+        failures=$((failures + 1))
+    fi
+    # files the printer does not take are left out of the job
+    echo "$file" >> "$tmp/files"
+done
+if [ ! -f "$tmp/files" ]; then
+    echo "no file could be converted" >&2
+    exit 1
+fi
+
+# the whole job, under load
+i=0
+while [ $i -lt "$rounds" ]; do
+    cat "$tmp/files"
+    i=$((i + 1))
+done > "$tmp/job"
+"$png2pos" $options $request -j "$jobs" -o "$tmp/local.pos" $(cat "$tmp/job") 2>/dev/null
+"$png2pos" $request -j "$jobs" -C "$socket" -o "$tmp/client.pos" $(cat "$tmp/job") 2>&1 >/dev/null | grep 'requests/s' || true
+if ! cmp -s "$tmp/local.pos" "$tmp/client.pos"; then
+    echo "DIFFERS job of $(wc -l < "$tmp/job") files"
+    failures=$((failures + 1))
+fi
+
+echo "$(wc -l < "$tmp/files") files, $rounds rounds, $jobs connections: $([ $failures -eq 0 ] && echo OK || echo "$failures FAILED")"
+[ $failures -eq 0 ]
@@ -0,0 +1,220 @@
+/*!
+(c) 2012 - 2015 Petr Kutalek: png2pos
+
+Licensed under the MIT License, see png2pos.c
+*/
+
+// make bench, generates the benchmark corpus:
+// widths of common printers × heights from a short label to a very long receipt × kinds of images,
+// LodePNG chooses color type of each file (1-bit grey, palette, RGB, RGBA) by its content;
+// line art is written as binary PBM as well
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "lodepng.h"
+
+void* lodepng_malloc(size_t size) {
+    return malloc(size);
+}
+
+void* lodepng_realloc(void *ptr, size_t new_size) {
+    return realloc(ptr, new_size);
+}
+
+void lodepng_free(void *ptr) {
+    free(ptr);
+}
+
+const unsigned int WIDTHS[] = { 384, 512, 576 };
+const unsigned int HEIGHTS[] = { 100, 1000, 10000, 50000 };
+
+// photos and alpha images do not compress well, the tallest ones would take hundreds of MiB
+#define TALL_HEIGHT 10000u
+
+// xorshift32, the corpus is the same on every machine
+unsigned int random_next(unsigned int *state) {
+    unsigned int x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+// black glyph-like strokes on white, lines of text separated by spacing: 1-bit greyscale
+void line_art(unsigned char *rgba, const unsigned int w, const unsigned int h, unsigned int *state) {
+    for (unsigned int y = 0; y != h; ++y) {
+        const unsigned int row = y % 40;
+        unsigned int ink = 0;
+        for (unsigned int x = 0; x != w; ++x) {
+            // glyphs 12 px wide with 4 px gaps, 24 px tall lines, random stems
+            if (row < 24 && x % 16 < 12 && x >= 16 && x < w - 16) {
+                if (x % 16 == 0 || (random_next(state) & 0x0f) == 0) {
+                    ink = random_next(state) & 1;
+                }
+            } else {
+                ink = 0;
+            }
+            unsigned char *p = &rgba[((size_t)y * w + x) << 2];
+            p[0] = p[1] = p[2] = ink ? 0x00 : 0xff;
+            p[3] = 0xff;
+        }
+    }
+}
+
+// smooth gradients with mild noise: RGB
+void photo(unsigned char *rgba, const unsigned int w, const unsigned int h, unsigned int *state) {
+    for (unsigned int y = 0; y != h; ++y) {
+        for (unsigned int x = 0; x != w; ++x) {
+            unsigned char *p = &rgba[((size_t)y * w + x) << 2];
+            const unsigned int noise = random_next(state) & 0x0f;
+            p[0] = (x * 255 / w + noise) & 0xff;
+            p[1] = ((y % 512) * 255 / 511 + noise) & 0xff;
+            p[2] = ((x + y) % 256 + noise) & 0xff;
+            p[3] = 0xff;
+        }
+    }
+}
+
+// posterized blocks of 16 colors: palette
+void palette(unsigned char *rgba, const unsigned int w, const unsigned int h, unsigned int *state) {
+    (void)state;
+    for (unsigned int y = 0; y != h; ++y) {
+        for (unsigned int x = 0; x != w; ++x) {
+            unsigned char *p = &rgba[((size_t)y * w + x) << 2];
+            const unsigned int c = (x / 24 + y / 24 + (x * y >> 10)) & 0x0f;
+            p[0] = c * 17;
+            p[1] = (c * 53) & 0xff;
+            p[2] = 255 - c * 17;
+            p[3] = 0xff;
+        }
+    }
+}
+
+// colored shapes fading into transparency: RGBA
+void alpha(unsigned char *rgba, const unsigned int w, const unsigned int h, unsigned int *state) {
+    for (unsigned int y = 0; y != h; ++y) {
+        for (unsigned int x = 0; x != w; ++x) {
+            unsigned char *p = &rgba[((size_t)y * w + x) << 2];
+            const unsigned int dx = x % 128 < 64 ? x % 128 : 127 - x % 128;
+            const unsigned int dy = y % 128 < 64 ? y % 128 : 127 - y % 128;
+            p[0] = (x * 3) & 0xff;
+            p[1] = (y * 5) & 0xff;
+            p[2] = random_next(state) & 0x3f;
+            p[3] = (dx * dy) >> 4;
+        }
+    }
+}
+
+int file_exists(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (f) {
+        fclose(f), f = NULL;
+        return 1;
+    }
+    return 0;
+}
+
+// B/W image as binary PBM, rows packed MSB first, 1 = black
+int write_pbm(const char *path, const unsigned char *rgba, const unsigned int w, const unsigned int h) {
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        return 1;
+    }
+    fprintf(f, "P4\n%u %u\n", w, h);
+    for (unsigned int y = 0; y != h; ++y) {
+        for (unsigned int x = 0; x < w; x += 8) {
+            unsigned int byte = 0;
+            for (unsigned int i = 0; i != 8 && x + i != w; ++i) {
+                byte |= (rgba[((size_t)y * w + x + i) << 2] < 0x80) << (7 - i);
+            }
+            putc(byte, f);
+        }
+    }
+    return fclose(f) != 0;
+}
+
+struct kind {
+    const char *name;
+    void (*generate)(unsigned char *, unsigned int, unsigned int, unsigned int *);
+    unsigned int max_height;
+    // written as PBM too
+    unsigned int pbm;
+};
+
+const struct kind KINDS[] = {
+    { "line", line_art, ~0u, 1 },
+    { "photo", photo, TALL_HEIGHT, 0 },
+    { "palette", palette, ~0u, 0 },
+    { "alpha", alpha, TALL_HEIGHT, 0 }
+};
+
+int main(int argc, char *argv[]) {
+    int ret = EXIT_FAILURE;
+    unsigned char *rgba = NULL;
+    char path[4096];
+
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s DIR\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (mkdir(argv[1], 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Could not create directory '%s'\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    for (unsigned int k = 0; k != sizeof(KINDS) / sizeof(KINDS[0]); ++k) {
+        for (unsigned int i = 0; i != sizeof(WIDTHS) / sizeof(WIDTHS[0]); ++i) {
+            for (unsigned int j = 0; j != sizeof(HEIGHTS) / sizeof(HEIGHTS[0]); ++j) {
+                const unsigned int w = WIDTHS[i];
+                const unsigned int h = HEIGHTS[j];
+                if (h > KINDS[k].max_height) {
+                    continue;
+                }
+
+                // corpus is deterministic, files are not generated again
+                snprintf(path, sizeof(path), "%s/%s-%u-%u.pbm", argv[1], KINDS[k].name, w, h);
+                if (!KINDS[k].pbm || file_exists(path)) {
+                    snprintf(path, sizeof(path), "%s/%s-%u-%u.png", argv[1], KINDS[k].name, w, h);
+                    if (file_exists(path)) {
+                        continue;
+                    }
+                }
+                snprintf(path, sizeof(path), "%s/%s-%u-%u.png", argv[1], KINDS[k].name, w, h);
+
+                rgba = (unsigned char *)malloc((size_t)w * h * 4);
+                if (!rgba) {
+                    fprintf(stderr, "Could not allocate enough memory\n");
+                    goto fail;
+                }
+                unsigned int state = 0x2545f491u ^ (w * 2654435761u) ^ h;
+                KINDS[k].generate(rgba, w, h, &state);
+
+                const unsigned int error = lodepng_encode32_file(path, rgba, w, h);
+                if (error) {
+                    fprintf(stderr, "Could not write '%s', %s\n", path, lodepng_error_text(error));
+                    goto fail;
+                }
+                fprintf(stderr, "%s\n", path);
+
+                if (KINDS[k].pbm) {
+                    snprintf(path, sizeof(path), "%s/%s-%u-%u.pbm", argv[1], KINDS[k].name, w, h);
+                    if (write_pbm(path, rgba, w, h) != 0) {
+                        fprintf(stderr, "Could not write '%s'\n", path);
+                        goto fail;
+                    }
+                    fprintf(stderr, "%s\n", path);
+                }
+                free(rgba), rgba = NULL;
+            }
+        }
+    }
+
+    ret = EXIT_SUCCESS;
+
+fail:
+    free(rgba), rgba = NULL;
+    return ret;
+}
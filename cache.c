@@ -0,0 +1,423 @@
+/*!
+(c) 2012 - 2015 Petr Kutalek: png2pos
+
+Licensed under the MIT License, see png2pos.c
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "cache.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
+// entry file: "P2PC", version, threshold, 2 reserved bytes, bytes saved by -e (LE32), ESC/POS output
+#define CACHE_HEADER_LENGTH 12
+#define CACHE_VERSION 2
+
+// SHA-256, FIPS 180-4
+struct sha256 {
+    unsigned long state[8];
+    unsigned char block[64];
+    unsigned int used;
+    unsigned long long length;
+};
+
+static const unsigned long SHA256_K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROR32(x, n) ((((x) >> (n)) | ((x) << (32 - (n)))) & 0xffffffff)
+
+static void sha256_block(struct sha256 *h, const unsigned char *p) {
+    unsigned long w[64];
+    for (unsigned int i = 0; i != 16; ++i) {
+        w[i] = (unsigned long)p[i << 2] << 24 | (unsigned long)p[(i << 2) | 1] << 16 | (unsigned long)p[(i << 2) | 2] << 8 | p[(i << 2) | 3];
+    }
+    for (unsigned int i = 16; i != 64; ++i) {
+        const unsigned long s0 = ROR32(w[i - 15], 7) ^ ROR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        const unsigned long s1 = ROR32(w[i - 2], 17) ^ ROR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = (w[i - 16] + s0 + w[i - 7] + s1) & 0xffffffff;
+    }
+
+    unsigned long a = h->state[0], b = h->state[1], c = h->state[2], d = h->state[3];
+    unsigned long e = h->state[4], f = h->state[5], g = h->state[6], k = h->state[7];
+    for (unsigned int i = 0; i != 64; ++i) {
+        const unsigned long s1 = ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25);
+        const unsigned long ch = (e & f) ^ (~e & g);
+        const unsigned long t1 = (k + s1 + ch + SHA256_K[i] + w[i]) & 0xffffffff;
+        const unsigned long s0 = ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22);
+        const unsigned long maj = (a & b) ^ (a & c) ^ (b & c);
+        const unsigned long t2 = (s0 + maj) & 0xffffffff;
+        k = g;
+        g = f;
+        f = e;
+        e = (d + t1) & 0xffffffff;
+        d = c;
+        c = b;
+        b = a;
+        a = (t1 + t2) & 0xffffffff;
+    }
+    h->state[0] = (h->state[0] + a) & 0xffffffff;
+    h->state[1] = (h->state[1] + b) & 0xffffffff;
+    h->state[2] = (h->state[2] + c) & 0xffffffff;
+    h->state[3] = (h->state[3] + d) & 0xffffffff;
+    h->state[4] = (h->state[4] + e) & 0xffffffff;
+    h->state[5] = (h->state[5] + f) & 0xffffffff;
+    h->state[6] = (h->state[6] + g) & 0xffffffff;
+    h->state[7] = (h->state[7] + k) & 0xffffffff;
+}
+
+static void sha256_init(struct sha256 *h) {
+    static const unsigned long H0[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(h->state, H0, sizeof(H0));
+    h->used = 0;
+    h->length = 0;
+}
+
+static void sha256_update(struct sha256 *h, const unsigned char *p, size_t n) {
+    h->length += n;
+    if (h->used != 0) {
+        while (n != 0 && h->used != 64) {
+            h->block[h->used++] = *p++;
+            --n;
+        }
+        if (h->used != 64) {
+            return;
+        }
+        sha256_block(h, h->block);
+        h->used = 0;
+    }
+    for (; n >= 64; n -= 64, p += 64) {
+        sha256_block(h, p);
+    }
+    memcpy(h->block, p, n);
+    h->used = n;
+}
+
+static void sha256_final(struct sha256 *h, unsigned char *digest) {
+    const unsigned long long bits = h->length << 3;
+    h->block[h->used++] = 0x80;
+    if (h->used > 56) {
+        memset(&h->block[h->used], 0, 64 - h->used);
+        sha256_block(h, h->block);
+        h->used = 0;
+    }
+    memset(&h->block[h->used], 0, 56 - h->used);
+    for (unsigned int i = 0; i != 8; ++i) {
+        h->block[56 + i] = bits >> (56 - 8 * i) & 0xff;
+    }
+    sha256_block(h, h->block);
+    for (unsigned int i = 0; i != 32; ++i) {
+        digest[i] = h->state[i >> 2] >> (24 - 8 * (i & 3)) & 0xff;
+    }
+}
+
+void cache_key(unsigned char *key, const unsigned char *png, const size_t png_size, const unsigned char *options, const size_t options_size) {
+    struct sha256 h;
+    sha256_init(&h);
+    sha256_update(&h, png, png_size);
+    sha256_update(&h, options, options_size);
+    sha256_final(&h, key);
+}
+
+struct {
+    char *dir;
+    unsigned long max_size;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+    pthread_mutex_t lock;
+} cache = {
+    .dir = NULL,
+    .max_size = 0,
+    .hits = 0,
+    .misses = 0,
+    .evictions = 0,
+    .lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+void cache_stats(unsigned long *hits, unsigned long *misses, unsigned long *evictions) {
+    pthread_mutex_lock(&cache.lock);
+    *hits = cache.hits;
+    *misses = cache.misses;
+    *evictions = cache.evictions;
+    pthread_mutex_unlock(&cache.lock);
+}
+
+#ifdef _WIN32
+int cache_open(const char *dir, const unsigned long max_size) {
+    (void)dir;
+    (void)max_size;
+    // not supported on this platform
+    errno = ENOSYS;
+    return 1;
+}
+
+int cache_lookup(const unsigned char *key, struct cache_entry *entry) {
+    (void)key;
+    (void)entry;
+    return 1;
+}
+
+void cache_release(struct cache_entry *entry) {
+    (void)entry;
+}
+
+int cache_store_begin(char **tmp) {
+    *tmp = NULL;
+    return -1;
+}
+
+int cache_store_end(const unsigned char *key, const int fd, char *tmp, const unsigned int threshold, const long saved, const int failed) {
+    (void)key;
+    (void)fd;
+    (void)tmp;
+    (void)threshold;
+    (void)saved;
+    (void)failed;
+    errno = ENOSYS;
+    return 1;
+}
+#else
+int cache_open(const char *dir, const unsigned long max_size) {
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        return 1;
+    }
+    free(cache.dir);
+    if (!(cache.dir = strdup(dir))) {
+        errno = ENOMEM;
+        return 1;
+    }
+    cache.max_size = max_size;
+    return 0;
+}
+
+// name of an entry, 64 hex digits
+static char* entry_path(const unsigned char *key) {
+    static const char HEX[16] = "0123456789abcdef";
+    const size_t dir_length = strlen(cache.dir);
+    char *path = (char *)malloc(dir_length + 2 + 2 * CACHE_KEY_LENGTH);
+    if (path) {
+        memcpy(path, cache.dir, dir_length);
+        path[dir_length] = '/';
+        for (unsigned int i = 0; i != CACHE_KEY_LENGTH; ++i) {
+            path[dir_length + 1 + 2 * i] = HEX[key[i] >> 4];
+            path[dir_length + 2 + 2 * i] = HEX[key[i] & 0x0f];
+        }
+        path[dir_length + 1 + 2 * CACHE_KEY_LENGTH] = '\0';
+    }
+    return path;
+}
+
+int cache_lookup(const unsigned char *key, struct cache_entry *entry) {
+    int ret = 1;
+    int fd = -1;
+    char *path = NULL;
+
+    memset(entry, 0, sizeof(struct cache_entry));
+    if (!cache.dir || !(path = entry_path(key))) {
+        goto fail;
+    }
+
+    struct stat st;
+    if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) != 0 || st.st_size < CACHE_HEADER_LENGTH) {
+        goto fail;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        goto fail;
+    }
+    const unsigned char *header = (const unsigned char *)map;
+    if (memcmp(header, "P2PC", 4) != 0 || header[4] != CACHE_VERSION) {
+        munmap(map, st.st_size);
+        goto fail;
+    }
+
+    // the most recently used one
+    futimens(fd, NULL);
+
+    entry->map = map;
+    entry->map_size = st.st_size;
+    entry->threshold = header[5];
+    entry->saved = (long)header[8] | (long)header[9] << 8 | (long)header[10] << 16 | (long)(signed char)header[11] << 24;
+    entry->data = &header[CACHE_HEADER_LENGTH];
+    entry->size = st.st_size - CACHE_HEADER_LENGTH;
+    ret = 0;
+
+fail:
+    if (fd >= 0) {
+        close(fd);
+    }
+    free(path), path = NULL;
+
+    pthread_mutex_lock(&cache.lock);
+    if (ret == 0) {
+        ++cache.hits;
+    } else {
+        ++cache.misses;
+    }
+    pthread_mutex_unlock(&cache.lock);
+    return ret;
+}
+
+void cache_release(struct cache_entry *entry) {
+    if (entry->map) {
+        munmap(entry->map, entry->map_size);
+    }
+    memset(entry, 0, sizeof(struct cache_entry));
+}
+
+int cache_store_begin(char **tmp) {
+    static const unsigned char EMPTY[CACHE_HEADER_LENGTH] = { 0 };
+    const size_t dir_length = strlen(cache.dir);
+    int fd = -1;
+
+    if (!(*tmp = (char *)malloc(dir_length + 16))) {
+        return -1;
+    }
+    memcpy(*tmp, cache.dir, dir_length);
+    strcpy(&(*tmp)[dir_length], "/.tmp-XXXXXX");
+
+    // header is written once the entry is complete
+    if ((fd = mkstemp(*tmp)) < 0 || write(fd, EMPTY, CACHE_HEADER_LENGTH) != CACHE_HEADER_LENGTH) {
+        if (fd >= 0) {
+            close(fd);
+            unlink(*tmp);
+        }
+        free(*tmp), *tmp = NULL;
+        return -1;
+    }
+    return fd;
+}
+
+struct cache_file {
+    char name[2 * CACHE_KEY_LENGTH + 1];
+    time_t mtime;
+    off_t size;
+};
+
+static int cache_file_older(const void *a, const void *b) {
+    const time_t ta = ((const struct cache_file *)a)->mtime;
+    const time_t tb = ((const struct cache_file *)b)->mtime;
+    return ta < tb ? -1 : ta > tb;
+}
+
+// removes least recently used entries until the cache fits into its size limit
+static void cache_evict(void) {
+    DIR *dir = NULL;
+    struct cache_file *files = NULL;
+    unsigned int count = 0;
+    unsigned int size = 0;
+    unsigned long long total = 0;
+    const size_t dir_length = strlen(cache.dir);
+    char *path = (char *)malloc(dir_length + 2 + 2 * CACHE_KEY_LENGTH);
+
+    if (!path || !(dir = opendir(cache.dir))) {
+        goto fail;
+    }
+    memcpy(path, cache.dir, dir_length);
+    path[dir_length] = '/';
+
+    struct dirent *de = NULL;
+    while ((de = readdir(dir)) != NULL) {
+        if (strlen(de->d_name) != 2 * CACHE_KEY_LENGTH || strspn(de->d_name, "0123456789abcdef") != 2 * CACHE_KEY_LENGTH) {
+            continue;
+        }
+        strcpy(&path[dir_length + 1], de->d_name);
+        struct stat st;
+        if (stat(path, &st) != 0) {
+            continue;
+        }
+        if (count == size) {
+            size = size ? 2 * size : 64;
+            struct cache_file *f = (struct cache_file *)realloc(files, size * sizeof(struct cache_file));
+            if (!f) {
+                goto fail;
+            }
+            files = f;
+        }
+        strcpy(files[count].name, de->d_name);
+        files[count].mtime = st.st_mtime;
+        files[count].size = st.st_size;
+        total += st.st_size;
+        ++count;
+    }
+
+    if (total <= cache.max_size) {
+        goto fail;
+    }
+
+    qsort(files, count, sizeof(struct cache_file), cache_file_older);
+    for (unsigned int i = 0; i != count && total > cache.max_size; ++i) {
+        strcpy(&path[dir_length + 1], files[i].name);
+        if (unlink(path) == 0) {
+            total -= files[i].size;
+            pthread_mutex_lock(&cache.lock);
+            ++cache.evictions;
+            pthread_mutex_unlock(&cache.lock);
+        }
+    }
+
+fail:
+    if (dir) {
+        closedir(dir);
+    }
+    free(files), files = NULL;
+    free(path), path = NULL;
+}
+
+int cache_store_end(const unsigned char *key, const int fd, char *tmp, const unsigned int threshold, const long saved, const int failed) {
+    const unsigned char header[CACHE_HEADER_LENGTH] = {
+        'P', '2', 'P', 'C', CACHE_VERSION, threshold & 0xff, 0x00, 0x00,
+        saved & 0xff, saved >> 8 & 0xff, saved >> 16 & 0xff, saved >> 24 & 0xff
+    };
+    char *path = NULL;
+    int error = failed;
+    // reason of the failure, cleanup below may change errno
+    int reason = 0;
+
+    if (!error && pwrite(fd, header, CACHE_HEADER_LENGTH, 0) != CACHE_HEADER_LENGTH) {
+        error = 1;
+    }
+    if (close(fd) != 0) {
+        error = 1;
+    }
+    // rename is atomic, a concurrent reader sees either no entry or the complete one
+    if (!error && (!(path = entry_path(key)) || rename(tmp, path) != 0)) {
+        error = 1;
+    }
+    if (error) {
+        reason = errno;
+        unlink(tmp);
+    }
+    free(path), path = NULL;
+    free(tmp);
+
+    // entries being stored concurrently are evicted by one thread
+    static pthread_mutex_t evict_lock = PTHREAD_MUTEX_INITIALIZER;
+    if (pthread_mutex_trylock(&evict_lock) == 0) {
+        cache_evict();
+        pthread_mutex_unlock(&evict_lock);
+    }
+    errno = reason;
+    return error;
+}
+#endif
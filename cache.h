@@ -0,0 +1,52 @@
+/*!
+(c) 2012 - 2015 Petr Kutalek: png2pos
+
+Licensed under the MIT License, see png2pos.c
+*/
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+
+// On-disk cache of converted images. ESC/POS output of an image is stored in a file named by
+// SHA-256 of the PNG data and of the conversion options, so repeated logos and headers are
+// printed straight from a memory mapped file, without inflate and dithering.
+// Once size of the cache exceeds its limit, entries are evicted in least recently used order
+// (modification time of an entry is refreshed on every hit).
+
+#define CACHE_KEY_LENGTH 32
+
+struct cache_entry {
+    // ESC/POS output
+    const unsigned char *data;
+    size_t size;
+    // threshold for the next file, as shifted by photo mode
+    unsigned int threshold;
+    // bytes saved by blank row elision (-e)
+    long saved;
+    void *map;
+    size_t map_size;
+};
+
+// opens (creates) cache directory, max_size in bytes; returns 0 on success, errno tells why it failed
+int cache_open(const char *dir, unsigned long max_size);
+
+// key of PNG data converted with given options
+void cache_key(unsigned char *key, const unsigned char *png, size_t png_size, const unsigned char *options, size_t options_size);
+
+// maps an entry, returns 0 on hit
+int cache_lookup(const unsigned char *key, struct cache_entry *entry);
+
+void cache_release(struct cache_entry *entry);
+
+// creates a temporary file the entry is written into, returns its descriptor or -1
+int cache_store_begin(char **tmp);
+
+// publishes the written entry (or throws it away if failed) and evicts old entries, closes fd and frees tmp;
+// returns 0 if the entry was stored, errno tells why it was not
+int cache_store_end(const unsigned char *key, int fd, char *tmp, unsigned int threshold, long saved, int failed);
+
+void cache_stats(unsigned long *hits, unsigned long *misses, unsigned long *evictions);
+
+#endif
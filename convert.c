@@ -0,0 +1,2176 @@
+/*!
+(c) 2012 - 2015 Petr Kutalek: png2pos
+
+Licensed under the MIT License, see png2pos.c
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include "lodepng.h"
+#include "pngstream.h"
+#include "pnm.h"
+#include "pool.h"
+#include "queue.h"
+#include "scale.h"
+#include "grey.h"
+#include "dither.h"
+#include "convert.h"
+
+const char *PNG2POS_VERSION = "1.6.4";
+
+// lodepng allocators, decoded images come from the pool of the job and are released by pool_free;
+// lodepng clears what it needs cleared itself
+void* lodepng_malloc(size_t size) {
+    return pool_alloc(size);
+}
+
+void* lodepng_realloc(void *ptr, size_t new_size) {
+    return pool_realloc(ptr, new_size);
+}
+
+void lodepng_free(void *ptr) {
+    pool_free(ptr);
+}
+
+// ESC sequences, their lengths are defined in convert.h
+const unsigned char ESC_INIT[ESC_INIT_LENGTH] = {
+    // ESC @, Initialize printer, p. 412
+    0x1b, 0x40
+};
+
+const unsigned char ESC_CUT[ESC_CUT_LENGTH] = {
+    // GS V, Sub-Function B, p. 373
+    0x1d, 0x56, 0x41,
+    // Feeds paper to (cutting position + n × vertical motion unit)
+    // and executes a full cut (cuts the paper completely)
+    // The vertical motion unit is specified by GS P.
+    0x40
+};
+
+static const unsigned char ESC_OFFSET[ESC_OFFSET_LENGTH] = {
+    // GS L, Set left margin, p. 169
+    0x1d, 0x4c, 
+    // nl, nh
+    0x00, 0x00
+};
+
+static const unsigned char ESC_STORE[ESC_STORE_LENGTH] = {
+    // GS 8 L, Store the graphics data in the print buffer (raster format), p. 252
+    0x1d, 0x38, 0x4c,
+    // p1 p2 p3 p4
+    0x0b, 0x00, 0x00, 0x00, 
+    // Function 112
+    0x30, 0x70, 0x30,
+    // bx by, zoom
+    0x01, 0x01, 
+    // c, single-color printing model
+    0x31, 
+    // xl, xh, number of dots in the horizontal direction
+    0x00, 0x00, 
+    // yl, yh, number of dots in the vertical direction
+    0x00, 0x00
+};
+
+static const unsigned char ESC_FLUSH[ESC_FLUSH_LENGTH] = {
+    // GS ( L, Print the graphics data in the print buffer, p. 241
+    // Moves print position to the left side of the print area after 
+    // printing of graphics data is completed
+    0x1d, 0x28, 0x4c, 0x02, 0x00, 0x30,
+    // Fn 50
+    0x32 
+};
+
+static const unsigned char ESC_FEED[ESC_FEED_LENGTH] = {
+    // ESC J, Print and feed paper
+    0x1b, 0x4a,
+    // n × vertical motion unit
+    0x00
+};
+
+static const unsigned char ESC_DEFINE[ESC_DEFINE_LENGTH] = {
+    // GS 8 L, Define the NV graphics data (raster format), Function 67
+    // or Define the download graphics data (raster format), Function 83
+    0x1d, 0x38, 0x4c,
+    // p1 p2 p3 p4
+    0x0b, 0x00, 0x00, 0x00,
+    // Function 67 (83), a = 48
+    0x30, 0x43, 0x30,
+    // kc1 kc2, key code
+    0x20, 0x20,
+    // b, number of colors
+    0x01,
+    // xl, xh, number of dots in the horizontal direction
+    0x00, 0x00,
+    // yl, yh, number of dots in the vertical direction
+    0x00, 0x00,
+    // c, color 1
+    0x31
+};
+
+static const unsigned char ESC_PRINT_STORED[ESC_PRINT_STORED_LENGTH] = {
+    // GS ( L, Print the specified NV graphics data, Function 69
+    // or Print the specified download graphics data, Function 85
+    0x1d, 0x28, 0x4c, 0x06, 0x00, 0x30, 0x45,
+    // kc1 kc2, key code
+    0x20, 0x20,
+    // x y, zoom
+    0x01, 0x01
+};
+
+// monotonic clock, seconds
+double clock_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+// clock is read only if stats are collected (stats is not NULL)
+double stage_clock(const struct stats *stats) {
+    if (!stats) {
+        return 0.0;
+    }
+    return clock_seconds();
+}
+
+void stage_failed(struct stats *stats, const unsigned int stage) {
+    if (stats) {
+        stats->failed = stage + 1;
+    }
+}
+
+// adds time since begin to the stage, returns current time, so that stages can be chained
+static double stage_end(struct stats *stats, const unsigned int stage, const double begin) {
+    if (!stats) {
+        return begin;
+    }
+    const double now = stage_clock(stats);
+    stats->time[stage] += now - begin;
+    return now;
+}
+
+// a buffer of given size has been allocated (size > 0) or released (size < 0)
+static void stats_memory(struct stats *stats, const long size) {
+    if (!stats || size == 0) {
+        return;
+    }
+    stats->memory += size;
+    if (stats->memory > stats->memory_peak) {
+        stats->memory_peak = stats->memory;
+    }
+    struct job_memory *job = stats->job;
+    if (!job) {
+        return;
+    }
+    pthread_mutex_lock(&job->lock);
+    job->memory += size;
+    if (job->memory > job->memory_peak) {
+        job->memory_peak = job->memory;
+    }
+    pthread_mutex_unlock(&job->lock);
+}
+
+// Gamma 2.2 lookup table
+const unsigned char GAMMA_22[256] = {
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x02, 0x02, 0x02,
+    0x02, 0x02, 0x03, 0x03, 0x03, 0x03, 0x03, 0x04, 0x04, 0x04, 0x04, 0x05, 0x05, 0x05, 0x05, 0x06,
+    0x06, 0x06, 0x07, 0x07, 0x07, 0x08, 0x08, 0x08, 0x09, 0x09, 0x09, 0x0a, 0x0a, 0x0a, 0x0b, 0x0b,
+    0x0c, 0x0c, 0x0d, 0x0d, 0x0d, 0x0e, 0x0e, 0x0f, 0x0f, 0x10, 0x10, 0x11, 0x11, 0x12, 0x12, 0x13,
+    0x13, 0x14, 0x15, 0x15, 0x16, 0x16, 0x17, 0x17, 0x18, 0x19, 0x19, 0x1a, 0x1b, 0x1b, 0x1c, 0x1d,
+    0x1d, 0x1e, 0x1f, 0x1f, 0x20, 0x21, 0x21, 0x22, 0x23, 0x24, 0x24, 0x25, 0x26, 0x27, 0x28, 0x28,
+    0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2d, 0x2e, 0x2f, 0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37,
+    0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0x3e, 0x3f, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47,
+    0x48, 0x49, 0x4a, 0x4b, 0x4d, 0x4e, 0x4f, 0x50, 0x51, 0x52, 0x54, 0x55, 0x56, 0x57, 0x58, 0x5a,
+    0x5b, 0x5c, 0x5d, 0x5f, 0x60, 0x61, 0x63, 0x64, 0x65, 0x67, 0x68, 0x69, 0x6b, 0x6c, 0x6d, 0x6f,
+    0x70, 0x72, 0x73, 0x75, 0x76, 0x77, 0x79, 0x7a, 0x7c, 0x7d, 0x7f, 0x80, 0x82, 0x83, 0x85, 0x87,
+    0x88, 0x8a, 0x8b, 0x8d, 0x8e, 0x90, 0x92, 0x93, 0x95, 0x97, 0x98, 0x9a, 0x9c, 0x9d, 0x9f, 0xa1,
+    0xa2, 0xa4, 0xa6, 0xa8, 0xa9, 0xab, 0xad, 0xaf, 0xb0, 0xb2, 0xb4, 0xb6, 0xb8, 0xba, 0xbb, 0xbd, 
+    0xbf, 0xc1, 0xc3, 0xc5, 0xc7, 0xc9, 0xcb, 0xcd, 0xcf, 0xd1, 0xd3, 0xd5, 0xd7, 0xd9, 0xdb, 0xdd,
+    0xdf, 0xe1, 0xe3, 0xe5, 0xe7, 0xe9, 0xeb, 0xed, 0xef, 0xf1, 0xf4, 0xf6, 0xf8, 0xfa, 0xfc, 0xff
+};
+
+// Lightness lookup table
+const unsigned char LIGHTNESS[256] = {
+    0x00, 0x05, 0x11, 0x1a, 0x21, 0x26, 0x2b, 0x30, 0x34, 0x38, 0x3b, 0x3e, 0x41, 0x44, 0x47, 0x4a,
+    0x4c, 0x4f, 0x51, 0x53, 0x55, 0x57, 0x59, 0x5b, 0x5d, 0x5f, 0x61, 0x63, 0x64, 0x66, 0x68, 0x69,
+    0x6b, 0x6c, 0x6e, 0x6f, 0x71, 0x72, 0x74, 0x75, 0x76, 0x78, 0x79, 0x7a, 0x7b, 0x7d, 0x7e, 0x7f,
+    0x80, 0x81, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x8b, 0x8c, 0x8d, 0x8e, 0x8f, 0x90,
+    0x91, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0x9b, 0x9b, 0x9c, 0x9d, 0x9e, 0x9f,
+    0xa0, 0xa1, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xa9, 0xaa, 0xab, 0xac,
+    0xac, 0xad, 0xae, 0xae, 0xaf, 0xb0, 0xb1, 0xb1, 0xb2, 0xb3, 0xb3, 0xb4, 0xb5, 0xb6, 0xb6, 0xb7,
+    0xb8, 0xb8, 0xb9, 0xba, 0xba, 0xbb, 0xbb, 0xbc, 0xbd, 0xbd, 0xbe, 0xbf, 0xbf, 0xc0, 0xc1, 0xc1,
+    0xc2, 0xc2, 0xc3, 0xc4, 0xc4, 0xc5, 0xc5, 0xc6, 0xc7, 0xc7, 0xc8, 0xc8, 0xc9, 0xc9, 0xca, 0xcb,
+    0xcb, 0xcc, 0xcc, 0xcd, 0xcd, 0xce, 0xcf, 0xcf, 0xd0, 0xd0, 0xd1, 0xd1, 0xd2, 0xd2, 0xd3, 0xd3,
+    0xd4, 0xd4, 0xd5, 0xd6, 0xd6, 0xd7, 0xd7, 0xd8, 0xd8, 0xd9, 0xd9, 0xda, 0xda, 0xdb, 0xdb, 0xdc,
+    0xdc, 0xdd, 0xdd, 0xde, 0xde, 0xdf, 0xdf, 0xe0, 0xe0, 0xe0, 0xe1, 0xe1, 0xe2, 0xe2, 0xe3, 0xe3,
+    0xe4, 0xe4, 0xe5, 0xe5, 0xe6, 0xe6, 0xe7, 0xe7, 0xe7, 0xe8, 0xe8, 0xe9, 0xe9, 0xea, 0xea, 0xeb,
+    0xeb, 0xec, 0xec, 0xec, 0xed, 0xed, 0xee, 0xee, 0xef, 0xef, 0xef, 0xf0, 0xf0, 0xf1, 0xf1, 0xf2,
+    0xf2, 0xf2, 0xf3, 0xf3, 0xf4, 0xf4, 0xf4, 0xf5, 0xf5, 0xf6, 0xf6, 0xf7, 0xf7, 0xf7, 0xf8, 0xf8,
+    0xf9, 0xf9, 0xf9, 0xfa, 0xfa, 0xfb, 0xfb, 0xfb, 0xfc, 0xfc, 0xfd, 0xfd, 0xfd, 0xfe, 0xfe, 0xff
+};
+
+// writes all pending buffers, output failure is sticky and reported at the end of job
+void output_flush(struct output *out) {
+    struct iovec *iov = &out->iov[1];
+    unsigned int iovcnt = out->iovcnt;
+    if (iovcnt != 0) {
+        ++out->flushes;
+    }
+
+    if (out->framed == 1 && iovcnt != 0) {
+        unsigned long length = 0;
+        for (unsigned int i = 0; i != iovcnt; ++i) {
+            length += iov[i].iov_len;
+        }
+        out->frame[0] = length & 0xff;
+        out->frame[1] = length >> 8 & 0xff;
+        out->frame[2] = length >> 16 & 0xff;
+        out->frame[3] = length >> 24 & 0xff;
+        --iov;
+        ++iovcnt;
+        iov->iov_base = out->frame;
+        iov->iov_len = 4;
+    }
+
+    while (iovcnt != 0 && out->failed == 0) {
+        if (out->write) {
+            // library context, buffers are handed to the caller one by one
+            if (out->write(out->user, (const unsigned char *)iov->iov_base, iov->iov_len) != 0) {
+                out->failed = 1;
+            }
+            ++iov;
+            --iovcnt;
+            ++out->writes;
+            if (out->written == 0.0) {
+                out->written = clock_seconds();
+            }
+            continue;
+        }
+#ifdef _WIN32
+        if (fwrite(iov->iov_base, 1, iov->iov_len, out->stream) != iov->iov_len) {
+            out->failed = 1;
+        }
+        ++iov;
+        --iovcnt;
+        if (iovcnt == 0 && fflush(out->stream) != 0) {
+            out->failed = 1;
+        }
+        ++out->writes;
+        if (out->written == 0.0) {
+            out->written = clock_seconds();
+        }
+#else
+        ssize_t n = writev(out->fd, iov, iovcnt);
+        if (n < 0) {
+            if (errno != EINTR) {
+                out->failed = 1;
+            }
+            continue;
+        }
+        ++out->writes;
+        if (out->written == 0.0) {
+            out->written = clock_seconds();
+        }
+
+        // partial write, skip written buffers
+        while (iovcnt != 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            ++iov;
+            --iovcnt;
+        }
+        if (iovcnt != 0) {
+            iov->iov_base = (unsigned char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+#endif
+    }
+
+    out->iovcnt = 0;
+    out->headercnt = 0;
+    for (unsigned int i = 0; i != out->heldcnt; ++i) {
+        pool_free(out->held[i]), out->held[i] = NULL;
+    }
+    out->heldcnt = 0;
+}
+
+// buffer has to stay valid until output_flush() is called
+void print(struct output *out, const unsigned char *buffer, const unsigned int length) {
+    if (out->iovcnt == OUTPUT_IOVS - 1) {
+        output_flush(out);
+    }
+    ++out->iovcnt;
+    out->iov[out->iovcnt].iov_base = (void *)buffer;
+    out->iov[out->iovcnt].iov_len = length;
+    out->bytes += length;
+}
+
+// passes a printed buffer to the output layer, it is freed when it is written
+static void output_hold(struct output *out, void *buffer) {
+    if (out->heldcnt == out->heldsize) {
+        const unsigned int size = out->heldsize ? 2 * out->heldsize : 16;
+        void **held = (void **)realloc(out->held, size * sizeof(void *));
+        if (!held) {
+            // no room to keep it, write it right now
+            output_flush(out);
+            pool_free(buffer);
+            return;
+        }
+        out->held = held;
+        out->heldsize = size;
+    }
+    out->held[out->heldcnt++] = buffer;
+}
+
+// convert RGBA to greyscale, collects a histogram for HEA
+static void rgba_to_grey(unsigned char *img_grey, const unsigned char *img_rgba, const unsigned int size, unsigned int *histogram) {
+    grey_convert(img_grey, img_rgba, size);
+
+    // prepare a histogram for HEA
+    for (unsigned int i = 0; i != size; ++i) {
+        ++histogram[img_grey[i]];
+    }
+}
+
+// -p hints
+static void photo_hints(const struct config *cfg, const unsigned int *histogram) {
+    unsigned int colors = 0;
+    for (unsigned int i = 0; i != 256; ++i) {
+        if (histogram[i] > 0) {
+            ++colors;
+        }
+    }
+    if (colors < 16 && cfg->photo == 1) {
+        report(cfg->report, "Image seems to be B/W. -p is probably not good option this time");
+    }
+    if (colors >= 16 && cfg->photo == 0) {
+        report(cfg->report, "Image seems to be greyscale or colored. Maybe you should use options -p and -t for better results");
+    }
+}
+
+// compress bytes into bitmap, line by line
+static void bitmap(unsigned char *img_bw, const unsigned char *img_grey, const unsigned int img_w, const unsigned int canvas_w, const unsigned int img_h, const unsigned int threshold, const unsigned int rotate) {
+    for (unsigned int y = 0; y != img_h; ++y) {
+        // upside down rotation = reversed order of lines and mirrored lines
+        const unsigned int src = rotate == 1 ? img_h - 1 - y : y;
+        grey_pack_line(&img_bw[y * (canvas_w >> 3)], &img_grey[src * img_w], img_w, threshold, rotate);
+    }
+}
+
+// upside down rotation of bitmap in place = reversed order of lines and mirrored lines
+static void bitmap_rotate(unsigned char *img_bw, const unsigned int img_w, const unsigned int canvas_w, const unsigned int img_h) {
+    const unsigned int n = canvas_w >> 3;
+    unsigned char line[PROFILE_MAX_WIDTH >> 3];
+    for (unsigned int y = 0; y < img_h - 1 - y; ++y) {
+        unsigned char *top = &img_bw[y * n];
+        unsigned char *bottom = &img_bw[(img_h - 1 - y) * n];
+        grey_mirror_bw_line(line, top, img_w);
+        grey_mirror_bw_line(top, bottom, img_w);
+        memcpy(bottom, line, n);
+    }
+    if (img_h & 1) {
+        unsigned char *middle = &img_bw[(img_h >> 1) * n];
+        grey_mirror_bw_line(line, middle, img_w);
+        memcpy(middle, line, n);
+    }
+}
+
+// lightness of every sample value of grey or palette image decoded at its native depth,
+// the same grey_scalar gives for its RGBA expansion (color key and palette alpha included);
+// convert is grey_scalar, or grey_linear for luminance of --fit
+static void samples_grey(unsigned char *map, const LodePNGColorMode *color, const grey_kernel convert) {
+    const unsigned int values = 1u << color->bitdepth;
+    unsigned char rgba[256 * 4];
+    for (unsigned int v = 0; v != values; ++v) {
+        unsigned char *p = &rgba[v << 2];
+        if (color->colortype == LCT_PALETTE) {
+            if (v < color->palettesize) {
+                memcpy(p, &color->palette[v << 2], 4);
+            } else {
+                // index out of palette is black
+                p[0] = p[1] = p[2] = 0;
+                p[3] = 0xff;
+            }
+        } else {
+            p[0] = p[1] = p[2] = v * 255 / (values - 1);
+            p[3] = color->key_defined && v == color->key_r ? 0 : 0xff;
+        }
+    }
+    convert(map, rgba, values);
+}
+
+// -p hints of image decoded at its native depth, only presence of each lightness is marked in histogram
+static void samples_histogram(unsigned int *histogram, const unsigned char *samples, const size_t pixels, const unsigned int depth, const unsigned char *map) {
+    const unsigned int mask = (1u << depth) - 1;
+    unsigned char seen[256] = { 0 };
+    const size_t full = pixels * depth >> 3;
+    for (size_t i = 0; i != full; ++i) {
+        seen[samples[i]] = 1;
+    }
+    for (unsigned int b = 0; b != 256; ++b) {
+        for (unsigned int shift = 8; seen[b] && shift != 0; shift -= depth) {
+            histogram[map[(b >> (shift - depth)) & mask]] = 1;
+        }
+    }
+    // pixels of the last, partial byte
+    for (unsigned int i = 0, shift = 8; i != (pixels * depth & 7) / depth; ++i, shift -= depth) {
+        histogram[map[(samples[full] >> (shift - depth)) & mask]] = 1;
+    }
+}
+
+// left offset
+static unsigned int left_offset(const struct profile *profile, const unsigned int canvas_w, const char align) {
+    unsigned int offset = 0;
+    switch (align) {
+        case 'C':
+            offset = (profile->width - canvas_w) >> 1;
+            break;
+
+        case 'R':
+            offset = profile->width - canvas_w;
+            break;
+
+        case 'L':
+        case '?':
+        default:
+            offset = 0;
+    }
+
+    // offset have to be a multiple of 8
+    return (offset >> 3) << 3;
+}
+
+// one chunk of k lines, at most one band of the printer (profile_band), bitmap is referenced until the output is flushed
+static void print_band(struct output *out, const unsigned char *img_bw, const unsigned int canvas_w, const unsigned int k, const unsigned int offset) {
+    if (out->headercnt == OUTPUT_HEADERS || out->iovcnt > OUTPUT_IOVS - 4) {
+        output_flush(out);
+    }
+
+    unsigned char *header = out->headers[out->headercnt++];
+    unsigned int header_length = 0;
+    // trimmed bands of -e move the left margin, so it is set whenever it changes
+    if (out->elide == 1 ? offset != out->margin : offset != 0) {
+        memcpy(header, ESC_OFFSET, ESC_OFFSET_LENGTH);
+        header[2] = offset & 0xff;
+        header[3] = offset >> 8 & 0xff;
+        header_length = ESC_OFFSET_LENGTH;
+        out->margin = offset;
+    }
+
+    unsigned char *store = &header[header_length];
+    const unsigned int f112_p = 10 + k * (canvas_w >> 3);
+    memcpy(store, ESC_STORE, ESC_STORE_LENGTH);
+    store[ 3] = f112_p & 0xff;
+    store[ 4] = f112_p >> 8 & 0xff;
+    store[13] = canvas_w & 0xff;
+    store[14] = canvas_w >> 8 & 0xff;
+    store[15] = k & 0xff;
+    store[16] = k >> 8 & 0xff;
+    header_length += ESC_STORE_LENGTH;
+
+    print(out, header, header_length);
+    print(out, img_bw, k * (canvas_w >> 3));
+    print(out, ESC_FLUSH, ESC_FLUSH_LENGTH);
+    ++out->bands;
+    if (out->policy == 'B') {
+        output_flush(out);
+    }
+}
+
+// -e, a part of compacted bitmap: feed blank rows, then print a band of rows trimmed to width bytes starting at byte left
+struct segment {
+    unsigned int feed;
+    unsigned int rows;
+    unsigned int left;
+    unsigned int width;
+};
+
+// a run of blank rows between bands is elided if the rows are longer than the band header it costs
+#define ELIDE_MIN_BYTES (ESC_OFFSET_LENGTH + ESC_STORE_LENGTH + ESC_FLUSH_LENGTH + ESC_FEED_LENGTH)
+
+// -e, replaces runs of blank rows by paper feed and trims blank byte columns of each band,
+// bitmap is compacted in place; returns segments (count of them in *count) or NULL if there is not enough memory;
+// rows are scanned by kernels of their width (profile_rows)
+static struct segment* compact(const struct profile *profile, unsigned char *img_bw, const unsigned int canvas_w, const unsigned int img_h, unsigned int *count) {
+    const unsigned int row_bytes = canvas_w >> 3;
+    const unsigned int band = profile_band(profile, canvas_w);
+    const struct profile_rows *rows = profile_rows(row_bytes);
+    unsigned char columns[PROFILE_MAX_WIDTH >> 3];
+    unsigned int size = 16;
+    unsigned int n = 0;
+    unsigned int feed = 0;
+    unsigned char *dst = img_bw;
+
+    struct segment *segments = (struct segment *)malloc(size * sizeof(struct segment));
+    if (!segments) {
+        return NULL;
+    }
+
+    for (unsigned int y = 0; y != img_h;) {
+        // leading and trailing runs are always fed, runs between bands only if it pays off
+        unsigned int b = y;
+        while (b != img_h && rows->blank(&img_bw[b * row_bytes], row_bytes)) {
+            ++b;
+        }
+        if (b != y && (y == 0 || b == img_h || (b - y) * row_bytes > ELIDE_MIN_BYTES)) {
+            feed += b - y;
+            y = b;
+            continue;
+        }
+
+        // band ends at rows of a band of the printer or at a run of blank rows worth eliding
+        const unsigned int max = img_h - y < band ? img_h : y + band;
+        unsigned int end = y;
+        while (end != max) {
+            if (!rows->blank(&img_bw[end * row_bytes], row_bytes)) {
+                ++end;
+                continue;
+            }
+            unsigned int e = end;
+            while (e != img_h && rows->blank(&img_bw[e * row_bytes], row_bytes)) {
+                ++e;
+            }
+            if (end != y && (e == img_h || (e - end) * row_bytes > ELIDE_MIN_BYTES)) {
+                break;
+            }
+            end = e < max ? e : max;
+        }
+
+        // trim blank byte columns, rows of the band are ORed into columns
+        rows->columns(columns, &img_bw[y * row_bytes], end - y, row_bytes);
+        unsigned int left = 0;
+        unsigned int right = row_bytes;
+        while (left != row_bytes && columns[left] == 0x00) {
+            ++left;
+        }
+        while (right > left && columns[right - 1] == 0x00) {
+            --right;
+        }
+        if (left == right) {
+            // short blank run cut by the end of a band
+            feed += end - y;
+            y = end;
+            continue;
+        }
+
+        if (n == size) {
+            size *= 2;
+            struct segment *grown = (struct segment *)realloc(segments, size * sizeof(struct segment));
+            if (!grown) {
+                free(segments);
+                return NULL;
+            }
+            segments = grown;
+        }
+        const unsigned int width = right - left;
+        segments[n].feed = feed;
+        segments[n].rows = end - y;
+        segments[n].left = left;
+        segments[n].width = width;
+        ++n;
+        feed = 0;
+
+        // compacted data never overtake the rows still to be read
+        for (; y != end; ++y) {
+            memmove(dst, &img_bw[y * row_bytes + left], width);
+            dst += width;
+        }
+    }
+
+    if (feed != 0) {
+        if (n == size) {
+            struct segment *grown = (struct segment *)realloc(segments, (size + 1) * sizeof(struct segment));
+            if (!grown) {
+                free(segments);
+                return NULL;
+            }
+            segments = grown;
+        }
+        segments[n].feed = feed;
+        segments[n].rows = 0;
+        segments[n].left = 0;
+        segments[n].width = 0;
+        ++n;
+    }
+
+    *count = n;
+    return segments;
+}
+
+// bytes of paper feed commands for given number of rows
+static unsigned long feed_length(const struct profile *profile, const unsigned int rows) {
+    const unsigned long units = (unsigned long)rows * profile->dot_feed;
+    return (units + 254) / 255 * ESC_FEED_LENGTH;
+}
+
+// bytes saved by compaction, compared to plain bands of the same bitmap
+static long compact_saved(const struct profile *profile, const unsigned int canvas_w, const unsigned int img_h, const unsigned int offset, const struct segment *segments, const unsigned int count) {
+    const unsigned int band = profile_band(profile, canvas_w);
+    const unsigned int bands = (img_h + band - 1) / band;
+    long saved = (long)bands * ((offset != 0 ? ESC_OFFSET_LENGTH : 0) + ESC_STORE_LENGTH + ESC_FLUSH_LENGTH) + (long)img_h * (canvas_w >> 3);
+    unsigned int margin = ~0u;
+    for (unsigned int i = 0; i != count; ++i) {
+        saved -= feed_length(profile, segments[i].feed);
+        if (segments[i].rows != 0) {
+            const unsigned int band_offset = offset + (segments[i].left << 3);
+            if (band_offset != margin) {
+                saved -= ESC_OFFSET_LENGTH;
+                margin = band_offset;
+            }
+            saved -= ESC_STORE_LENGTH + ESC_FLUSH_LENGTH + (long)segments[i].rows * segments[i].width;
+        }
+    }
+    return saved;
+}
+
+// feeds paper by rows of dots instead of printing blank rows
+static void print_feed(struct output *out, const unsigned int rows) {
+    unsigned long units = (unsigned long)rows * out->profile->dot_feed;
+    while (units != 0) {
+        if (out->headercnt == OUTPUT_HEADERS || out->iovcnt > OUTPUT_IOVS - 2) {
+            output_flush(out);
+        }
+        unsigned char *feed = out->headers[out->headercnt++];
+        unsigned int length = 0;
+        for (; units != 0 && length + ESC_FEED_LENGTH <= OUTPUT_HEADER_LENGTH; length += ESC_FEED_LENGTH) {
+            const unsigned int n = units > 255 ? 255 : units;
+            memcpy(&feed[length], ESC_FEED, ESC_FEED_LENGTH);
+            feed[length + 2] = n;
+            units -= n;
+        }
+        print(out, feed, length);
+    }
+}
+
+// prints compacted bitmap, bitmap is referenced until the output is flushed;
+// the margin is set by the first band, so the output does not depend on what has been printed before
+static void print_segments(struct output *out, const unsigned char *img_bw, const struct segment *segments, const unsigned int count, const unsigned int offset) {
+    out->margin = ~0u;
+    for (unsigned int i = 0; i != count; ++i) {
+        const struct segment *segment = &segments[i];
+        if (segment->feed != 0) {
+            print_feed(out, segment->feed);
+        }
+        if (segment->rows != 0) {
+            print_band(out, img_bw, segment->width << 3, segment->rows, offset + (segment->left << 3));
+            img_bw += segment->rows * segment->width;
+        }
+    }
+}
+
+// prints a band of -s, compacted with -e; band is flushed by the caller before it is reused
+static int print_stream_band(struct output *out, unsigned char *band_bw, const unsigned int canvas_w, const unsigned int k, const unsigned int offset) {
+    if (out->elide == 0) {
+        print_band(out, band_bw, canvas_w, k, offset);
+        return 0;
+    }
+
+    unsigned int count = 0;
+    struct segment *segments = compact(out->profile, band_bw, canvas_w, k, &count);
+    if (!segments) {
+        report(out->report, "Could not allocate enough memory");
+        return 1;
+    }
+    print_segments(out, band_bw, segments, count, offset);
+    out->saved += compact_saved(out->profile, canvas_w, k, offset, segments, count);
+    free(segments), segments = NULL;
+    return 0;
+}
+
+// -s pipeline, RGBA lines decoded in a slot of STREAM_LINES lines
+#define STREAM_LINES 16u
+#define STREAM_LINE_SLOTS 4u
+// B/W bands converted ahead of the writer
+#define STREAM_BAND_SLOTS 3u
+
+// -s pipeline: decoder thread -> slots of RGBA lines -> raster thread -> slots of B/W bands -> writer (calling thread);
+// stages overlap, so the first band is written while the rest of image is still being decoded and dithered
+struct stream {
+    struct config *cfg;
+    struct pngstream *png;
+    struct stats *stats;
+    unsigned int img_w;
+    unsigned int img_h;
+    unsigned int canvas_w;
+    // rows of a band (profile_band)
+    unsigned int band;
+    // decoder -> raster, error of decoder (pngstream)
+    struct queue lines;
+    unsigned char *lines_rgba;
+    unsigned int error;
+    // raster -> writer, rows of each band, raster failed (memory)
+    struct queue bands;
+    unsigned char *bands_bw;
+    unsigned int rows[STREAM_BAND_SLOTS];
+    unsigned int failed;
+    // photo mode, band + two lines ahead for dithering
+    unsigned char *band_grey;
+    const unsigned char *equalize;
+    unsigned int *histogram;
+    // slot of lines being converted by raster and its next line
+    int slot;
+    unsigned int line;
+};
+
+static void* stream_decoder(void *arg) {
+    struct stream *s = (struct stream *)arg;
+    const size_t slot_size = (size_t)STREAM_LINES * s->img_w * 4;
+
+    for (unsigned int y = 0; y < s->img_h; y += STREAM_LINES) {
+        const int slot = queue_reserve(&s->lines);
+        if (slot < 0) {
+            break;
+        }
+        const unsigned int n = s->img_h - y < STREAM_LINES ? s->img_h - y : STREAM_LINES;
+        const double t = stage_clock(s->stats);
+        if ((s->error = pngstream_read(s->png, &s->lines_rgba[slot * slot_size], n)) != 0) {
+            break;
+        }
+        stage_end(s->stats, STAGE_DECODE, t);
+        queue_push(&s->lines);
+    }
+    queue_close(&s->lines);
+    return NULL;
+}
+
+// next decoded line, NULL if decoder failed; slot of the previous line is released, it has been converted already
+static const unsigned char* stream_line(struct stream *s) {
+    if (s->slot < 0 || s->line == STREAM_LINES) {
+        if (s->slot >= 0) {
+            queue_pop(&s->lines);
+        }
+        if ((s->slot = queue_front(&s->lines)) < 0) {
+            return NULL;
+        }
+        s->line = 0;
+    }
+    return &s->lines_rgba[((size_t)s->slot * STREAM_LINES + s->line++) * s->img_w * 4];
+}
+
+static void* stream_raster(void *arg) {
+    struct stream *s = (struct stream *)arg;
+    const struct config *cfg = s->cfg;
+    struct stats *stats = s->stats;
+    const unsigned int img_w = s->img_w;
+    const unsigned int img_h = s->img_h;
+    const unsigned int canvas_w = s->canvas_w;
+    const size_t band_size = (size_t)(canvas_w >> 3) * s->band;
+    const unsigned char *line_rgba = NULL;
+
+    // chunking, l = lines already converted, currently processing a chunk of height k,
+    // lines [0; ready) of band_grey are already decoded
+    unsigned int ready = 0;
+    for (unsigned int l = 0, k = s->band; l < img_h; l += k) {
+        if (k > img_h - l) {
+            k = img_h - l;
+        }
+
+        const int slot = queue_reserve(&s->bands);
+        if (slot < 0) {
+            // writer failed
+            goto fail;
+        }
+        unsigned char *band_bw = &s->bands_bw[slot * band_size];
+        double t = stage_clock(stats);
+
+        if (cfg->photo == 0) {
+            // fused conversion straight into bitmap
+            for (unsigned int y = 0; y != k; ++y) {
+                if (!(line_rgba = stream_line(s))) {
+                    goto fail;
+                }
+                t = stage_clock(stats);
+                grey_bw_line(&band_bw[y * (canvas_w >> 3)], line_rgba, img_w, cfg->threshold, 0, s->histogram);
+                t = stage_end(stats, STAGE_PACK, t);
+            }
+        } else {
+            const unsigned int avail = img_h - l < k + 2 ? img_h - l : k + 2;
+            for (; ready != avail; ++ready) {
+                if (!(line_rgba = stream_line(s))) {
+                    goto fail;
+                }
+                t = stage_clock(stats);
+                unsigned char *line_grey = &s->band_grey[ready * img_w];
+                rgba_to_grey(line_grey, line_rgba, img_w, s->histogram);
+                t = stage_end(stats, STAGE_GREY, t);
+                for (unsigned int i = 0; i != img_w; ++i) {
+                    line_grey[i] = s->equalize[line_grey[i]];
+                }
+                t = stage_end(stats, STAGE_EQUALIZE, t);
+            }
+
+            if (cfg->dither != DITHER_ATKINSON) {
+                // ordered dithering packs the band straight into bitmap, matrix continues from the previous band
+                if (dither_ordered(band_bw, s->band_grey, img_w, canvas_w, k, l, cfg->dither, cfg->threshold, 0, cfg->dither_jobs) != 0) {
+                    s->failed = 1;
+                    goto fail;
+                }
+                t = stage_end(stats, STAGE_DITHER, t);
+            } else {
+                if (dither_atkinson(s->band_grey, img_w, k, avail, cfg->threshold, cfg->dither_jobs) != 0) {
+                    s->failed = 1;
+                    goto fail;
+                }
+                t = stage_end(stats, STAGE_DITHER, t);
+                bitmap(band_bw, s->band_grey, img_w, canvas_w, k, cfg->threshold, cfg->rotate);
+                t = stage_end(stats, STAGE_PACK, t);
+            }
+
+            // lines ahead have already been touched by dithering, keep them for the next chunk
+            memmove(s->band_grey, &s->band_grey[k * img_w], (avail - k) * img_w);
+            ready = avail - k;
+        }
+
+        s->rows[slot] = k;
+        queue_push(&s->bands);
+    }
+
+fail:
+    // decoder stops as well, if it has not finished yet
+    queue_close(&s->lines);
+    queue_close(&s->bands);
+    return NULL;
+}
+
+// -s, decodes input line by line and prints it band by band, so only a few bands of image are held in memory;
+// photo mode needs a histogram of whole image in advance, therefore the input is decoded twice
+// returns 0 on success, -1 if the image can not be streamed (caller falls back to full decode)
+int convert_stream(struct config *cfg, struct output *out, const char *input, const unsigned char *data, size_t size, struct stats *stats) {
+    int ret = 1;
+    FILE *fin = NULL;
+    struct pngstream *png = NULL;
+    unsigned char *lines_rgba = NULL;
+    unsigned char *band_grey = NULL;
+    unsigned char *bands_bw = NULL;
+    pthread_t threads[2];
+    unsigned int started = 0;
+    struct stream s = { .png = NULL };
+
+    unsigned int histogram[256] = { 0 };
+    unsigned char equalize[256];
+
+    // standard input, PBM, PGM and raw images are read as a whole, they are not decoded anyway
+    if (cfg->raw_width != 0 || (!data && strcmp(input, "-") == 0)) {
+        return -1;
+    }
+#ifdef _WIN32
+    // no fmemopen(3), PNG in memory is decoded as a whole
+    if (data) {
+        return -1;
+    }
+#endif
+    if (stats) {
+        stats->begin = stage_clock(stats);
+        stats->job = cfg->job_memory;
+    }
+
+    png = (struct pngstream *)calloc(1, sizeof(struct pngstream));
+    if (!png) {
+        report(cfg->report, "Could not allocate enough memory");
+        stage_failed(stats, STAGE_DECODE);
+        goto fail;
+    }
+    stats_memory(stats, sizeof(struct pngstream));
+
+#ifdef _WIN32
+    fin = fopen(input, "rb");
+#else
+    fin = data ? fmemopen((void *)data, size, "rb") : fopen(input, "rb");
+#endif
+    if (!fin) {
+        report(cfg->report, "Could not load and process input PNG file, %s", "failed to open file for reading");
+        stage_failed(stats, STAGE_DECODE);
+        goto fail;
+    }
+    unsigned char magic[2];
+    if (fread(magic, 1, 2, fin) == 2 && pnm_format(magic) != 0) {
+        ret = -1;
+        goto fail;
+    }
+    rewind(fin);
+    if (stats && fseek(fin, 0, SEEK_END) == 0) {
+        const long length = ftell(fin);
+        stats->input = length > 0 ? length : 0;
+        rewind(fin);
+    }
+
+    for (unsigned int pass = cfg->photo == 1 ? 0 : 1; pass != 2; ++pass) {
+        unsigned int error = pngstream_open(png, fin);
+        if (error == PNGSTREAM_E_INTERLACED) {
+            ret = -1;
+            goto fail;
+        }
+        if (error) {
+            report(cfg->report, "Could not load and process input PNG file, %s", pngstream_error_text(error));
+            stage_failed(stats, STAGE_DECODE);
+            goto fail;
+        }
+
+        const unsigned int img_w = png->width;
+        const unsigned int img_h = png->height;
+        if (img_w > cfg->profile->width && cfg->fit != SCALE_NONE) {
+            // scaled down as a whole image
+            ret = -1;
+            goto fail;
+        }
+        if (img_w > cfg->profile->width) {
+            report(cfg->report, "Image width %u px exceeds the printer's capability (%u px)", img_w, cfg->profile->width);
+            stage_failed(stats, STAGE_PACK);
+            goto fail;
+        }
+
+        // canvas size is width of a picture rounded up to nearest multiple of 8
+        const unsigned int canvas_w = ((img_w + 7) >> 3) << 3;
+        const unsigned int band = profile_band(cfg->profile, canvas_w);
+
+        if (!lines_rgba) {
+            lines_rgba = (unsigned char *)pool_alloc((size_t)img_w * 4 * STREAM_LINES * STREAM_LINE_SLOTS);
+            bands_bw = (unsigned char *)pool_alloc((size_t)(canvas_w >> 3) * band * STREAM_BAND_SLOTS);
+            band_grey = cfg->photo == 1 ? (unsigned char *)pool_alloc((size_t)img_w * (band + 2)) : NULL;
+            if (!lines_rgba || !bands_bw || (cfg->photo == 1 && !band_grey)) {
+                report(cfg->report, "Could not allocate enough memory");
+                stage_failed(stats, STAGE_DECODE);
+                goto fail;
+            }
+            stats_memory(stats, (long)img_w * 4 * STREAM_LINES * STREAM_LINE_SLOTS + (canvas_w >> 3) * band * STREAM_BAND_SLOTS
+                + (cfg->photo == 1 ? img_w * (band + 2) : 0));
+            if (stats) {
+                stats->source = 'S';
+                stats->width = img_w;
+                stats->height = img_h;
+            }
+        }
+
+        if (pass == 0) {
+            // collect a histogram only
+            double t = stage_clock(stats);
+            for (unsigned int y = 0; y != img_h; ++y) {
+                if ((error = pngstream_read(png, lines_rgba, 1)) != 0) {
+                    report(cfg->report, "Could not load and process input PNG file, %s", pngstream_error_text(error));
+                    stage_failed(stats, STAGE_DECODE);
+                    goto fail;
+                }
+                t = stage_end(stats, STAGE_DECODE, t);
+                rgba_to_grey(band_grey, lines_rgba, img_w, histogram);
+                t = stage_end(stats, STAGE_GREY, t);
+            }
+            pngstream_close(png);
+            if (fseek(fin, 0, SEEK_SET) != 0) {
+                report(cfg->report, "Could not load and process input PNG file, %s", "input is not seekable");
+                stage_failed(stats, STAGE_DECODE);
+                goto fail;
+            }
+
+            photo_hints(cfg, histogram);
+
+            // Histogram Equalization Algorithm
+            t = stage_clock(stats);
+            const unsigned int img_grey_size = img_h * img_w;
+            for (unsigned int i = 1; i != 256; ++i) {
+                histogram[i] += histogram[i - 1];
+            }
+            for (unsigned int i = 0; i != 256; ++i) {
+                equalize[i] = 255 * histogram[i] / img_grey_size;
+            }
+            stage_end(stats, STAGE_EQUALIZE, t);
+            cfg->threshold = 255 * histogram[cfg->threshold] / img_grey_size;
+            report(cfg->report, "Threshold shift, new value = %d", cfg->threshold);
+            continue;
+        }
+
+        s.cfg = cfg;
+        s.png = png;
+        s.stats = stats;
+        s.img_w = img_w;
+        s.img_h = img_h;
+        s.canvas_w = canvas_w;
+        s.band = band;
+        s.lines_rgba = lines_rgba;
+        s.bands_bw = bands_bw;
+        s.band_grey = band_grey;
+        s.equalize = equalize;
+        s.histogram = histogram;
+        s.slot = -1;
+        queue_init(&s.lines, STREAM_LINE_SLOTS);
+        queue_init(&s.bands, STREAM_BAND_SLOTS);
+
+        if (pthread_create(&threads[0], NULL, stream_decoder, &s) != 0) {
+            report(cfg->report, "Could not start worker threads");
+            stage_failed(stats, STAGE_DECODE);
+            goto fail;
+        }
+        ++started;
+        if (pthread_create(&threads[1], NULL, stream_raster, &s) != 0) {
+            queue_close(&s.lines);
+            report(cfg->report, "Could not start worker threads");
+            stage_failed(stats, STAGE_DECODE);
+            goto fail;
+        }
+        ++started;
+
+        // writer, bands are written as soon as they are converted
+        const unsigned int offset = left_offset(cfg->profile, canvas_w, cfg->align);
+        const size_t band_size = (size_t)(canvas_w >> 3) * band;
+        int slot;
+        while ((slot = queue_front(&s.bands)) >= 0) {
+            const double t = stage_clock(stats);
+            const unsigned int k = s.rows[slot];
+            if (print_stream_band(out, &bands_bw[slot * band_size], canvas_w, k, offset) != 0) {
+                queue_close(&s.bands);
+                stage_failed(stats, STAGE_EMIT);
+                goto fail;
+            }
+            // band is reused for the next one
+            output_flush(out);
+            stage_end(stats, STAGE_EMIT, t);
+            queue_pop(&s.bands);
+        }
+        for (; started != 0; --started) {
+            pthread_join(threads[started - 1], NULL);
+        }
+
+        if (s.error != 0) {
+            report(cfg->report, "Could not load and process input PNG file, %s", pngstream_error_text(s.error));
+            stage_failed(stats, STAGE_DECODE);
+            goto fail;
+        }
+        if (s.failed != 0) {
+            report(cfg->report, "Could not allocate enough memory");
+            stage_failed(stats, STAGE_DITHER);
+            goto fail;
+        }
+
+        if (cfg->photo == 0) {
+            // raster has finished, its histogram is complete
+            photo_hints(cfg, histogram);
+        }
+    }
+
+    ret = 0;
+
+fail:
+    for (; started != 0; --started) {
+        pthread_join(threads[started - 1], NULL);
+    }
+    if (png) {
+        pngstream_close(png);
+    }
+    free(png), png = NULL;
+    if (stats) {
+        stats_memory(stats, -(long)stats->memory);
+    }
+    pool_free(band_grey), band_grey = NULL;
+    pool_free(lines_rgba), lines_rgba = NULL;
+    pool_free(bands_bw), bands_bw = NULL;
+    if (fin) {
+        fclose(fin), fin = NULL;
+    }
+    return ret;
+}
+
+// -j, input files are rasterized by a pool of worker threads and printed by main thread
+// in command line order; at most window files are rasterized ahead of the printed one
+
+struct batch_item {
+    struct raster raster;
+    unsigned int state;
+    // threshold shifted by photo mode, the next file starts from it
+    unsigned int threshold;
+    unsigned int threshold_ready;
+};
+
+struct batch {
+    struct config *cfg;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    const char *const *inputs;
+    unsigned int count;
+    struct batch_item *items;
+    unsigned int next;
+    unsigned int printed;
+    unsigned int window;
+    unsigned int failed;
+};
+
+// threshold the file of given index starts from, in photo mode it depends on all preceding files;
+// returns a value > 255 if a preceding file failed
+static unsigned int threshold_wait(const struct config *cfg, struct batch *batch, const unsigned int index) {
+    if (!batch || index == 0) {
+        return cfg->threshold;
+    }
+
+    const struct batch_item *prev = &batch->items[index - 1];
+    pthread_mutex_lock(&batch->lock);
+    while (!prev->threshold_ready && prev->state != BATCH_FAILED && !batch->failed) {
+        pthread_cond_wait(&batch->cond, &batch->lock);
+    }
+    const unsigned int threshold = prev->threshold_ready ? prev->threshold : ~0u;
+    pthread_mutex_unlock(&batch->lock);
+    return threshold;
+}
+
+static void threshold_publish(struct config *cfg, struct batch *batch, const unsigned int index, const unsigned int threshold) {
+    if (!batch) {
+        cfg->threshold = threshold;
+        return;
+    }
+
+    pthread_mutex_lock(&batch->lock);
+    batch->items[index].threshold = threshold;
+    batch->items[index].threshold_ready = 1;
+    pthread_cond_broadcast(&batch->cond);
+    pthread_mutex_unlock(&batch->lock);
+}
+
+// prints bitmap chunked into bands, bitmap stays owned by raster
+static void print_bands(struct output *out, const struct raster *raster) {
+    const unsigned int canvas_w = raster->canvas_w;
+    const unsigned int img_h = raster->img_h;
+    const unsigned int offset = raster->offset;
+
+    if (raster->segments) {
+        print_segments(out, raster->img_bw, raster->segments, raster->segmentcnt, offset);
+        return;
+    }
+
+    // chunking, l = lines already printed, currently processing a chunk of height k
+    for (unsigned int l = 0, k = profile_band(out->profile, canvas_w); l < img_h; l += k) {
+        if (k > img_h - l) {
+            k = img_h - l;
+        }
+
+        print_band(out, &raster->img_bw[l * (canvas_w >> 3)], canvas_w, k, offset);
+    }
+}
+
+// everything the ESC/POS output depends on besides PNG data itself
+static unsigned int cache_options(unsigned char *options, const struct config *cfg, const unsigned int threshold) {
+    unsigned int length = 0;
+    // bumped whenever conversion changes its output
+    options[length++] = 1;
+    options[length++] = cfg->photo;
+    options[length++] = cfg->rotate;
+    options[length++] = cfg->align;
+    options[length++] = threshold;
+    options[length++] = cfg->profile->width & 0xff;
+    options[length++] = cfg->profile->width >> 8 & 0xff;
+    options[length++] = cfg->profile->band_height & 0xff;
+    options[length++] = cfg->profile->band_height >> 8 & 0xff;
+    options[length++] = cfg->dither;
+    options[length++] = cfg->turn / 90;
+    options[length++] = cfg->fit;
+    if (profile_band(cfg->profile, cfg->profile->width) != cfg->profile->band_height) {
+        // print buffer limits bands only if it does not hold a band of full width
+        options[length++] = cfg->profile->buffer & 0xff;
+        options[length++] = cfg->profile->buffer >> 8 & 0xff;
+        options[length++] = cfg->profile->buffer >> 16 & 0xff;
+    }
+    return length;
+}
+
+// writes bands of a converted image into a new cache entry
+static void cache_put(const struct config *cfg, const unsigned char *key, const struct raster *raster, const unsigned int threshold) {
+    char *tmp = NULL;
+    const int fd = cache_store_begin(&tmp);
+    if (fd < 0) {
+        return;
+    }
+
+    struct output *out = (struct output *)calloc(1, sizeof(struct output));
+    if (!out) {
+        cache_store_end(key, fd, tmp, threshold, 0, 1);
+        return;
+    }
+    out->fd = fd;
+    out->policy = 'J';
+    out->elide = cfg->elide;
+    out->profile = cfg->profile;
+    print_bands(out, raster);
+    output_flush(out);
+    if (cache_store_end(key, fd, tmp, threshold, raster->saved, out->failed) != 0 && out->failed == 0) {
+        report(cfg->report, "Could not store cache entry, %s", strerror(errno));
+    }
+    free(out->held), out->held = NULL;
+    free(out), out = NULL;
+}
+
+// input files are read in chunks of this size, unless their size is known
+#define INPUT_CHUNK 65536u
+
+// opens input file, "-" is standard input
+static FILE* input_open(const char *input) {
+    if (strcmp(input, "-") == 0) {
+        return stdin;
+    }
+    return fopen(input, "rb");
+}
+
+// reads input file: PNG into memory as it is, PBM, PGM and raw images into rows of pixels (see pnm.h),
+// pnm->format is 0 for PNG
+static int input_load(const struct config *cfg, const char *input, unsigned char **data, size_t *size, struct pnm *pnm) {
+    int ret = 1;
+    unsigned char *buffer = NULL;
+    unsigned int error = 0;
+
+    memset(pnm, 0, sizeof(struct pnm));
+    FILE *fin = input_open(input);
+    if (!fin) {
+        report(cfg->report, "Could not open input file '%s'", input);
+        goto fail;
+    }
+
+    unsigned char magic[2];
+    size_t length = 0;
+    if (cfg->raw_width != 0) {
+        error = pnm_open(pnm, fin, PNM_RAW, cfg->raw_width, cfg->raw_height);
+    } else if ((length = fread(magic, 1, 2, fin)) == 2 && pnm_format(magic) != 0) {
+        error = pnm_open(pnm, fin, pnm_format(magic), 0, 0);
+    }
+    if (!error && pnm->format != 0) {
+        // height of a turned image is checked once it is loaded, an image to fit is scaled down
+        if (cfg->turn == 0 && cfg->fit == SCALE_NONE && pnm->width > cfg->profile->width) {
+            report(cfg->report, "Image width %u px exceeds the printer's capability (%u px)", pnm->width, cfg->profile->width);
+            goto fail;
+        }
+        error = pnm_load(pnm, data);
+    }
+    if (error) {
+        report(cfg->report, "Could not load and process input PNM file, %s", pnm_error_text(error));
+        goto fail;
+    }
+    if (pnm->format != 0) {
+        *size = (size_t)pnm->height * pnm->linebytes;
+        ret = 0;
+        goto fail;
+    }
+
+    // PNG is loaded as it is, size of a regular file is known in advance
+    size_t capacity = INPUT_CHUNK;
+    if (fin != stdin && fseek(fin, 0, SEEK_END) == 0) {
+        const long end = ftell(fin);
+        rewind(fin);
+        length = 0;
+        // one byte more, so the end of file is found without growing the buffer
+        capacity = end > 0 ? (size_t)end + 1 : INPUT_CHUNK;
+    }
+    buffer = (unsigned char *)pool_alloc(capacity);
+    if (!buffer) {
+        report(cfg->report, "Could not allocate enough memory");
+        goto fail;
+    }
+    memcpy(buffer, magic, length);
+    for (;;) {
+        if (length == capacity) {
+            unsigned char *b = (unsigned char *)pool_realloc(buffer, capacity << 1);
+            if (!b) {
+                report(cfg->report, "Could not allocate enough memory");
+                goto fail;
+            }
+            buffer = b;
+            capacity <<= 1;
+        }
+        const size_t n = fread(&buffer[length], 1, capacity - length, fin);
+        length += n;
+        if (n == 0) {
+            break;
+        }
+    }
+    if (ferror(fin)) {
+        report(cfg->report, "Could not read input file '%s'", input);
+        goto fail;
+    }
+    *data = buffer, buffer = NULL;
+    *size = length;
+    ret = 0;
+
+fail:
+    pool_free(buffer), buffer = NULL;
+    if (fin && fin != stdin) {
+        fclose(fin), fin = NULL;
+    }
+    return ret;
+}
+
+// decodes input file (or PNG in memory if png is not NULL) and converts it into B/W bitmap,
+// index is order of the file in batch; with -k the converted image may be taken from cache instead,
+// with -g an image the printer already holds is not converted at all;
+// PBM, PGM and raw input files are not decoded, their rows are used as bitmap or greyscale image
+int rasterize(struct config *cfg, const char *input, const unsigned char *png, size_t png_size, struct raster *raster, struct batch *batch, const unsigned int index) {
+    int ret = 1;
+    unsigned char *png_file = NULL;
+    unsigned char *img_rgba = NULL;
+    unsigned char *img_samples = NULL;
+    unsigned char *img_grey = NULL;
+    unsigned char *img_bw = NULL;
+    unsigned int threshold = cfg->threshold;
+    unsigned int lodepng_error = 0;
+    unsigned char key[CACHE_KEY_LENGTH];
+    const unsigned char *graphics = cfg->graphics ? graphics_find(input) : NULL;
+    struct stats *stats = cfg->stats ? &raster->stats : NULL;
+    struct pnm pnm = { .format = 0 };
+
+    if (stats) {
+        stats->job = cfg->job_memory;
+    }
+
+    // load input file, the cache key covers the whole file anyway
+    double t = stage_clock(stats);
+    if (!png) {
+        if (input_load(cfg, input, &png_file, &png_size, &pnm) != 0) {
+            stage_failed(stats, STAGE_DECODE);
+            goto fail;
+        }
+        png = png_file;
+        stats_memory(stats, png_size);
+    }
+    if (stats) {
+        stats->begin = t;
+    }
+    t = stage_end(stats, STAGE_DECODE, t);
+    if (stats) {
+        stats->source = 'D';
+        stats->input = png_size;
+    }
+
+    if (cfg->cache || graphics) {
+
+        // in photo mode output depends on the threshold left by the previous file
+        if (cfg->photo == 1) {
+            threshold = threshold_wait(cfg, batch, index);
+            if (threshold > 255) {
+                goto fail;
+            }
+        }
+
+        unsigned char options[32];
+        unsigned int options_size = cache_options(options, cfg, threshold);
+        if (pnm.format != 0) {
+            // rows of PBM, PGM and raw images do not carry their size
+            options[options_size++] = pnm.format;
+            options[options_size++] = pnm.width & 0xff;
+            options[options_size++] = pnm.width >> 8 & 0xff;
+            options[options_size++] = pnm.width >> 16 & 0xff;
+            options[options_size++] = pnm.width >> 24 & 0xff;
+        }
+
+        if (graphics) {
+            options[options_size++] = cfg->memory;
+            cache_key(raster->graphics_hash, png, png_size, options, options_size);
+
+            unsigned int width = 0;
+            if (graphics_lookup(graphics, raster->graphics_hash, &raster->graphics_threshold, &width) == 0) {
+                raster->graphics = graphics;
+                raster->memory = cfg->memory;
+                raster->canvas_w = width;
+                raster->offset = left_offset(cfg->profile, width, cfg->align);
+                if (stats) {
+                    stats->source = 'G';
+                    stats->width = width;
+                }
+                if (cfg->photo == 1) {
+                    threshold_publish(cfg, batch, index, raster->graphics_threshold);
+                    report(cfg->report, "Threshold shift, new value = %d", raster->graphics_threshold);
+                }
+                ret = 0;
+                goto fail;
+            }
+        } else {
+            // blank row elision changes the output, not the bitmap
+            options[options_size++] = cfg->elide == 1 ? cfg->profile->dot_feed : 0;
+            cache_key(key, png, png_size, options, options_size);
+        }
+
+        if (!graphics && cache_lookup(key, &raster->cached) == 0) {
+            if (stats) {
+                stats->source = 'C';
+            }
+            if (cfg->photo == 1) {
+                threshold_publish(cfg, batch, index, raster->cached.threshold);
+                report(cfg->report, "Threshold shift, new value = %d", raster->cached.threshold);
+            }
+            ret = 0;
+            goto fail;
+        }
+    }
+
+    // decode RGBA PNG, rows of PGM become greyscale image and rows of PBM and raw images become bitmap
+    t = stage_clock(stats);
+    unsigned int img_w = 0;
+    unsigned int img_h = 0;
+    unsigned int depth = 0;
+    size_t samples_size = 0;
+    unsigned char samples_map[256];
+    unsigned char samples_linear[256];
+    if (pnm.format == PNM_PGM) {
+        img_grey = png_file, png_file = NULL;
+        img_w = pnm.width;
+        img_h = pnm.height;
+    } else if (pnm.format != 0) {
+        img_bw = png_file, png_file = NULL;
+        img_w = pnm.width;
+        img_h = pnm.height;
+    } else {
+        // 1, 2, 4 and 8-bit grey and palette images are decoded at their native depth, without RGBA expansion;
+        // lightness of each grey level or palette entry is computed once
+        LodePNGState state;
+        lodepng_state_init(&state);
+        lodepng_error = lodepng_inspect(&img_w, &img_h, &state, png, png_size);
+        const LodePNGColorMode *color = &state.info_png.color;
+        if (!lodepng_error && (color->colortype == LCT_PALETTE || (color->colortype == LCT_GREY && color->bitdepth <= 8))) {
+            state.decoder.color_convert = 0;
+            lodepng_error = lodepng_decode(&img_samples, &img_w, &img_h, &state, png, png_size);
+            if (!lodepng_error) {
+                depth = color->bitdepth;
+                samples_size = ((size_t)img_w * img_h * depth + 7) >> 3;
+                samples_grey(samples_map, color, grey_scalar);
+                if (cfg->fit != SCALE_NONE) {
+                    samples_grey(samples_linear, color, grey_linear);
+                }
+            }
+        } else if (!lodepng_error) {
+            lodepng_error = lodepng_decode32(&img_rgba, &img_w, &img_h, png, png_size);
+        }
+        lodepng_state_cleanup(&state);
+        if (lodepng_error) {
+            report(cfg->report, "Could not load and process input PNG file, %s", lodepng_error_text(lodepng_error));
+            stage_failed(stats, STAGE_DECODE);
+            goto fail;
+        }
+        // PNG file and decoded image are held at once
+        stats_memory(stats, img_samples ? (long)samples_size : (long)img_w * img_h * 4);
+        if (png_file) {
+            pool_free(png_file), png_file = NULL;
+            stats_memory(stats, -(long)png_size);
+        }
+    }
+    t = stage_end(stats, STAGE_DECODE, t);
+    if (stats) {
+        stats->width = img_w;
+        stats->height = img_h;
+    }
+
+    // --fit, an image too wide for the printer is scaled down to its width while it is converted to greyscale:
+    // lines of linear luminance are filtered one by one, full resolution greyscale image is never made
+    unsigned int fitted = 0;
+    if (cfg->fit != SCALE_NONE && (cfg->turn != 0 ? img_h : img_w) > cfg->profile->width) {
+        // the other side keeps aspect ratio, it is height of a turned image that has to fit
+        const unsigned int side = cfg->turn != 0 ? img_h : img_w;
+        const unsigned int other = cfg->turn != 0 ? img_w : img_h;
+        unsigned int fit_other = ((unsigned long long)other * cfg->profile->width + (side >> 1)) / side;
+        if (fit_other == 0) {
+            fit_other = 1;
+        }
+        const unsigned int fit_w = cfg->turn != 0 ? fit_other : cfg->profile->width;
+        const unsigned int fit_h = cfg->turn != 0 ? cfg->profile->width : fit_other;
+
+        // samples of PGM, PBM and raw images are unpacked to luminance by a map as well
+        static const unsigned char BW_LINEAR[2] = { 0xff, 0x00 };
+        const unsigned char *samples = img_samples;
+        const unsigned char *map = samples_linear;
+        unsigned int samples_depth = depth;
+        size_t line_bits = (size_t)img_w * depth;
+        if (pnm.format == PNM_PGM) {
+            samples = img_grey;
+            map = GAMMA_22;
+            samples_depth = 8;
+            line_bits = (size_t)img_w << 3;
+        } else if (pnm.format != 0) {
+            samples = img_bw;
+            map = BW_LINEAR;
+            samples_depth = 1;
+            line_bits = (size_t)pnm.linebytes << 3;
+        }
+
+        struct scale scale;
+        unsigned char *img_fit = NULL;
+        if (scale_open(&scale, cfg->fit, img_w, img_h, fit_w, fit_h) != 0 || !(img_fit = (unsigned char *)pool_alloc((size_t)fit_w * fit_h))) {
+            scale_close(&scale);
+            report(cfg->report, "Could not allocate enough memory");
+            stage_failed(stats, STAGE_GREY);
+            goto fail;
+        }
+        stats_memory(stats, (long)fit_w * fit_h + (long)scale.memory);
+        for (unsigned int y = 0; y != img_h; ++y) {
+            unsigned char *line = scale_line(&scale);
+            if (img_rgba) {
+                grey_linear(line, &img_rgba[((size_t)y * img_w) << 2], img_w);
+            } else {
+                grey_unpack_samples_line(line, samples, y * line_bits, img_w, samples_depth, map);
+            }
+            scale_push(&scale, img_fit);
+        }
+        scale_close(&scale);
+        stats_memory(stats, -(long)scale.memory);
+
+        // source image is not needed anymore, the scaled one goes on as a greyscale image
+        if (img_rgba) {
+            pool_free(img_rgba), img_rgba = NULL;
+            stats_memory(stats, -(long)img_w * img_h * 4);
+        }
+        if (img_samples) {
+            pool_free(img_samples), img_samples = NULL;
+            stats_memory(stats, -(long)samples_size);
+        }
+        if (img_grey || img_bw) {
+            pool_free(img_grey), img_grey = NULL;
+            pool_free(img_bw), img_bw = NULL;
+            stats_memory(stats, -(long)png_size);
+        }
+        img_grey = img_fit;
+        img_w = fit_w;
+        img_h = fit_h;
+        pnm.format = 0;
+        fitted = 1;
+        report(cfg->report, "Image scaled down to %ux%u px", img_w, img_h);
+        t = stage_end(stats, STAGE_GREY, t);
+    }
+
+    // height of an image becomes its width once it is turned
+    const unsigned int print_w = cfg->turn != 0 ? img_h : img_w;
+    if (print_w > cfg->profile->width) {
+        report(cfg->report, "Image width %u px exceeds the printer's capability (%u px)", print_w, cfg->profile->width);
+        stage_failed(stats, STAGE_PACK);
+        goto fail;
+    }
+
+    unsigned int histogram[256] = { 0 };
+
+    // canvas size is width of a picture rounded up to nearest multiple of 8
+    const unsigned int canvas_w = ((img_w + 7) >> 3) << 3;
+
+    const unsigned int img_bw_size = img_h * (canvas_w >> 3);
+    if (!img_bw) {
+        // every byte of bitmap is written by packing or dithering, it is not cleared
+        img_bw = (unsigned char *)pool_alloc(img_bw_size);
+        if (!img_bw) {
+            report(cfg->report, "Could not allocate enough memory");
+            stage_failed(stats, STAGE_PACK);
+            goto fail;
+        }
+        stats_memory(stats, img_bw_size);
+    }
+
+    if (cfg->photo == 0 && pnm.format != 0 && pnm.format != PNM_PGM) {
+        // bitmap is printed as it is, threshold does not apply
+        if (cfg->rotate == 1) {
+            bitmap_rotate(img_bw, img_w, canvas_w, img_h);
+        }
+        t = stage_end(stats, STAGE_PACK, t);
+    } else if (cfg->photo == 0 && (pnm.format == PNM_PGM || fitted)) {
+        // levels of PGM, lightness of a scaled image
+        const unsigned int img_grey_size = img_h * img_w;
+        if (pnm.format == PNM_PGM) {
+            grey_levels(img_grey, img_grey, img_grey_size);
+        }
+        for (unsigned int i = 0; i != img_grey_size; ++i) {
+            ++histogram[img_grey[i]];
+        }
+        t = stage_end(stats, STAGE_GREY, t);
+        bitmap(img_bw, img_grey, img_w, canvas_w, img_h, threshold, cfg->rotate);
+        t = stage_end(stats, STAGE_PACK, t);
+
+        pool_free(img_grey), img_grey = NULL;
+        stats_memory(stats, -(long)img_grey_size);
+
+        photo_hints(cfg, histogram);
+    } else if (cfg->photo == 0 && img_samples) {
+        // B/W pixel of each sample value, then of each sample byte
+        unsigned char bits[256];
+        for (unsigned int v = 0; v != 1u << depth; ++v) {
+            bits[v] = samples_map[v] <= threshold;
+        }
+        unsigned char lut[256];
+        grey_samples_lut(lut, bits, depth);
+
+        unsigned char line[PROFILE_MAX_WIDTH >> 3];
+        for (unsigned int y = 0; y != img_h; ++y) {
+            const size_t bit = (size_t)y * img_w * depth;
+            if (cfg->rotate == 1) {
+                // upside down rotation = reversed order of lines and mirrored lines
+                grey_pack_samples_line(line, img_samples, samples_size, bit, img_w, depth, lut);
+                grey_mirror_bw_line(&img_bw[(img_h - 1 - y) * (canvas_w >> 3)], line, img_w);
+            } else {
+                grey_pack_samples_line(&img_bw[y * (canvas_w >> 3)], img_samples, samples_size, bit, img_w, depth, lut);
+            }
+        }
+        t = stage_end(stats, STAGE_PACK, t);
+
+        samples_histogram(histogram, img_samples, (size_t)img_w * img_h, depth, samples_map);
+        pool_free(img_samples), img_samples = NULL;
+        stats_memory(stats, -(long)samples_size);
+
+        photo_hints(cfg, histogram);
+    } else if (cfg->photo == 0) {
+        // fused conversion straight into bitmap, line by line, without a greyscale copy of image
+        for (unsigned int y = 0; y != img_h; ++y) {
+            // upside down rotation = reversed order of lines and mirrored lines
+            const unsigned int dst = cfg->rotate == 1 ? img_h - 1 - y : y;
+            grey_bw_line(&img_bw[dst * (canvas_w >> 3)], &img_rgba[(y * img_w) << 2], img_w, threshold, cfg->rotate, histogram);
+        }
+        t = stage_end(stats, STAGE_PACK, t);
+
+        pool_free(img_rgba), img_rgba = NULL;
+        stats_memory(stats, -(long)img_w * img_h * 4);
+
+#ifdef DEBUG
+        // draw histogram via gnuplot, write dataset
+        FILE *fhist = fopen("debug/histogram.txt", "w");
+        if (fhist) {
+            fprintf(fhist, "#hue\tcount\n");
+            for (unsigned int i = 0; i != 256; ++i) {
+                fprintf(fhist, "%d\t%d\n", i, histogram[i]);
+            }
+            fprintf(fhist, "#EOF\n");
+        }
+        fclose(fhist), fhist = NULL;
+#endif
+
+        photo_hints(cfg, histogram);
+    } else {
+        // convert RGBA (or levels of PGM, or bitmap of PBM) to greyscale
+        const unsigned int img_grey_size = img_h * img_w;
+        if (!img_grey) {
+            img_grey = (unsigned char *)pool_alloc(img_grey_size);
+            if (!img_grey) {
+                report(cfg->report, "Could not allocate enough memory");
+                stage_failed(stats, STAGE_GREY);
+                goto fail;
+            }
+            stats_memory(stats, img_grey_size);
+        }
+
+        if (img_rgba) {
+            rgba_to_grey(img_grey, img_rgba, img_grey_size, histogram);
+            t = stage_end(stats, STAGE_GREY, t);
+
+            pool_free(img_rgba), img_rgba = NULL;
+            stats_memory(stats, -(long)img_w * img_h * 4);
+        } else {
+            if (img_samples) {
+                for (unsigned int y = 0; y != img_h; ++y) {
+                    grey_unpack_samples_line(&img_grey[y * img_w], img_samples, (size_t)y * img_w * depth, img_w, depth, samples_map);
+                }
+                pool_free(img_samples), img_samples = NULL;
+                stats_memory(stats, -(long)samples_size);
+            } else if (pnm.format == PNM_PGM) {
+                grey_levels(img_grey, img_grey, img_grey_size);
+            } else if (pnm.format != 0) {
+                for (unsigned int y = 0; y != img_h; ++y) {
+                    grey_unpack_line(&img_grey[y * img_w], &img_bw[y * (canvas_w >> 3)], img_w);
+                }
+            }
+            for (unsigned int i = 0; i != img_grey_size; ++i) {
+                ++histogram[img_grey[i]];
+            }
+            t = stage_end(stats, STAGE_GREY, t);
+        }
+
+#ifdef DEBUG
+        lodepng_encode_file("debug/g.png", img_grey, img_w, img_h, LCT_GREY, 8);
+
+        // draw histogram via gnuplot, write dataset
+        FILE *fhist = fopen("debug/histogram.txt", "w");
+        if (fhist) {
+            fprintf(fhist, "#hue\tcount\n");
+            for (unsigned int i = 0; i != 256; ++i) {
+                fprintf(fhist, "%d\t%d\n", i, histogram[i]);
+            }
+            fprintf(fhist, "#EOF\n");
+        }
+        fclose(fhist), fhist = NULL;
+#endif
+
+        photo_hints(cfg, histogram);
+
+        // post-processing
+        // Histogram Equalization Algorithm
+        for (unsigned int i = 1; i != 256; ++i) {
+            histogram[i] += histogram[i - 1];
+        }
+        for (unsigned int i = 0; i != img_grey_size; ++i) {
+            img_grey[i] = 255 * histogram[img_grey[i]] / img_grey_size;
+        }
+        stage_end(stats, STAGE_EQUALIZE, t);
+        // shifted threshold is passed to the next file
+        const unsigned int threshold_prev = threshold_wait(cfg, batch, index);
+        if (threshold_prev > 255) {
+            // previous file failed, this one will not be printed
+            goto fail;
+        }
+        threshold = 255 * histogram[threshold_prev] / img_grey_size;
+        threshold_publish(cfg, batch, index, threshold);
+        report(cfg->report, "Threshold shift, new value = %d", threshold);
+        t = stage_clock(stats);
+
+#ifdef DEBUG
+        lodepng_encode_file("debug/g_pp.png", img_grey, img_w, img_h, LCT_GREY, 8);
+
+        for (unsigned int i = 1; i != 256; ++i) {
+            histogram[i] = 0;
+        }
+        for (unsigned int i = 0; i != img_grey_size; ++i) {
+            ++histogram[img_grey[i]];
+        }
+
+        // draw histogram via gnuplot, write dataset
+        FILE *fhist_pp = fopen("debug/histogram_pp.txt", "w");
+        if (fhist_pp) {
+            fprintf(fhist_pp, "#hue\tcount\n");
+            for (unsigned int i = 0; i != 256; ++i) {
+                fprintf(fhist_pp, "%d\t%d\n", i, histogram[i]);
+            }
+            fprintf(fhist_pp, "#EOF\n");
+        }
+        fclose(fhist_pp), fhist_pp = NULL;
+#endif
+
+        // convert to B/W bitmap
+        if (cfg->dither != DITHER_ATKINSON) {
+            // rows are dithered and packed at once, in parallel
+            if (dither_ordered(img_bw, img_grey, img_w, canvas_w, img_h, 0, cfg->dither, threshold, cfg->rotate, cfg->dither_jobs) != 0) {
+                report(cfg->report, "Could not allocate enough memory");
+                stage_failed(stats, STAGE_DITHER);
+                goto fail;
+            }
+            t = stage_end(stats, STAGE_DITHER, t);
+        } else {
+            if (dither_atkinson(img_grey, img_w, img_h, img_h, threshold, cfg->dither_jobs) != 0) {
+                report(cfg->report, "Could not allocate enough memory");
+                stage_failed(stats, STAGE_DITHER);
+                goto fail;
+            }
+            t = stage_end(stats, STAGE_DITHER, t);
+            bitmap(img_bw, img_grey, img_w, canvas_w, img_h, threshold, cfg->rotate);
+            t = stage_end(stats, STAGE_PACK, t);
+        }
+
+        pool_free(img_grey), img_grey = NULL;
+        stats_memory(stats, -(long)img_grey_size);
+    }
+
+#ifdef DEBUG
+    //for (unsigned int i = 0; i != img_bw_size; ++i) {
+    //    img_bw[i] = ~img_bw[i];
+    //}
+    lodepng_encode_file("debug/bw_inv.png", img_bw, canvas_w, img_h, LCT_GREY, 1);
+#endif
+
+    t = stage_clock(stats);
+    raster->canvas_w = canvas_w;
+    raster->img_h = img_h;
+    if (cfg->turn != 0) {
+        // columns of the bitmap become its rows, transposes write whole groups of 8 rows
+        const unsigned int turned_size = canvas_w * ((print_w + 7) >> 3);
+        unsigned char *img_turned = (unsigned char *)pool_alloc(turned_size);
+        if (!img_turned) {
+            report(cfg->report, "Could not allocate enough memory");
+            stage_failed(stats, STAGE_PACK);
+            goto fail;
+        }
+        stats_memory(stats, turned_size);
+        grey_turn_bw(img_turned, img_bw, img_w, img_h, cfg->turn == 90);
+        pool_free(img_bw), img_bw = img_turned;
+        stats_memory(stats, -(long)img_bw_size);
+        raster->canvas_w = ((print_w + 7) >> 3) << 3;
+        raster->img_h = img_w;
+        t = stage_end(stats, STAGE_PACK, t);
+    }
+    raster->img_bw = img_bw, img_bw = NULL;
+    raster->offset = left_offset(cfg->profile, raster->canvas_w, cfg->align);
+    if (graphics && raster->img_h > cfg->profile->graphics_height) {
+        report(cfg->report, "Image height %u px exceeds the printer's graphics memory capability (%u px), printing it as a bitmap", raster->img_h, cfg->profile->graphics_height);
+    } else if (graphics) {
+        raster->graphics = graphics;
+        raster->memory = cfg->memory;
+        raster->graphics_threshold = threshold;
+    }
+    if (!raster->graphics && cfg->elide == 1 && cfg->compose == 0) {
+        // without memory for segments the bitmap is just printed as it is (--compose compacts the canvas instead)
+        raster->segments = compact(cfg->profile, raster->img_bw, raster->canvas_w, raster->img_h, &raster->segmentcnt);
+        if (raster->segments) {
+            raster->saved = compact_saved(cfg->profile, raster->canvas_w, raster->img_h, raster->offset, raster->segments, raster->segmentcnt);
+        }
+    }
+    if (!raster->graphics && cfg->cache) {
+        cache_put(cfg, key, raster, threshold);
+    }
+    stage_end(stats, STAGE_EMIT, t);
+    ret = 0;
+
+fail:
+    pool_free(png_file), png_file = NULL;
+    pool_free(img_rgba), img_rgba = NULL;
+    pool_free(img_samples), img_samples = NULL;
+    pool_free(img_grey), img_grey = NULL;
+    pool_free(img_bw), img_bw = NULL;
+    // only the bitmap passed to raster is held now
+    if (stats) {
+        stats_memory(stats, (raster->img_bw ? (long)raster->img_h * (raster->canvas_w >> 3) : 0) - (long)stats->memory);
+    }
+    return ret;
+}
+
+// defines bitmap (if there is one) under its key and prints the image from printer memory,
+// bitmap is passed to the output layer
+static void print_graphics(struct output *out, struct raster *raster) {
+    const unsigned int canvas_w = raster->canvas_w;
+    const unsigned int img_h = raster->img_h;
+    const unsigned int offset = raster->offset;
+    const unsigned char *key = raster->graphics;
+
+    if (out->headercnt > OUTPUT_HEADERS - 2 || out->iovcnt > OUTPUT_IOVS - 4) {
+        output_flush(out);
+    }
+
+    if (raster->img_bw) {
+        unsigned char *define = out->headers[out->headercnt++];
+        const unsigned long p = 11 + (unsigned long)img_h * (canvas_w >> 3);
+        memcpy(define, ESC_DEFINE, ESC_DEFINE_LENGTH);
+        define[ 3] = p & 0xff;
+        define[ 4] = p >> 8 & 0xff;
+        define[ 5] = p >> 16 & 0xff;
+        define[ 6] = p >> 24 & 0xff;
+        define[ 8] = raster->memory == 'D' ? 0x53 : 0x43;
+        define[10] = key[0];
+        define[11] = key[1];
+        define[13] = canvas_w & 0xff;
+        define[14] = canvas_w >> 8 & 0xff;
+        define[15] = img_h & 0xff;
+        define[16] = img_h >> 8 & 0xff;
+        print(out, define, ESC_DEFINE_LENGTH);
+        print(out, raster->img_bw, img_h * (canvas_w >> 3));
+        graphics_stored(key, raster->graphics_hash, raster->graphics_threshold, canvas_w);
+    }
+
+    unsigned char *header = out->headers[out->headercnt++];
+    unsigned int header_length = 0;
+    if (offset != 0 || out->elide == 1) {
+        memcpy(header, ESC_OFFSET, ESC_OFFSET_LENGTH);
+        header[2] = offset & 0xff;
+        header[3] = offset >> 8 & 0xff;
+        header_length = ESC_OFFSET_LENGTH;
+    }
+    unsigned char *stored = &header[header_length];
+    memcpy(stored, ESC_PRINT_STORED, ESC_PRINT_STORED_LENGTH);
+    stored[6] = raster->memory == 'D' ? 0x55 : 0x45;
+    stored[7] = key[0];
+    stored[8] = key[1];
+    header_length += ESC_PRINT_STORED_LENGTH;
+    print(out, header, header_length);
+
+    if (out->policy == 'J') {
+        if (raster->img_bw) {
+            output_hold(out, raster->img_bw);
+        }
+    } else {
+        output_flush(out);
+        pool_free(raster->img_bw);
+    }
+    raster->img_bw = NULL;
+}
+
+// prints bitmap chunked into bands, bitmap is passed to the output layer
+void print_raster(struct output *out, struct raster *raster) {
+    if (raster->cached.data) {
+        // mapping is released right after it is written
+        print(out, raster->cached.data, raster->cached.size);
+        output_flush(out);
+        out->saved += raster->cached.saved;
+        cache_release(&raster->cached);
+        return;
+    }
+
+    if (raster->graphics) {
+        print_graphics(out, raster);
+        return;
+    }
+
+    print_bands(out, raster);
+    out->saved += raster->saved;
+    free(raster->segments), raster->segments = NULL;
+
+    if (out->policy == 'J') {
+        output_hold(out, raster->img_bw);
+    } else {
+        output_flush(out);
+        pool_free(raster->img_bw);
+    }
+    raster->img_bw = NULL;
+}
+
+// prints a converted file, with --stats time and output it took are added to its stats
+void print_file(struct output *out, struct raster *raster, const struct config *cfg) {
+    struct stats *stats = cfg->stats ? &raster->stats : NULL;
+    const unsigned long bytes = out->bytes;
+    const unsigned long bands = out->bands;
+    const unsigned long flushes = out->flushes;
+
+    const double t = stage_clock(stats);
+    if (stats) {
+        out->written = 0.0;
+    }
+    print_raster(out, raster);
+    stage_end(stats, STAGE_EMIT, t);
+
+    if (stats) {
+        stats->output = out->bytes - bytes;
+        stats->bands = out->bands - bands;
+        stats->flushes = out->flushes - flushes;
+        stats->written = out->written;
+        out->written = -1.0;
+        // bitmap belongs to the output layer now
+        stats_memory(stats, -(long)stats->memory);
+        if (out->failed != 0) {
+            stage_failed(stats, STAGE_EMIT);
+        }
+    }
+}
+
+// --compose, prints the canvas: images stacked in order, each at its own offset; bands of the canvas are filled
+// up to rows of a band of the printer across image boundaries and passed to the output layer, bitmap of each image is released
+// as soon as its last row is copied. All bands start at the left margin of the canvas (so the margin does not change
+// within it), each one is as wide as the images it takes rows of.
+int compose_print(struct output *out, struct compose *compose) {
+    if (compose->count == 0) {
+        return 0;
+    }
+
+    unsigned int left = ~0u;
+    unsigned int right = 0;
+    unsigned int height = 0;
+    for (unsigned int i = 0; i != compose->count; ++i) {
+        const struct raster *raster = &compose->rasters[i];
+        if (raster->offset < left) {
+            left = raster->offset;
+        }
+        if (raster->offset + raster->canvas_w > right) {
+            right = raster->offset + raster->canvas_w;
+        }
+        height += raster->img_h;
+    }
+
+    // image i, row y of it is the next one to be copied; rows of bands are those of the widest one
+    unsigned int i = 0;
+    unsigned int y = 0;
+    for (unsigned int l = 0, k = profile_band(out->profile, right - left); l < height; l += k) {
+        if (k > height - l) {
+            k = height - l;
+        }
+
+        unsigned int canvas_w = 0;
+        for (unsigned int j = i, rows = 0, first = y; rows < k; ++j, first = 0) {
+            const struct raster *raster = &compose->rasters[j];
+            if (raster->offset - left + raster->canvas_w > canvas_w) {
+                canvas_w = raster->offset - left + raster->canvas_w;
+            }
+            rows += raster->img_h - first;
+        }
+        const unsigned int row_bytes = canvas_w >> 3;
+
+        unsigned char *band = (unsigned char *)pool_alloc((size_t)k * row_bytes);
+        if (!band) {
+            report(out->report, "Could not allocate enough memory");
+            compose_release(compose);
+            return 1;
+        }
+        memset(band, 0x00, (size_t)k * row_bytes);
+        for (unsigned int row = 0; row != k;) {
+            struct raster *raster = &compose->rasters[i];
+            const unsigned int width = raster->canvas_w >> 3;
+            const unsigned int x = (raster->offset - left) >> 3;
+            const unsigned int n = raster->img_h - y < k - row ? raster->img_h - y : k - row;
+            for (unsigned int j = 0; j != n; ++j) {
+                memcpy(&band[(row + j) * row_bytes + x], &raster->img_bw[(y + j) * width], width);
+            }
+            row += n;
+            y += n;
+            if (y == raster->img_h) {
+                pool_free(raster->img_bw), raster->img_bw = NULL;
+                ++i;
+                y = 0;
+            }
+        }
+
+        if (print_stream_band(out, band, canvas_w, k, left) != 0) {
+            pool_free(band);
+            compose_release(compose);
+            return 1;
+        }
+        output_hold(out, band);
+    }
+
+    if (out->policy != 'J') {
+        output_flush(out);
+    }
+    compose_release(compose);
+    return 0;
+}
+
+// adds a converted file to the canvas, bitmap is passed to the canvas; an image taken from cache or printer memory
+// is printed on its own, after the canvas composed so far
+int compose_file(struct output *out, struct compose *compose, struct raster *raster, const struct config *cfg) {
+    if (raster->cached.data || raster->graphics) {
+        if (compose_print(out, compose) != 0) {
+            return 1;
+        }
+        print_file(out, raster, cfg);
+        return 0;
+    }
+
+    if (compose->count == compose->size) {
+        const unsigned int size = compose->size ? 2 * compose->size : 16;
+        struct raster *rasters = (struct raster *)realloc(compose->rasters, size * sizeof(struct raster));
+        if (!rasters) {
+            report(cfg->report, "Could not allocate enough memory");
+            pool_free(raster->img_bw), raster->img_bw = NULL;
+            return 1;
+        }
+        compose->rasters = rasters;
+        compose->size = size;
+    }
+    compose->rasters[compose->count++] = *raster;
+    raster->img_bw = NULL;
+    if (cfg->stats) {
+        // bitmap belongs to the canvas now
+        stats_memory(&raster->stats, -(long)raster->stats.memory);
+    }
+    return 0;
+}
+
+void compose_release(struct compose *compose) {
+    for (unsigned int i = 0; i != compose->count; ++i) {
+        pool_free(compose->rasters[i].img_bw), compose->rasters[i].img_bw = NULL;
+    }
+    free(compose->rasters), compose->rasters = NULL;
+    compose->count = 0;
+    compose->size = 0;
+}
+
+// takes files in order, waits if it got too far ahead of printing
+static void* batch_worker(void *arg) {
+    struct batch *batch = (struct batch *)arg;
+
+    pthread_mutex_lock(&batch->lock);
+    for (;;) {
+        while (!batch->failed && batch->next != batch->count && batch->next >= batch->printed + batch->window) {
+            pthread_cond_wait(&batch->cond, &batch->lock);
+        }
+        if (batch->failed || batch->next == batch->count) {
+            break;
+        }
+        const unsigned int index = batch->next++;
+        pthread_mutex_unlock(&batch->lock);
+
+        struct raster raster = { .img_bw = NULL };
+        const int error = rasterize(batch->cfg, batch->inputs[index], NULL, 0, &raster, batch, index);
+
+        pthread_mutex_lock(&batch->lock);
+        batch->items[index].raster = raster;
+        batch->items[index].state = error ? BATCH_FAILED : BATCH_DONE;
+        pthread_cond_broadcast(&batch->cond);
+    }
+    pthread_mutex_unlock(&batch->lock);
+    return NULL;
+}
+
+// rasterizes count input files by jobs threads, prints them in order as soon as they are ready;
+// output is the same as if the files were processed one by one, printing stops at the first failed file;
+// with --stats, stats of printed files and of the failed one are stored into files; with --compose (compose is not NULL) files are added to the canvas
+int convert_batch(struct config *cfg, struct output *out, const char *const *inputs, const unsigned int count, unsigned int jobs, struct stats *files, struct compose *compose) {
+    int ret = 1;
+    struct batch batch = {
+        .cfg = cfg,
+        .inputs = inputs,
+        .count = count,
+        .next = 0,
+        .printed = 0,
+        .window = 2 * jobs,
+        .failed = 0
+    };
+    pthread_t *threads = NULL;
+    unsigned int started = 0;
+
+    pthread_mutex_init(&batch.lock, NULL);
+    pthread_cond_init(&batch.cond, NULL);
+
+    batch.items = (struct batch_item *)calloc(count, sizeof(struct batch_item));
+    threads = (pthread_t *)calloc(jobs, sizeof(pthread_t));
+    if (!batch.items || !threads) {
+        report(cfg->report, "Could not allocate enough memory");
+        goto fail;
+    }
+
+    for (; started != jobs; ++started) {
+        if (pthread_create(&threads[started], NULL, batch_worker, &batch) != 0) {
+            break;
+        }
+    }
+    if (started == 0) {
+        report(cfg->report, "Could not start worker threads");
+        goto fail;
+    }
+
+    for (unsigned int i = 0; i != count; ++i) {
+        pthread_mutex_lock(&batch.lock);
+        while (batch.items[i].state == BATCH_PENDING) {
+            pthread_cond_wait(&batch.cond, &batch.lock);
+        }
+        const unsigned int state = batch.items[i].state;
+        pthread_mutex_unlock(&batch.lock);
+
+        if (state == BATCH_FAILED) {
+            if (files) {
+                files[i] = batch.items[i].raster.stats;
+            }
+            goto fail;
+        }
+
+        if (compose) {
+            if (compose_file(out, compose, &batch.items[i].raster, cfg) != 0) {
+                if (files) {
+                    files[i] = batch.items[i].raster.stats;
+                    stage_failed(&files[i], STAGE_EMIT);
+                }
+                goto fail;
+            }
+        } else {
+            print_file(out, &batch.items[i].raster, cfg);
+        }
+        if (files) {
+            files[i] = batch.items[i].raster.stats;
+        }
+
+        pthread_mutex_lock(&batch.lock);
+        batch.printed = i + 1;
+        pthread_cond_broadcast(&batch.cond);
+        pthread_mutex_unlock(&batch.lock);
+    }
+
+    ret = 0;
+
+fail:
+    // stop workers, files being rasterized are finished and thrown away
+    pthread_mutex_lock(&batch.lock);
+    batch.failed = 1;
+    pthread_cond_broadcast(&batch.cond);
+    pthread_mutex_unlock(&batch.lock);
+    for (unsigned int t = 0; t != started; ++t) {
+        pthread_join(threads[t], NULL);
+    }
+    if (batch.items) {
+        for (unsigned int i = 0; i != count; ++i) {
+            pool_free(batch.items[i].raster.img_bw), batch.items[i].raster.img_bw = NULL;
+            free(batch.items[i].raster.segments), batch.items[i].raster.segments = NULL;
+            cache_release(&batch.items[i].raster.cached);
+        }
+    }
+    free(batch.items), batch.items = NULL;
+    free(threads), threads = NULL;
+    pthread_cond_destroy(&batch.cond);
+    pthread_mutex_destroy(&batch.lock);
+    return ret;
+}
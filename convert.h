@@ -0,0 +1,262 @@
+/*!
+(c) 2012 - 2015 Petr Kutalek: png2pos
+
+Licensed under the MIT License, see png2pos.c
+*/
+
+#ifndef CONVERT_H
+#define CONVERT_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <limits.h>
+#include <pthread.h>
+#ifndef _WIN32
+#include <sys/uio.h>
+#endif
+#include "cache.h"
+#include "graphics.h"
+#include "profile.h"
+#include "report.h"
+
+// Conversion of images into ESC/POS and the output layer, the core of libpng2pos
+//
+// Everything here works on the configuration, output and stats it is given, there is no global
+// mutable state besides the pool of image buffers (pool.c, locked) and the kernels chosen once by
+// grey_init(); cache and graphics kept in printer memory are used only if the configuration asks for them.
+// Diagnostics go to the report of the configuration (or of the output), never to standard error.
+// libpng2pos.c wraps it into the public API of png2pos.h, the command line (png2pos.c) uses just that API.
+
+extern const char *PNG2POS_VERSION;
+
+// ESC sequences, see convert.c
+#define ESC_INIT_LENGTH 2
+#define ESC_CUT_LENGTH 4
+#define ESC_OFFSET_LENGTH 4
+#define ESC_STORE_LENGTH 17
+#define ESC_FLUSH_LENGTH 7
+#define ESC_FEED_LENGTH 3
+#define ESC_DEFINE_LENGTH 18
+#define ESC_PRINT_STORED_LENGTH 11
+
+extern const unsigned char ESC_INIT[ESC_INIT_LENGTH];
+extern const unsigned char ESC_CUT[ESC_CUT_LENGTH];
+
+// peak of buffers held by all files of job at once, files overlap with -j
+struct job_memory {
+    pthread_mutex_t lock;
+    unsigned long memory;
+    unsigned long memory_peak;
+};
+
+// conversion options of a library context
+struct config {
+    unsigned int cut;
+    unsigned int photo;
+    char align;
+    unsigned int rotate;
+    // --rotate 90 or 270, quarter turn clockwise, 0 = none (-r, upside down, is rotate)
+    unsigned int turn;
+    // --fit, filter images too wide for the printer are scaled down by, SCALE_*
+    unsigned int fit;
+    // photo mode shifts it for the next file
+    unsigned int threshold;
+    unsigned int stream;
+    unsigned int jobs;
+    unsigned int dither_jobs;
+    // dithering engine of photo mode, DITHER_*
+    unsigned int dither;
+    char flush;
+    // converted images are looked up in the cache and stored into it (cache_open)
+    unsigned int cache;
+    // input files mapped onto keys are printed from printer memory of the record (graphics_open), N = NV, D = download
+    unsigned int graphics;
+    char memory;
+    // -e, blank rows are fed instead of printed, bands are trimmed to their content
+    unsigned int elide;
+    // --compose, images of a job are stacked into one canvas printed in full bands
+    unsigned int compose;
+    // --printer, what the printer takes
+    const struct profile *profile;
+    // --stats, per file and job statistics are reported as JSON, buffers of all files are counted
+    // into job_memory (if not NULL)
+    unsigned int stats;
+    struct job_memory *job_memory;
+    // --raw, input files are raw 1-bit rasters of this size, height 0 = up to the end of file
+    unsigned int raw_width;
+    unsigned int raw_height;
+    // diagnostics, see report.h
+    const struct report *report;
+};
+
+// conversion stages, timed with --stats
+enum { STAGE_DECODE, STAGE_GREY, STAGE_EQUALIZE, STAGE_DITHER, STAGE_PACK, STAGE_EMIT, STAGES };
+
+// --stats, what conversion and printing of one input file took
+struct stats {
+    // D = decoded, S = decoded band by band (-s), C = taken from cache, G = printed from printer memory
+    char source;
+    unsigned int width;
+    unsigned int height;
+    // wall time of stages, seconds
+    double time[STAGES];
+    // bytes of PNG file, bytes of ESC/POS data printed, bands and flushes of output
+    unsigned long input;
+    unsigned long output;
+    unsigned long bands;
+    unsigned long flushes;
+    // buffers held by conversion, bytes, and the job they are counted into as well (may be NULL)
+    unsigned long memory;
+    unsigned long memory_peak;
+    struct job_memory *job;
+    // clock when its conversion started and when the first write of its output returned (0.0 if it was not written
+    // while the file was printed, -f J), for time to first byte
+    double begin;
+    double written;
+    // stage its conversion or printing failed in, STAGE_* + 1, 0 if it did not fail
+    unsigned int failed;
+};
+
+// monotonic clock, seconds
+double clock_seconds(void);
+
+// clock is read only if stats are collected (stats is not NULL)
+double stage_clock(const struct stats *stats);
+
+// conversion failed in the stage (stats may be NULL)
+void stage_failed(struct stats *stats, unsigned int stage);
+
+// output layer, printed data is collected as a vector of buffers and handed to the kernel
+// by a single writev(2) when flushed (or to the write callback of a library context, buffer
+// by buffer); bitmaps are not copied, so they have to be kept until they are written (see output_hold),
+// only band headers are copied
+#if defined(IOV_MAX) && IOV_MAX < 1024
+#define OUTPUT_IOVS IOV_MAX
+#else
+#define OUTPUT_IOVS 1024
+#endif
+
+// a band consists of header, bitmap and ESC_FLUSH
+#define OUTPUT_HEADER_LENGTH (ESC_OFFSET_LENGTH + ESC_STORE_LENGTH)
+#define OUTPUT_HEADERS (OUTPUT_IOVS / 3)
+
+#ifdef _WIN32
+struct iovec {
+    void *iov_base;
+    size_t iov_len;
+};
+#endif
+
+struct output {
+    int fd;
+    FILE *stream;
+    // if set, buffers are passed to it instead of fd, non-zero return value fails the output
+    int (*write)(void *user, const unsigned char *data, size_t length);
+    void *user;
+    // flush policy, B = after each band, F = after each file, J = at the end of job
+    char policy;
+    // server mode, each flush is sent as a chunk prefixed by its length (iov[0])
+    unsigned int framed;
+    unsigned char frame[4];
+    // pending buffers start at iov[1]
+    struct iovec iov[OUTPUT_IOVS];
+    unsigned int iovcnt;
+    unsigned char headers[OUTPUT_HEADERS][OUTPUT_HEADER_LENGTH];
+    unsigned int headercnt;
+    // buffers released once they are written
+    void **held;
+    unsigned int heldcnt;
+    unsigned int heldsize;
+    unsigned int failed;
+    unsigned long writes;
+    // --stats, bytes printed, bands printed and flushes that wrote something
+    unsigned long bytes;
+    unsigned long bands;
+    unsigned long flushes;
+    // --stats, clock of the first write since the caller set it to 0.0, negative if writes are not timed
+    double written;
+    // printer the output goes to, bands and paper feed follow it
+    const struct profile *profile;
+    // -e, the left margin is set only when it changes; left margin set by the last band (~0 if unknown)
+    // and bytes saved by blank row elision and trimming
+    unsigned int elide;
+    unsigned int margin;
+    long saved;
+    // diagnostics of printing, see report.h
+    const struct report *report;
+};
+
+// writes all pending buffers, output failure is sticky and reported at the end of job
+void output_flush(struct output *out);
+
+// buffer has to stay valid until output_flush() is called
+void print(struct output *out, const unsigned char *buffer, unsigned int length);
+
+struct segment;
+
+// one input file converted into B/W bitmap, ready to be printed
+struct raster {
+    unsigned char *img_bw;
+    unsigned int canvas_w;
+    unsigned int img_h;
+    unsigned int offset;
+    // converted image taken from cache, printed instead of img_bw
+    struct cache_entry cached;
+    // key of image kept in printer memory, img_bw (if any) is defined under the key before it is printed
+    // into memory of given kind (N = NV, D = download)
+    const unsigned char *graphics;
+    unsigned char graphics_hash[GRAPHICS_HASH_LENGTH];
+    unsigned int graphics_threshold;
+    char memory;
+    // -e, compacted img_bw
+    struct segment *segments;
+    unsigned int segmentcnt;
+    long saved;
+    // --stats
+    struct stats stats;
+};
+
+// -j, files of a batch being rasterized, see convert_batch(); states of its files (and of requests of client mode)
+#define BATCH_PENDING 0
+#define BATCH_DONE 1
+#define BATCH_FAILED 2
+
+struct batch;
+
+// decodes input file (or PNG in memory if png is not NULL) and converts it into B/W bitmap,
+// index is order of the file in batch (batch is NULL for a single file); in photo mode cfg->threshold
+// is shifted for the next file
+int rasterize(struct config *cfg, const char *input, const unsigned char *png, size_t png_size, struct raster *raster, struct batch *batch, unsigned int index);
+
+// prints bitmap chunked into bands, bitmap is passed to the output layer
+void print_raster(struct output *out, struct raster *raster);
+
+// prints a converted file, with --stats time and output it took are added to its stats
+void print_file(struct output *out, struct raster *raster, const struct config *cfg);
+
+// --compose, converted images waiting to be printed as one canvas
+struct compose {
+    struct raster *rasters;
+    unsigned int count;
+    unsigned int size;
+};
+
+// adds a converted file to the canvas, bitmap is passed to the canvas; an image taken from cache or printer memory
+// is printed on its own, after the canvas composed so far; returns 0 on success
+int compose_file(struct output *out, struct compose *compose, struct raster *raster, const struct config *cfg);
+
+// prints the canvas composed so far re-banded into full bands, images are passed to the output layer; returns 0 on success
+int compose_print(struct output *out, struct compose *compose);
+
+// releases images of the canvas without printing them
+void compose_release(struct compose *compose);
+
+// -s, decodes input file (or PNG of size bytes at data if it is not NULL) line by line and prints it band by band into out;
+// returns 0 on success, -1 if the image can not be streamed (caller falls back to full decode)
+int convert_stream(struct config *cfg, struct output *out, const char *input, const unsigned char *data, size_t size, struct stats *stats);
+
+// -j, rasterizes count input files by jobs threads, prints them into out in order as soon as they are ready;
+// with --stats, stats of printed files are stored into files; with --compose (compose is not NULL) files are added to the canvas
+int convert_batch(struct config *cfg, struct output *out, const char *const *inputs, unsigned int count, unsigned int jobs, struct stats *files, struct compose *compose);
+
+#endif
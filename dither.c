@@ -0,0 +1,433 @@
+/*!
+(c) 2012 - 2015 Petr Kutalek: png2pos
+
+Licensed under the MIT License, see png2pos.c
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include "dither.h"
+#include "grey.h"
+
+#if defined(__GNUC__)
+#define DITHER_WAVEFRONT
+#define progress_load(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define progress_store(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#endif
+
+// lines in ring are padded, so the error may be diffused out of the line without any check
+#define DITHER_PAD 2u
+
+// pixels dithered by a thread between two progress updates
+#define DITHER_BLOCK 32u
+
+// pixel x of a line needs pixels up to x + 3 of the previous line to be dithered:
+// x + 2 receives the error from x + 1, x + 2 and x + 3 of the previous line before x diffuses into it
+#define DITHER_LAG 4u
+
+// progress of a thread, line × (w + 1) + dithered pixels of the line, so it never decreases;
+// padded to its own cache line
+struct dither_progress {
+    size_t done;
+    unsigned char pad[64 - sizeof(size_t)];
+};
+
+struct dither_state {
+    unsigned char *img_grey;
+    unsigned int w;
+    unsigned int rows;
+    unsigned int avail;
+    unsigned int threshold;
+    unsigned int threads;
+    unsigned int slots;
+    unsigned int stride;
+    unsigned char *ring;
+    struct dither_progress *progress;
+    pthread_mutex_t lock;
+};
+
+struct dither_worker {
+    struct dither_state *state;
+    unsigned int id;
+};
+
+static unsigned char* ring_line(const struct dither_state *s, const unsigned int y) {
+    return &s->ring[(y % s->slots) * s->stride + DITHER_PAD];
+}
+
+static inline unsigned int clamp_add(const unsigned int value, const int d) {
+    const int a = (int)value + d;
+    return a < 0x00 ? 0x00 : a > 0xff ? 0xff : a;
+}
+
+// dithers pixels [x; end) of a line, interior loop without any branch on position;
+// next points one pixel to the left of the next line, so it is never indexed by x - 1
+static void dither_span(unsigned char *restrict out, unsigned char *restrict cur, unsigned char *restrict next, unsigned char *restrict next2,
+        unsigned int x, const unsigned int end, const unsigned int threshold) {
+    for (; x != end; ++x) {
+        const unsigned int o = cur[x];
+        const unsigned int n = o <= threshold ? 0x00 : 0xff;
+        const int d = ((int)o - (int)n) / 8;
+        out[x] = n;
+
+        cur[x + 1] = clamp_add(cur[x + 1], d);
+        cur[x + 2] = clamp_add(cur[x + 2], d);
+        next[x] = clamp_add(next[x], d);
+        next[x + 1] = clamp_add(next[x + 1], d);
+        next[x + 2] = clamp_add(next[x + 2], d);
+        next2[x] = clamp_add(next2[x], d);
+    }
+}
+
+static void dither_line(struct dither_state *s, const unsigned int y) {
+    const unsigned int w = s->w;
+    unsigned char *cur = ring_line(s, y);
+    unsigned char *next = ring_line(s, y + 1) - 1;
+    unsigned char *next2 = ring_line(s, y + 2);
+    unsigned char *out = &s->img_grey[(size_t)y * w];
+
+    // slot of line y + 2 has been freed by line y - threads, dithered by the same thread;
+    // error diffused beyond avail lines is lost in the slot
+    if (y + 2 < s->avail) {
+        memcpy(next2, &s->img_grey[(size_t)(y + 2) * w], w);
+    }
+
+#ifdef DITHER_WAVEFRONT
+    if (s->threads > 1) {
+        const size_t base = (size_t)y * (w + 1);
+        const size_t base_prev = base - (w + 1);
+        const size_t *prev = &s->progress[(y + s->threads - 1) % s->threads].done;
+        size_t *mine = &s->progress[y % s->threads].done;
+
+        for (unsigned int x = 0; x != w;) {
+            const unsigned int end = w - x < DITHER_BLOCK ? w : x + DITHER_BLOCK;
+            if (y != 0) {
+                const unsigned int need = w - end < DITHER_LAG - 1 ? w : end + DITHER_LAG - 1;
+                while (progress_load(prev) < base_prev + need) {
+                    sched_yield();
+                }
+            }
+            dither_span(out, cur, next, next2, x, end, s->threshold);
+            progress_store(mine, base + end);
+            x = end;
+        }
+        return;
+    }
+#endif
+
+    dither_span(out, cur, next, next2, 0, w, s->threshold);
+}
+
+static void* dither_thread(void *arg) {
+    const struct dither_worker *worker = (const struct dither_worker *)arg;
+    struct dither_state *s = worker->state;
+
+    // wait until the number of threads is known
+    pthread_mutex_lock(&s->lock);
+    const unsigned int threads = s->threads;
+    pthread_mutex_unlock(&s->lock);
+
+    for (unsigned int y = worker->id; y < s->rows; y += threads) {
+        dither_line(s, y);
+    }
+    return NULL;
+}
+
+unsigned int dither_atkinson(unsigned char *img_grey, const unsigned int w, const unsigned int rows, const unsigned int avail, const unsigned int threshold, unsigned int threads) {
+    if (w == 0 || rows == 0) {
+        return 0;
+    }
+
+#ifndef DITHER_WAVEFRONT
+    threads = 1;
+#endif
+    if (threads > rows) {
+        threads = rows;
+    }
+    if (threads == 0) {
+        threads = 1;
+    }
+
+    struct dither_state s = {
+        .img_grey = img_grey,
+        .w = w,
+        .rows = rows,
+        .avail = avail,
+        .threshold = threshold,
+        .threads = threads,
+        .slots = threads + 2,
+        .stride = w + 2 * DITHER_PAD,
+        .ring = NULL,
+        .progress = NULL
+    };
+    pthread_t *tids = NULL;
+    struct dither_worker *workers = NULL;
+    unsigned int started = 0;
+
+    s.ring = (unsigned char *)calloc(s.slots, s.stride);
+    s.progress = (struct dither_progress *)calloc(threads, sizeof(struct dither_progress));
+    tids = (pthread_t *)calloc(threads, sizeof(pthread_t));
+    workers = (struct dither_worker *)calloc(threads, sizeof(struct dither_worker));
+    if (!s.ring || !s.progress || !tids || !workers) {
+        free(s.ring), s.ring = NULL;
+        free(s.progress), s.progress = NULL;
+        free(tids), tids = NULL;
+        free(workers), workers = NULL;
+        return DITHER_E_MEMORY;
+    }
+
+    pthread_mutex_init(&s.lock, NULL);
+    pthread_mutex_lock(&s.lock);
+    for (unsigned int t = 0; t != threads; ++t) {
+        workers[t].state = &s;
+        workers[t].id = t;
+    }
+    // thread 0 is the calling one, lines of threads which could not be started are taken by the others
+    for (started = 1; started != threads; ++started) {
+        if (pthread_create(&tids[started], NULL, dither_thread, &workers[started]) != 0) {
+            break;
+        }
+    }
+    s.threads = started;
+    s.slots = started + 2;
+
+    // the first two lines, the following ones are loaded as they enter the ring
+    for (unsigned int y = 0; y != 2 && y < avail; ++y) {
+        memcpy(ring_line(&s, y), &img_grey[(size_t)y * w], w);
+    }
+    pthread_mutex_unlock(&s.lock);
+
+    dither_thread(&workers[0]);
+    for (unsigned int t = 1; t != started; ++t) {
+        pthread_join(tids[t], NULL);
+    }
+
+    // lines ahead keep the error diffused into them
+    for (unsigned int y = rows; y != rows + 2 && y < avail; ++y) {
+        memcpy(&img_grey[(size_t)y * w], ring_line(&s, y), w);
+    }
+
+    pthread_mutex_destroy(&s.lock);
+    free(s.ring), s.ring = NULL;
+    free(s.progress), s.progress = NULL;
+    free(tids), tids = NULL;
+    free(workers), workers = NULL;
+    return 0;
+}
+
+// ordered dithering matrices, Bayer index matrices and a 32 × 32 blue noise mask (void-and-cluster, σ = 1.9),
+// blue noise ranks are quantized to 256 levels
+static const unsigned char BAYER_4[16] = {
+     0,  8,  2, 10,
+    12,  4, 14,  6,
+     3, 11,  1,  9,
+    15,  7, 13,  5
+};
+
+static const unsigned char BAYER_8[64] = {
+     0, 32,  8, 40,  2, 34, 10, 42,
+    48, 16, 56, 24, 50, 18, 58, 26,
+    12, 44,  4, 36, 14, 46,  6, 38,
+    60, 28, 52, 20, 62, 30, 54, 22,
+     3, 35, 11, 43,  1, 33,  9, 41,
+    51, 19, 59, 27, 49, 17, 57, 25,
+    15, 47,  7, 39, 13, 45,  5, 37,
+    63, 31, 55, 23, 61, 29, 53, 21
+};
+
+static const unsigned char BLUE_NOISE_32[1024] = {
+    0x34, 0x5f, 0xca, 0x91, 0x2d, 0x9a, 0x7a, 0xe7, 0xc9, 0x1d, 0xb1, 0xfa, 0x35, 0x50, 0xbf, 0x60,
+    0x3a, 0x14, 0xd9, 0xf8, 0xa1, 0xe2, 0x6b, 0xf4, 0x55, 0x2a, 0x48, 0x9f, 0x75, 0x56, 0xf1, 0xbe,
+    0x86, 0xfc, 0x1d, 0x6c, 0xc2, 0xef, 0x07, 0x42, 0x57, 0xdc, 0x9c, 0x83, 0x17, 0xa4, 0x76, 0x0c,
+    0xed, 0x7e, 0x92, 0xaf, 0x5f, 0x40, 0x20, 0xb7, 0x8d, 0xe6, 0xc1, 0x0e, 0xd0, 0x43, 0xe4, 0x15,
+    0x4e, 0xa4, 0x41, 0x81, 0x51, 0xd5, 0x26, 0x89, 0xbe, 0x2e, 0x09, 0x69, 0xd3, 0x29, 0xf5, 0x44,
+    0xcf, 0x6a, 0x53, 0x01, 0x2b, 0xc5, 0x7d, 0xd9, 0x16, 0x63, 0xb0, 0xf6, 0x2f, 0x8f, 0xab, 0x6f,
+    0xb9, 0xd1, 0xe5, 0x0c, 0xb2, 0xf6, 0x65, 0xac, 0x71, 0xed, 0x3d, 0xb8, 0xe4, 0x59, 0x95, 0xad,
+    0x20, 0x31, 0xb8, 0xd5, 0x8c, 0xf1, 0xa6, 0x4d, 0x06, 0x97, 0x3c, 0x7c, 0x5b, 0xc8, 0x01, 0x2a,
+    0x93, 0x1a, 0x5c, 0x30, 0x9e, 0x11, 0x49, 0x96, 0x15, 0xcd, 0x7d, 0x4c, 0x8d, 0x04, 0xc4, 0x82,
+    0xe2, 0x9e, 0xeb, 0x15, 0x46, 0x6e, 0x34, 0xcb, 0xfb, 0x71, 0x24, 0xa3, 0x1b, 0xef, 0x67, 0xdb,
+    0x3a, 0xf8, 0x73, 0x8d, 0xcf, 0x7c, 0xe1, 0x36, 0xfd, 0x5d, 0x9d, 0x1f, 0xf0, 0x36, 0x64, 0x11,
+    0x4d, 0x70, 0x86, 0x5a, 0xbf, 0x9b, 0x1a, 0x87, 0x55, 0xb3, 0xd8, 0xe5, 0x88, 0xb6, 0x48, 0x7d,
+    0x0a, 0xab, 0xc1, 0xec, 0x3f, 0x58, 0xc5, 0x22, 0xb4, 0x0a, 0xda, 0xaa, 0xc9, 0x74, 0xb6, 0xf7,
+    0x3d, 0xcc, 0x08, 0xfe, 0x27, 0xe2, 0x62, 0xed, 0x2e, 0xc2, 0x44, 0x07, 0x53, 0x33, 0xc6, 0x9e,
+    0x63, 0x29, 0x4f, 0x1f, 0x03, 0xa7, 0x69, 0x92, 0x85, 0x53, 0x6d, 0x2b, 0x46, 0x18, 0x9a, 0xd6,
+    0x23, 0xb1, 0xa5, 0x38, 0x7c, 0xb5, 0x05, 0xa8, 0x7a, 0x14, 0x65, 0x9b, 0x70, 0xff, 0x14, 0xe0,
+    0xf1, 0x87, 0xd6, 0x6f, 0xba, 0xe5, 0x2d, 0xd3, 0xea, 0x3b, 0xbd, 0xf9, 0x87, 0xe1, 0x58, 0x7a,
+    0x8f, 0x52, 0x65, 0xda, 0x94, 0x4c, 0xd2, 0x3c, 0xdf, 0x8e, 0xf4, 0xd2, 0xae, 0x24, 0x8f, 0x58,
+    0x78, 0xb4, 0x44, 0x95, 0xfc, 0x81, 0x18, 0x4c, 0x05, 0x76, 0x97, 0x0f, 0x61, 0xa8, 0x00, 0x31,
+    0xe8, 0x1a, 0xc1, 0x0d, 0xf2, 0x72, 0x1d, 0x5a, 0xa0, 0x27, 0x4d, 0x0f, 0x7f, 0xbc, 0x41, 0xcb,
+    0x32, 0x19, 0xa3, 0x0e, 0x36, 0x5d, 0x9d, 0xc3, 0xf5, 0xa5, 0x24, 0xce, 0xec, 0x3e, 0xb8, 0xc8,
+    0xf9, 0x6f, 0x9f, 0x2c, 0x43, 0x8a, 0xc5, 0xfc, 0xb7, 0x6b, 0xc7, 0x39, 0x5e, 0xe6, 0xa1, 0x04,
+    0xda, 0xee, 0xc0, 0x54, 0xdb, 0x75, 0xb2, 0x40, 0x64, 0xdd, 0x34, 0x7e, 0x4d, 0x8e, 0x68, 0x12,
+    0x47, 0x84, 0xdd, 0x5d, 0xcf, 0xad, 0x12, 0x32, 0x81, 0x00, 0xec, 0x94, 0xd6, 0x1c, 0x4f, 0x6d,
+    0x82, 0x26, 0x66, 0x8b, 0xf3, 0x23, 0xce, 0x13, 0x88, 0x55, 0xaf, 0x1b, 0xbe, 0xd9, 0x28, 0x98,
+    0xac, 0x37, 0xb8, 0x21, 0xec, 0x67, 0x4f, 0x99, 0xe2, 0x43, 0xa9, 0x72, 0x2c, 0x86, 0xf8, 0xaf,
+    0x5b, 0x98, 0xca, 0x47, 0x01, 0xa8, 0x31, 0x6e, 0xee, 0x08, 0x93, 0xff, 0x70, 0x0c, 0xf0, 0x7b,
+    0xe3, 0x51, 0x05, 0x93, 0x7e, 0x0c, 0xd8, 0x76, 0xc1, 0x1f, 0x56, 0xf3, 0x0b, 0x9c, 0xc2, 0x3d,
+    0xe9, 0x09, 0x38, 0xb5, 0x79, 0xe7, 0x96, 0xd9, 0xba, 0x45, 0xc7, 0x5e, 0x3b, 0xa2, 0x59, 0xd0,
+    0x16, 0x64, 0xfa, 0xc8, 0x40, 0xa6, 0xf5, 0x2b, 0x60, 0x90, 0xcb, 0xb4, 0x37, 0x62, 0xd1, 0x15,
+    0x74, 0xa7, 0xfb, 0xd4, 0x1c, 0x5c, 0x4e, 0x7f, 0x29, 0x9f, 0x1e, 0xe3, 0x85, 0x2e, 0xb3, 0x41,
+    0xc2, 0x75, 0xa0, 0x25, 0x57, 0xba, 0x1a, 0x3a, 0xa2, 0xea, 0x16, 0x4b, 0xde, 0x7a, 0x23, 0x49,
+    0xe1, 0x84, 0x2a, 0x6c, 0x8f, 0xc3, 0x3b, 0x11, 0xfa, 0x69, 0x79, 0xd3, 0x02, 0xf4, 0x94, 0x1f,
+    0x8b, 0xed, 0x30, 0xd7, 0x85, 0xe6, 0x6a, 0xd0, 0x80, 0x08, 0x6f, 0x89, 0xa4, 0xfd, 0x91, 0xbb,
+    0x10, 0x61, 0x50, 0x9e, 0x0b, 0xf2, 0xa6, 0xcc, 0xb3, 0x54, 0x34, 0xaa, 0xbd, 0x51, 0x68, 0xdb,
+    0x09, 0x4b, 0xaf, 0x6d, 0x02, 0x47, 0x90, 0xb4, 0x52, 0xf7, 0x41, 0xbd, 0x2c, 0x02, 0x59, 0xae,
+    0x32, 0xf5, 0xc0, 0x3f, 0xde, 0x25, 0x86, 0x62, 0x06, 0xea, 0x8c, 0x48, 0x13, 0x74, 0xe8, 0xa7,
+    0x38, 0x5f, 0xbb, 0x17, 0x9a, 0xff, 0x33, 0x0f, 0xdd, 0xab, 0x21, 0xd7, 0x68, 0xe7, 0x3d, 0xcc,
+    0x8a, 0x1d, 0xd7, 0xb0, 0x72, 0x4a, 0xe6, 0x2f, 0x98, 0xd8, 0x1b, 0xf8, 0x9c, 0xcd, 0x28, 0x82,
+    0xc7, 0xf9, 0x78, 0xe3, 0xcd, 0x5c, 0xc3, 0x26, 0x77, 0x92, 0x5e, 0xc6, 0x83, 0x19, 0x9b, 0x6e,
+    0xa5, 0x7b, 0x03, 0x93, 0x5d, 0x13, 0xbb, 0x78, 0x42, 0x6d, 0xc4, 0x7f, 0x3c, 0x61, 0x0d, 0x45,
+    0x99, 0x10, 0x8e, 0x22, 0x3e, 0x7f, 0xa0, 0x66, 0xea, 0x39, 0x06, 0x4e, 0xb2, 0xf0, 0x48, 0xdc,
+    0x27, 0x54, 0xef, 0x35, 0xd0, 0xfc, 0x9d, 0xc9, 0x22, 0xac, 0x56, 0x2c, 0xb9, 0xdc, 0xf1, 0xad,
+    0x57, 0xda, 0x2f, 0x52, 0xa9, 0xf3, 0x19, 0x49, 0xce, 0xa6, 0xf9, 0x98, 0x30, 0x79, 0x0d, 0xbc,
+    0x3b, 0xc7, 0x66, 0xaa, 0x1e, 0x82, 0x52, 0x07, 0xee, 0x90, 0xe1, 0x04, 0xa2, 0x8a, 0x1e, 0x76,
+    0xbf, 0x6c, 0xeb, 0xb7, 0x71, 0x07, 0xdb, 0xbb, 0x84, 0x11, 0x6e, 0xe0, 0x20, 0xd2, 0x5c, 0xfe,
+    0x80, 0x0f, 0xe9, 0x8b, 0x45, 0xb7, 0x6a, 0x39, 0xd5, 0x60, 0x17, 0xfd, 0x6b, 0x50, 0x33, 0xd2,
+    0x00, 0x3f, 0x16, 0x97, 0xcb, 0x35, 0x8c, 0x5a, 0x29, 0x40, 0xb5, 0x54, 0x8b, 0xa8, 0x6b, 0x95,
+    0x4a, 0xb9, 0x9b, 0x2d, 0xde, 0x10, 0xf6, 0xa3, 0x84, 0x2f, 0xc0, 0x44, 0x7d, 0xe9, 0xb3, 0x91,
+    0xfb, 0xa5, 0x83, 0x5e, 0xe0, 0x46, 0xac, 0xfd, 0x75, 0xd1, 0xe7, 0x14, 0xc4, 0x36, 0x00, 0xe4,
+    0xd4, 0x1c, 0x73, 0x55, 0xca, 0x7b, 0x28, 0xbc, 0x49, 0x73, 0xae, 0x97, 0xc9, 0x0a, 0x25, 0x63,
+    0x4b, 0xc6, 0x2a, 0xf4, 0x0b, 0x69, 0x21, 0x95, 0x03, 0xa1, 0x63, 0x7e, 0x46, 0xf2, 0xb1, 0x25,
+    0xa3, 0x61, 0xfa, 0x05, 0xad, 0x5f, 0x96, 0xe5, 0x0a, 0xf2, 0x21, 0xd7, 0x3a, 0x5a, 0xa1, 0xdf,
+    0x74, 0x1b, 0xb1, 0x50, 0x79, 0xbf, 0xe9, 0xc8, 0x4f, 0x33, 0xf6, 0x22, 0x9a, 0xce, 0x58, 0x88,
+    0xdf, 0x30, 0xc0, 0x43, 0xeb, 0x37, 0x1c, 0xcd, 0x57, 0x8d, 0x67, 0x12, 0xf7, 0x88, 0xbc, 0x10,
+    0xef, 0x38, 0x8c, 0xd6, 0x9f, 0x31, 0x83, 0x12, 0xdf, 0xb0, 0x8e, 0xbe, 0x0b, 0x6c, 0x77, 0x3e,
+    0x0d, 0x92, 0x81, 0xd1, 0xa0, 0x89, 0x70, 0xb0, 0x3e, 0xdd, 0xa2, 0x51, 0x77, 0x2e, 0xd3, 0x45,
+    0x99, 0xca, 0x66, 0xeb, 0x0e, 0x42, 0xb6, 0x62, 0x72, 0x3f, 0x59, 0xd8, 0x2d, 0xe8, 0x18, 0xf7,
+    0x53, 0xb6, 0x67, 0x13, 0x24, 0x4e, 0xff, 0x01, 0x80, 0xc4, 0x28, 0xb9, 0xe8, 0xa9, 0x6a, 0x80,
+    0x56, 0x06, 0xab, 0x23, 0x5b, 0xfb, 0x91, 0x26, 0xee, 0x19, 0x7c, 0xa4, 0x4c, 0x89, 0xc6, 0xa9,
+    0x27, 0x47, 0xf3, 0x77, 0xe3, 0xba, 0xd4, 0x65, 0x32, 0xf0, 0x0e, 0x94, 0x42, 0x03, 0x1e, 0xfe,
+    0x2b, 0xe4, 0x71, 0x87, 0xbd, 0xcf, 0x4b, 0xaa, 0xd4, 0xc5, 0x02, 0xfe, 0xb5, 0x39, 0x64, 0xd5,
+    0x9c, 0xdc, 0x04, 0xae, 0x3c, 0x5b, 0x17, 0xa7, 0x90, 0x4a, 0x73, 0x60, 0xcc, 0xe0, 0x8a, 0xb2,
+    0x9d, 0xc3, 0x4a, 0x35, 0x18, 0x78, 0x08, 0x99, 0x37, 0x85, 0x68, 0xde, 0x20, 0x96, 0x09, 0x7b
+};
+
+const struct dither_engine DITHER_ENGINES[] = {
+    { "atkinson", 0, 0, NULL },
+    { "bayer4", 4, 16, BAYER_4 },
+    { "bayer8", 8, 64, BAYER_8 },
+    { "bluenoise", 32, 256, BLUE_NOISE_32 },
+    { NULL, 0, 0, NULL }
+};
+
+int dither_engine(const char *name) {
+    for (unsigned int i = 0; DITHER_ENGINES[i].name; ++i) {
+        if (strcmp(DITHER_ENGINES[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// rows are not split among threads into parts smaller than this
+#define DITHER_ORDERED_ROWS 64u
+
+struct ordered_state {
+    unsigned char *img_bw;
+    const unsigned char *img_grey;
+    unsigned int w;
+    unsigned int row_bytes;
+    unsigned int rows;
+    unsigned int y0;
+    int reverse;
+    unsigned int size;
+    // size lines of w thresholds, the matrix tiled horizontally
+    const unsigned char *thresholds;
+};
+
+struct ordered_worker {
+    const struct ordered_state *state;
+    unsigned int from;
+    unsigned int to;
+};
+
+static void* ordered_thread(void *arg) {
+    const struct ordered_worker *worker = (const struct ordered_worker *)arg;
+    const struct ordered_state *s = worker->state;
+
+    for (unsigned int y = worker->from; y != worker->to; ++y) {
+        // upside down rotation = reversed order of lines and mirrored lines
+        const unsigned int src = s->reverse ? s->rows - 1 - y : y;
+        grey_pack_map_line(&s->img_bw[(size_t)y * s->row_bytes], &s->img_grey[(size_t)src * s->w],
+            &s->thresholds[(size_t)((s->y0 + y) % s->size) * s->w], s->w, s->reverse);
+    }
+    return NULL;
+}
+
+unsigned int dither_ordered(unsigned char *img_bw, const unsigned char *img_grey, const unsigned int w, const unsigned int canvas_w, const unsigned int rows, const unsigned int y0,
+        const unsigned int engine, const unsigned int threshold, const int reverse, unsigned int threads) {
+    const struct dither_engine *e = &DITHER_ENGINES[engine];
+    if (w == 0 || rows == 0) {
+        return 0;
+    }
+
+    unsigned char *thresholds = (unsigned char *)malloc((size_t)e->size * w);
+    if (!thresholds) {
+        return DITHER_E_MEMORY;
+    }
+    // level v stands for threshold + (v + 0.5) / levels × 256 - 128
+    for (unsigned int r = 0; r != e->size; ++r) {
+        for (unsigned int x = 0; x != w; ++x) {
+            const int t = (int)threshold - 128 + (int)((2 * e->matrix[r * e->size + x % e->size] + 1) * 128 / e->levels);
+            thresholds[(size_t)r * w + x] = t < 0x00 ? 0x00 : t > 0xff ? 0xff : t;
+        }
+    }
+
+    const struct ordered_state s = {
+        .img_bw = img_bw,
+        .img_grey = img_grey,
+        .w = w,
+        .row_bytes = canvas_w >> 3,
+        .rows = rows,
+        .y0 = y0,
+        .reverse = reverse,
+        .size = e->size,
+        .thresholds = thresholds
+    };
+
+    if (threads > rows / DITHER_ORDERED_ROWS) {
+        threads = rows / DITHER_ORDERED_ROWS;
+    }
+    if (threads <= 1) {
+        const struct ordered_worker worker = { .state = &s, .from = 0, .to = rows };
+        ordered_thread((void *)&worker);
+        free(thresholds), thresholds = NULL;
+        return 0;
+    }
+
+    pthread_t *tids = (pthread_t *)calloc(threads, sizeof(pthread_t));
+    struct ordered_worker *workers = (struct ordered_worker *)calloc(threads, sizeof(struct ordered_worker));
+    if (!tids || !workers) {
+        free(tids), tids = NULL;
+        free(workers), workers = NULL;
+        free(thresholds), thresholds = NULL;
+        return DITHER_E_MEMORY;
+    }
+
+    // contiguous parts of rows, thread 0 is the calling one and takes parts of threads which could not be started
+    for (unsigned int t = 0; t != threads; ++t) {
+        workers[t].state = &s;
+        workers[t].from = (unsigned int)((unsigned long)rows * t / threads);
+        workers[t].to = (unsigned int)((unsigned long)rows * (t + 1) / threads);
+    }
+    unsigned int started = 1;
+    for (; started != threads; ++started) {
+        if (pthread_create(&tids[started], NULL, ordered_thread, &workers[started]) != 0) {
+            break;
+        }
+    }
+    ordered_thread(&workers[0]);
+    for (unsigned int t = started; t != threads; ++t) {
+        ordered_thread(&workers[t]);
+    }
+    for (unsigned int t = 1; t != started; ++t) {
+        pthread_join(tids[t], NULL);
+    }
+
+    free(tids), tids = NULL;
+    free(workers), workers = NULL;
+    free(thresholds), thresholds = NULL;
+    return 0;
+}
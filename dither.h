@@ -0,0 +1,58 @@
+/*!
+(c) 2012 - 2015 Petr Kutalek: png2pos
+
+Licensed under the MIT License, see png2pos.c
+*/
+
+#ifndef DITHER_H
+#define DITHER_H
+
+// Atkinson Dithering Algorithm
+//
+// Lines being dithered are kept in a small ring of padded lines, so the inner loop
+// needs neither bounds checks nor a division of pixel index into x and y.
+// Diffused error is clamped to <0; 255> after each addition, exactly as the original
+// in-place algorithm does, so ring holds the partially diffused lines themselves.
+//
+// With threads > 1 lines are dithered in a wavefront: thread n takes every n-th line
+// and follows the previous line with a lag of a few pixels; pixels receive the error
+// in the same order as in the serial run, therefore the result is bit-identical.
+
+#define DITHER_E_MEMORY 1
+
+// dithers first rows of img_grey (w pixels each) to 0x00/0xff, pixel is black if it is <= threshold,
+// error is diffused into (at most) avail rows; lines [rows; avail) are left partially diffused
+unsigned int dither_atkinson(unsigned char *img_grey, unsigned int w, unsigned int rows, unsigned int avail, unsigned int threshold, unsigned int threads);
+
+
+// Ordered dithering engines (-d): pixel is black if it is <= threshold of its position
+// in a matrix tiled over the image. No error is diffused, so rows are independent of each other,
+// they are compared with a row of thresholds and packed by SIMD kernels of grey.c straight into bitmap.
+// Matrices are centered on the threshold, so the threshold shift of photo mode applies to them as well.
+
+#define DITHER_ATKINSON 0
+#define DITHER_BAYER4 1
+#define DITHER_BAYER8 2
+#define DITHER_BLUE_NOISE 3
+
+struct dither_engine {
+    const char *name;
+    // matrix of size × size values in <0; levels), NULL for Atkinson
+    unsigned int size;
+    unsigned int levels;
+    const unsigned char *matrix;
+};
+
+// indexed by DITHER_* constants, terminated by { NULL }
+extern const struct dither_engine DITHER_ENGINES[];
+
+// engine of given name, -1 if there is no such engine
+int dither_engine(const char *name);
+
+// dithers rows of img_grey (w pixels each) by an ordered engine and packs them into img_bw (canvas_w / 8 bytes per row);
+// row y of img_bw takes matrix row (y0 + y), reverse flips and mirrors the image (upside down rotation);
+// rows are split among threads
+unsigned int dither_ordered(unsigned char *img_bw, const unsigned char *img_grey, unsigned int w, unsigned int canvas_w, unsigned int rows, unsigned int y0,
+    unsigned int engine, unsigned int threshold, int reverse, unsigned int threads);
+
+#endif
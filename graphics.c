@@ -0,0 +1,276 @@
+/*!
+(c) 2012 - 2015 Petr Kutalek: png2pos
+
+Licensed under the MIT License, see png2pos.c
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "report.h"
+#include "graphics.h"
+
+struct graphics_record {
+    char memory;
+    unsigned char key[2];
+    unsigned char hash[GRAPHICS_HASH_LENGTH];
+    unsigned int threshold;
+    unsigned int width;
+};
+
+struct graphics_mapping {
+    unsigned char key[2];
+    const char *file;
+};
+
+struct {
+    const char *path;
+    char memory;
+    // records of all memories and keys, including those not used by this job
+    struct graphics_record *records;
+    unsigned int count;
+    unsigned int size;
+    unsigned int dirty;
+    struct graphics_mapping mappings[GRAPHICS_MAX_KEYS];
+    unsigned int mappingcnt;
+    pthread_mutex_t lock;
+} graphics = {
+    .path = NULL,
+    .memory = 'N',
+    .records = NULL,
+    .count = 0,
+    .size = 0,
+    .dirty = 0,
+    .mappingcnt = 0,
+    .lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+static int key_valid(const char *key) {
+    return key[0] >= 32 && key[0] <= 126 && key[1] >= 32 && key[1] <= 126;
+}
+
+static int hex_digit(const char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+static struct graphics_record* record_find(const unsigned char *key) {
+    for (unsigned int i = 0; i != graphics.count; ++i) {
+        struct graphics_record *r = &graphics.records[i];
+        if (r->memory == graphics.memory && r->key[0] == key[0] && r->key[1] == key[1]) {
+            return r;
+        }
+    }
+    return NULL;
+}
+
+static struct graphics_record* record_add(void) {
+    if (graphics.count == graphics.size) {
+        const unsigned int size = graphics.size ? 2 * graphics.size : 16;
+        struct graphics_record *records = (struct graphics_record *)realloc(graphics.records, size * sizeof(struct graphics_record));
+        if (!records) {
+            return NULL;
+        }
+        graphics.records = records;
+        graphics.size = size;
+    }
+    return &graphics.records[graphics.count++];
+}
+
+int graphics_key(const char *spec, const struct report *diagnostics) {
+    if (strlen(spec) < 4 || spec[2] != ':' || !key_valid(spec)) {
+        report(diagnostics, "Graphics key has to be two characters followed by ':' and file name");
+        return 1;
+    }
+    if (graphics.mappingcnt == GRAPHICS_MAX_KEYS) {
+        report(diagnostics, "At most %u graphics keys can be used", GRAPHICS_MAX_KEYS);
+        return 1;
+    }
+
+    struct graphics_mapping *m = &graphics.mappings[graphics.mappingcnt++];
+    m->key[0] = spec[0];
+    m->key[1] = spec[1];
+    m->file = &spec[3];
+    return 0;
+}
+
+int graphics_open(const char *path, const char memory, const struct report *diagnostics) {
+    int ret = 1;
+    char line[128];
+
+    graphics.path = path;
+    graphics.memory = memory;
+
+    FILE *frecord = fopen(path, "r");
+    if (!frecord) {
+        if (errno == ENOENT) {
+            // nothing has been stored yet
+            return 0;
+        }
+        report(diagnostics, "Could not open graphics record '%s'", path);
+        return 1;
+    }
+
+    // "M KK <64 hex digits> T W", key may contain a space, so fields have fixed positions
+    for (unsigned int n = 1; fgets(line, sizeof(line), frecord); ++n) {
+        const size_t length = strcspn(line, "\r\n");
+        if (length == 0 || line[0] == '#') {
+            continue;
+        }
+        line[length] = '\0';
+
+        struct graphics_record r;
+        unsigned int valid = length >= 6 + 2 * GRAPHICS_HASH_LENGTH + 3
+            && (line[0] == 'N' || line[0] == 'D') && line[1] == ' '
+            && key_valid(&line[2]) && line[4] == ' ' && line[5 + 2 * GRAPHICS_HASH_LENGTH] == ' ';
+        for (unsigned int i = 0; valid && i != GRAPHICS_HASH_LENGTH; ++i) {
+            const int hi = hex_digit(line[5 + 2 * i]);
+            const int lo = hex_digit(line[6 + 2 * i]);
+            valid = hi >= 0 && lo >= 0;
+            r.hash[i] = hi << 4 | lo;
+        }
+        if (valid) {
+            char *end = NULL;
+            r.threshold = strtoul(&line[6 + 2 * GRAPHICS_HASH_LENGTH], &end, 10);
+            valid = *end == ' ' && r.threshold <= 255;
+        }
+        if (valid) {
+            char *end = NULL;
+            const char *width = strchr(&line[6 + 2 * GRAPHICS_HASH_LENGTH], ' ') + 1;
+            r.width = strtoul(width, &end, 10);
+            valid = end != width && *end == '\0' && r.width % 8 == 0;
+        }
+        if (!valid) {
+            report(diagnostics, "Graphics record '%s' is corrupted at line %u", path, n);
+            goto fail;
+        }
+        r.memory = line[0];
+        r.key[0] = line[2];
+        r.key[1] = line[3];
+
+        struct graphics_record *slot = record_add();
+        if (!slot) {
+            report(diagnostics, "Could not allocate enough memory");
+            goto fail;
+        }
+        *slot = r;
+    }
+    ret = 0;
+
+fail:
+    fclose(frecord), frecord = NULL;
+    return ret;
+}
+
+const unsigned char* graphics_find(const char *file) {
+    if (!graphics.path || !file) {
+        return NULL;
+    }
+    for (unsigned int i = 0; i != graphics.mappingcnt; ++i) {
+        if (strcmp(graphics.mappings[i].file, file) == 0) {
+            return graphics.mappings[i].key;
+        }
+    }
+    return NULL;
+}
+
+char graphics_memory(void) {
+    return graphics.memory;
+}
+
+int graphics_lookup(const unsigned char *key, const unsigned char *hash, unsigned int *threshold, unsigned int *width) {
+    int ret = 1;
+    pthread_mutex_lock(&graphics.lock);
+    const struct graphics_record *r = record_find(key);
+    if (r && memcmp(r->hash, hash, GRAPHICS_HASH_LENGTH) == 0) {
+        *threshold = r->threshold;
+        *width = r->width;
+        ret = 0;
+    }
+    pthread_mutex_unlock(&graphics.lock);
+    return ret;
+}
+
+void graphics_stored(const unsigned char *key, const unsigned char *hash, const unsigned int threshold, const unsigned int width) {
+    pthread_mutex_lock(&graphics.lock);
+    struct graphics_record *r = record_find(key);
+    if (!r && (r = record_add()) != NULL) {
+        r->memory = graphics.memory;
+        r->key[0] = key[0];
+        r->key[1] = key[1];
+    }
+    // without memory for the record the image is just defined again next time
+    if (r) {
+        memcpy(r->hash, hash, GRAPHICS_HASH_LENGTH);
+        r->threshold = threshold;
+        r->width = width;
+        graphics.dirty = 1;
+    }
+    pthread_mutex_unlock(&graphics.lock);
+}
+
+int graphics_save(const struct report *diagnostics) {
+    static const char HEX[16] = "0123456789abcdef";
+    int ret = 1;
+    char *tmp = NULL;
+    FILE *frecord = NULL;
+
+    if (!graphics.path || graphics.dirty == 0) {
+        return 0;
+    }
+
+    // the record is replaced at once, so it is never left half written
+    const size_t path_length = strlen(graphics.path);
+    if (!(tmp = (char *)malloc(path_length + 5))) {
+        report(diagnostics, "Could not allocate enough memory");
+        goto fail;
+    }
+    memcpy(tmp, graphics.path, path_length);
+    memcpy(&tmp[path_length], ".tmp", 5);
+
+    if (!(frecord = fopen(tmp, "w"))) {
+        report(diagnostics, "Could not write graphics record '%s'", graphics.path);
+        goto fail;
+    }
+    fprintf(frecord, "# png2pos graphics record: memory, key, hash, threshold, width\n");
+    for (unsigned int i = 0; i != graphics.count; ++i) {
+        const struct graphics_record *r = &graphics.records[i];
+        char hash[2 * GRAPHICS_HASH_LENGTH + 1];
+        for (unsigned int j = 0; j != GRAPHICS_HASH_LENGTH; ++j) {
+            hash[2 * j] = HEX[r->hash[j] >> 4];
+            hash[2 * j + 1] = HEX[r->hash[j] & 0x0f];
+        }
+        hash[2 * GRAPHICS_HASH_LENGTH] = '\0';
+        fprintf(frecord, "%c %c%c %s %u %u\n", r->memory, r->key[0], r->key[1], hash, r->threshold, r->width);
+    }
+    const int error = ferror(frecord);
+    if (fclose(frecord) != 0 || error) {
+        frecord = NULL;
+        report(diagnostics, "Could not write graphics record '%s'", graphics.path);
+        remove(tmp);
+        goto fail;
+    }
+    frecord = NULL;
+
+#ifdef _WIN32
+    remove(graphics.path);
+#endif
+    if (rename(tmp, graphics.path) != 0) {
+        report(diagnostics, "Could not write graphics record '%s'", graphics.path);
+        remove(tmp);
+        goto fail;
+    }
+    graphics.dirty = 0;
+    ret = 0;
+
+fail:
+    free(tmp), tmp = NULL;
+    return ret;
+}
@@ -0,0 +1,48 @@
+/*!
+(c) 2012 - 2015 Petr Kutalek: png2pos
+
+Licensed under the MIT License, see png2pos.c
+*/
+
+#ifndef GRAPHICS_H
+#define GRAPHICS_H
+
+// Graphics kept in printer memory under a key (GS ( L functions 67/69 for NV memory, 83/85 for download memory).
+// A logo is sent to the printer once, later jobs print it by its two byte key only.
+//
+// What each printer holds is tracked in a local record file, one line per key:
+//   memory (N or D), key, SHA-256 of PNG and conversion options (64 hex digits), threshold for the next file, width
+// An image is defined again whenever its hash differs from the record, i.e. the PNG or options have changed.
+
+#define GRAPHICS_HASH_LENGTH 32
+
+struct report;
+
+// at most this many -n mappings
+#define GRAPHICS_MAX_KEYS 64
+
+// maps an input file onto a key, spec is KEY:FILE, KEY consists of two characters from <32; 126>;
+// spec has to stay valid as long as graphics are used; returns 0 on success, the reason of failure goes to diagnostics
+int graphics_key(const char *spec, const struct report *diagnostics);
+
+// loads the record of printer memory (N = NV graphics, D = download graphics), missing file is an empty record;
+// returns 0 on success, the reason of failure goes to diagnostics
+int graphics_open(const char *path, char memory, const struct report *diagnostics);
+
+// key of an input file, NULL if the file is printed as a bitmap
+const unsigned char* graphics_find(const char *file);
+
+// returns 0 if the printer holds image of given hash under the key,
+// threshold is the one left by the image, width is width of its canvas
+int graphics_lookup(const unsigned char *key, const unsigned char *hash, unsigned int *threshold, unsigned int *width);
+
+// records that the image has been sent to the printer
+void graphics_stored(const unsigned char *key, const unsigned char *hash, unsigned int threshold, unsigned int width);
+
+// memory given to graphics_open()
+char graphics_memory(void);
+
+// writes the record back if anything has changed; returns 0 on success, the reason of failure goes to diagnostics
+int graphics_save(const struct report *diagnostics);
+
+#endif
@@ -0,0 +1,826 @@
+/*!
+(c) 2012 - 2015 Petr Kutalek: png2pos
+
+Licensed under the MIT License, see png2pos.c
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "grey.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GREY_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) && defined(__aarch64__) && defined(__ARM_NEON)
+#define GREY_NEON
+#include <arm_neon.h>
+#endif
+
+// lines are processed in chunks small enough to stay in L1, multiple of 8 px
+#define GREY_CHUNK 256u
+
+grey_kernel grey_convert = grey_scalar;
+grey_pack_kernel grey_pack = grey_pack_scalar;
+grey_pack_map_kernel grey_pack_map = grey_pack_map_scalar;
+grey_transpose_kernel grey_transpose = grey_transpose_scalar;
+grey_filter_line_kernel grey_filter_line = grey_filter_line_scalar;
+grey_filter_rows_kernel grey_filter_rows = grey_filter_rows_scalar;
+
+// bit order reversal of a byte, for movemask based packing
+static unsigned char BIT_REVERSE[256];
+
+// lightness L* of grey levels, as grey_scalar converts an opaque grey pixel
+static unsigned char LEVEL_LIGHTNESS[256];
+
+void grey_scalar(unsigned char *img_grey, const unsigned char *img_rgba, const unsigned int size) {
+    for (unsigned int i = 0; i != size; ++i) {
+        // A
+        const unsigned int a = img_rgba[(i << 2) | 3];
+        // RGBA → RGB
+        const unsigned int r = (255 - a) + a / 255 * img_rgba[i << 2];
+        const unsigned int g = (255 - a) + a / 255 * img_rgba[(i << 2) | 1];
+        const unsigned int b = (255 - a) + a / 255 * img_rgba[(i << 2) | 2];
+        // RGB → R'G'B'
+        const unsigned int r_ = GAMMA_22[r];
+        const unsigned int g_ = GAMMA_22[g];
+        const unsigned int b_ = GAMMA_22[b];
+        // R'G'B' → luma Y' (!= luminance), CIE, BT.709
+        const unsigned int y_ = (55 * r_ + 182 * g_ + 18 * b_) / 255;
+        // Y' → lightness L*
+        img_grey[i] = LIGHTNESS[y_];
+    }
+}
+
+void grey_linear(unsigned char *img_y, const unsigned char *img_rgba, const unsigned int size) {
+    for (unsigned int i = 0; i != size; ++i) {
+        // the same as grey_scalar, without the lightness lookup
+        const unsigned int a = img_rgba[(i << 2) | 3];
+        const unsigned int r = (255 - a) + a / 255 * img_rgba[i << 2];
+        const unsigned int g = (255 - a) + a / 255 * img_rgba[(i << 2) | 1];
+        const unsigned int b = (255 - a) + a / 255 * img_rgba[(i << 2) | 2];
+        img_y[i] = (55 * GAMMA_22[r] + 182 * GAMMA_22[g] + 18 * GAMMA_22[b]) / 255;
+    }
+}
+
+void grey_pack_scalar(unsigned char *img_bw, const unsigned char *img_grey, const unsigned int size, const unsigned int threshold) {
+    unsigned int i = 0;
+    for (; i + 8 <= size; i += 8) {
+        unsigned int byte = 0;
+        for (unsigned int j = 0; j != 8; ++j) {
+            byte |= (img_grey[i + j] <= threshold) << (7 - j);
+        }
+        img_bw[i >> 3] = byte;
+    }
+    if (i != size) {
+        unsigned int byte = 0;
+        for (unsigned int j = 0; i + j != size; ++j) {
+            byte |= (img_grey[i + j] <= threshold) << (7 - j);
+        }
+        img_bw[i >> 3] = byte;
+    }
+}
+
+void grey_pack_map_scalar(unsigned char *img_bw, const unsigned char *img_grey, const unsigned char *thresholds, const unsigned int size) {
+    for (unsigned int i = 0; i < size; i += 8) {
+        unsigned int byte = 0;
+        for (unsigned int j = 0; j != 8 && i + j != size; ++j) {
+            byte |= (img_grey[i + j] <= thresholds[i + j]) << (7 - j);
+        }
+        img_bw[i >> 3] = byte;
+    }
+}
+
+static void mirror(unsigned char *dst, const unsigned char *src, const unsigned int n) {
+    for (unsigned int i = 0; i != n; ++i) {
+        dst[i] = src[n - 1 - i];
+    }
+}
+
+void grey_pack_line(unsigned char *img_bw, const unsigned char *img_grey, const unsigned int w, const unsigned int threshold, const int reverse) {
+    if (!reverse) {
+        grey_pack(img_bw, img_grey, w, threshold);
+        return;
+    }
+    unsigned char line[GREY_CHUNK];
+    for (unsigned int x = 0; x < w; x += GREY_CHUNK) {
+        const unsigned int n = w - x < GREY_CHUNK ? w - x : GREY_CHUNK;
+        mirror(line, &img_grey[w - x - n], n);
+        grey_pack(&img_bw[x >> 3], line, n, threshold);
+    }
+}
+
+void grey_pack_map_line(unsigned char *img_bw, const unsigned char *img_grey, const unsigned char *thresholds, const unsigned int w, const int reverse) {
+    if (!reverse) {
+        grey_pack_map(img_bw, img_grey, thresholds, w);
+        return;
+    }
+    unsigned char line[GREY_CHUNK];
+    for (unsigned int x = 0; x < w; x += GREY_CHUNK) {
+        const unsigned int n = w - x < GREY_CHUNK ? w - x : GREY_CHUNK;
+        mirror(line, &img_grey[w - x - n], n);
+        grey_pack_map(&img_bw[x >> 3], line, &thresholds[x], n);
+    }
+}
+
+void grey_bw_line(unsigned char *img_bw, const unsigned char *img_rgba, const unsigned int w, const unsigned int threshold, const int reverse, unsigned int *histogram) {
+    unsigned char line[GREY_CHUNK];
+    unsigned char mirrored[GREY_CHUNK];
+    for (unsigned int x = 0; x < w; x += GREY_CHUNK) {
+        const unsigned int n = w - x < GREY_CHUNK ? w - x : GREY_CHUNK;
+        grey_convert(line, &img_rgba[(reverse ? w - x - n : x) << 2], n);
+        for (unsigned int i = 0; i != n; ++i) {
+            ++histogram[line[i]];
+        }
+        if (reverse) {
+            mirror(mirrored, line, n);
+            grey_pack(&img_bw[x >> 3], mirrored, n, threshold);
+        } else {
+            grey_pack(&img_bw[x >> 3], line, n, threshold);
+        }
+    }
+}
+
+void grey_levels(unsigned char *img_grey, const unsigned char *levels, const unsigned int size) {
+    for (unsigned int i = 0; i != size; ++i) {
+        img_grey[i] = LEVEL_LIGHTNESS[levels[i]];
+    }
+}
+
+void grey_unpack_line(unsigned char *img_grey, const unsigned char *img_bw, const unsigned int w) {
+    const unsigned char black = LEVEL_LIGHTNESS[0];
+    const unsigned char white = LEVEL_LIGHTNESS[255];
+    for (unsigned int x = 0; x != w; ++x) {
+        img_grey[x] = img_bw[x >> 3] & (0x80 >> (x & 7)) ? black : white;
+    }
+}
+
+void grey_mirror_bw_line(unsigned char *dst, const unsigned char *src, const unsigned int w) {
+    // bytes in reversed order with reversed bits, then shifted left by the padding of the last byte
+    const unsigned int n = (w + 7) >> 3;
+    const unsigned int pad = (n << 3) - w;
+    for (unsigned int i = 0; i != n; ++i) {
+        const unsigned int hi = BIT_REVERSE[src[n - 1 - i]];
+        const unsigned int lo = i + 1 != n ? BIT_REVERSE[src[n - 2 - i]] : 0;
+        dst[i] = (hi << pad | lo >> (8 - pad)) & 0xff;
+    }
+}
+
+void grey_samples_lut(unsigned char *lut, const unsigned char *bits, const unsigned int depth) {
+    const unsigned int mask = (1u << depth) - 1;
+    for (unsigned int b = 0; b != 256; ++b) {
+        unsigned int byte = 0;
+        for (unsigned int shift = 8; shift != 0; shift -= depth) {
+            byte = byte << 1 | bits[(b >> (shift - depth)) & mask];
+        }
+        lut[b] = byte;
+    }
+}
+
+void grey_pack_samples_line(unsigned char *img_bw, const unsigned char *samples, const size_t size, const size_t bit, const unsigned int w, const unsigned int depth, const unsigned char *lut) {
+    // pixels of one sample byte, every sample byte completes 8 pixels or a whole number of sample bytes do
+    const unsigned int per = 8 / depth;
+    const unsigned int n = (w * depth + 7) >> 3;
+    const size_t first = bit >> 3;
+    const unsigned int shift = bit & 7;
+    unsigned int acc = 0;
+    unsigned int accbits = 0;
+    unsigned int out = 0;
+    for (unsigned int i = 0; i != n; ++i) {
+        unsigned int b = samples[first + i];
+        if (shift != 0) {
+            // row starts in the middle of a byte, take the rest from the next one
+            b = (b << shift | (first + i + 1 < size ? samples[first + i + 1] >> (8 - shift) : 0)) & 0xff;
+        }
+        acc = acc << per | lut[b];
+        accbits += per;
+        if (accbits == 8) {
+            img_bw[out++] = acc;
+            acc = 0;
+            accbits = 0;
+        }
+    }
+    if (accbits != 0) {
+        img_bw[out++] = acc << (8 - accbits);
+    }
+    // pixels of the next row (or padding) in the last byte
+    if (w & 7) {
+        img_bw[out - 1] &= 0xff << (8 - (w & 7));
+    }
+}
+
+void grey_unpack_samples_line(unsigned char *img_grey, const unsigned char *samples, const size_t bit, const unsigned int w, const unsigned int depth, const unsigned char *map) {
+    const unsigned int mask = (1u << depth) - 1;
+    size_t p = bit;
+    for (unsigned int x = 0; x != w; ++x, p += depth) {
+        // samples never cross a byte boundary
+        img_grey[x] = map[(samples[p >> 3] >> (8 - depth - (p & 7))) & mask];
+    }
+}
+
+// 8 × 8 bit matrix in a 64-bit word, row 0 in the top byte (Hacker's Delight, transpose8)
+static void transpose8(unsigned char *dst, const long dst_step, const unsigned char *src, const long src_step) {
+    uint64_t x = 0;
+    for (unsigned int i = 0; i != 8; ++i) {
+        x = x << 8 | src[i * src_step];
+    }
+    uint64_t t = (x ^ (x >> 7)) & 0x00aa00aa00aa00aaull;
+    x = x ^ t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000cccc0000ccccull;
+    x = x ^ t ^ (t << 14);
+    t = (x ^ (x >> 28)) & 0x00000000f0f0f0f0ull;
+    x = x ^ t ^ (t << 28);
+    for (unsigned int j = 0; j != 8; ++j) {
+        dst[j * dst_step] = x >> (56 - (j << 3));
+    }
+}
+
+void grey_transpose_scalar(unsigned char *dst, const long dst_step, const unsigned char *src, const long src_step, const unsigned int n) {
+    for (unsigned int i = 0; i != n; i += 8) {
+        transpose8(&dst[i >> 3], dst_step, &src[i * src_step], src_step);
+    }
+}
+
+// source bytes of one column of a turn, clockwise from the bottom row up, counterclockwise from the top row down
+static void turn_column(unsigned char *dst, const unsigned char *src, const unsigned int w, const unsigned int h, const long bx, const unsigned int k0, const unsigned int kn, const int clockwise) {
+    const long sw = (w + 7) >> 3;
+    const long dw = (h + 7) >> 3;
+    const unsigned int full = h >> 3;
+    // counterclockwise, pixels beyond width of the last source byte would land above the first output row
+    const int partial = !clockwise && (bx << 3) + 8 > w;
+    unsigned char rows[8 * GREY_TURN_TILE];
+
+    unsigned char *out = &dst[(bx << 3) * dw + k0];
+    long out_step = dw;
+    if (partial) {
+        out = rows;
+        out_step = kn;
+    } else if (!clockwise) {
+        out = &dst[(w - 1 - (bx << 3)) * dw + k0];
+        out_step = -dw;
+    }
+
+    // groups of 8 source rows, the last one may be incomplete
+    const unsigned int kf = k0 + kn < full ? k0 + kn : full;
+    const unsigned int nf = kf > k0 ? kf - k0 : 0;
+    if (nf != 0) {
+        const unsigned char *in = clockwise ? &src[(h - 1 - (k0 << 3)) * sw + bx] : &src[(k0 << 3) * sw + bx];
+        grey_transpose(out, out_step, in, clockwise ? -sw : sw, nf << 3);
+    }
+    if (k0 + kn > full) {
+        unsigned char column[8] = { 0 };
+        for (unsigned int i = 0; i != (h & 7); ++i) {
+            column[i] = src[(clockwise ? h - 1 - (full << 3) - i : (full << 3) + i) * sw + bx];
+        }
+        grey_transpose(&out[nf], out_step, column, 1, 8);
+    }
+
+    if (partial) {
+        for (unsigned int j = 0; j != (w & 7); ++j) {
+            memcpy(&dst[(w - 1 - (bx << 3) - j) * dw + k0], &rows[j * kn], kn);
+        }
+    }
+}
+
+void grey_turn_bw(unsigned char *dst, const unsigned char *src, const unsigned int w, const unsigned int h, const int clockwise) {
+    const unsigned int sw = (w + 7) >> 3;
+    const unsigned int dw = (h + 7) >> 3;
+    // tiles of GREY_TURN_TILE × 8 source rows by GREY_TURN_TILE source bytes, they stay in L1 with their output
+    for (unsigned int k0 = 0; k0 < dw; k0 += GREY_TURN_TILE) {
+        const unsigned int kn = dw - k0 < GREY_TURN_TILE ? dw - k0 : GREY_TURN_TILE;
+        for (unsigned int bx0 = 0; bx0 < sw; bx0 += GREY_TURN_TILE) {
+            const unsigned int bn = sw - bx0 < GREY_TURN_TILE ? sw - bx0 : GREY_TURN_TILE;
+            for (unsigned int bx = bx0; bx != bx0 + bn; ++bx) {
+                turn_column(dst, src, w, h, bx, k0, kn, clockwise);
+            }
+        }
+    }
+}
+
+// Q14 sum of luminance → Q7, clamped to <0; 255 << 7>
+static inline short filter_q7(const int sum) {
+    if (sum <= 0) {
+        return 0;
+    }
+    const int v = (sum + (1 << 6)) >> 7;
+    return v > 255 << 7 ? 255 << 7 : v;
+}
+
+// Q21 sum of weighted Q7 values → luminance, clamped to <0; 255>
+static inline unsigned char filter_u8(const int sum) {
+    if (sum <= 0) {
+        return 0;
+    }
+    const int v = (sum + (1 << 20)) >> 21;
+    return v > 255 ? 255 : v;
+}
+
+void grey_filter_line_scalar(short *dst, const unsigned char *src, const unsigned int *start, const short *weights, const unsigned int taps, const unsigned int w) {
+    for (unsigned int x = 0; x != w; ++x) {
+        const unsigned char *s = &src[start[x]];
+        const short *k = &weights[(size_t)x * taps];
+        int sum = 0;
+        for (unsigned int i = 0; i != taps; ++i) {
+            sum += s[i] * k[i];
+        }
+        dst[x] = filter_q7(sum);
+    }
+}
+
+static unsigned char filter_rows_pixel(const short *const *rows, const short *weights, const unsigned int taps, const unsigned int x) {
+    int sum = 0;
+    for (unsigned int k = 0; k != taps; ++k) {
+        sum += rows[k][x] * weights[k];
+    }
+    return filter_u8(sum);
+}
+
+void grey_filter_rows_scalar(unsigned char *dst, const short *const *rows, const short *weights, const unsigned int taps, const unsigned int w) {
+    for (unsigned int x = 0; x != w; ++x) {
+        dst[x] = filter_rows_pixel(rows, weights, taps, x);
+    }
+}
+
+static int supported_always(void) {
+    return 1;
+}
+
+// Notes common to SIMD kernels:
+// - a / 255 is 1 for opaque pixels and 0 otherwise, so RGBA → RGB is a select between C and 255 - A
+// - luma sum is <= 255 × 255, x / 255 == (x × 0x8081) >> 23 for all x < 2^16
+
+#ifdef GREY_X86
+// lookup tables widened to 32 bits for gathers
+static int GAMMA_22_32[256];
+static int LIGHTNESS_32[256];
+
+static int supported_sse2(void) {
+    return __builtin_cpu_supports("sse2");
+}
+
+static int supported_avx2(void) {
+    return __builtin_cpu_supports("avx2");
+}
+
+// SSE2 has no gather, lookups are scalar; selection, luma and division are vectorized
+__attribute__((target("sse2")))
+static void grey_sse2(unsigned char *img_grey, const unsigned char *img_rgba, const unsigned int size) {
+    const __m128i ff = _mm_set1_epi32(0xff);
+    const __m128i coef_rg = _mm_set1_epi32(182 << 16 | 55);
+    const __m128i coef_b = _mm_set1_epi32(18);
+    const __m128i div = _mm_set1_epi16((short)0x8081);
+
+    unsigned int i = 0;
+    for (; i + 8 <= size; i += 8) {
+        unsigned int c[24];
+        for (unsigned int h = 0; h != 2; ++h) {
+            const __m128i px = _mm_loadu_si128((const __m128i *)&img_rgba[(i + 4 * h) << 2]);
+            const __m128i a = _mm_srli_epi32(px, 24);
+            const __m128i opaque = _mm_cmpeq_epi32(a, ff);
+            const __m128i inv = _mm_andnot_si128(opaque, _mm_sub_epi32(ff, a));
+            const __m128i r = _mm_or_si128(_mm_and_si128(opaque, _mm_and_si128(px, ff)), inv);
+            const __m128i g = _mm_or_si128(_mm_and_si128(opaque, _mm_and_si128(_mm_srli_epi32(px, 8), ff)), inv);
+            const __m128i b = _mm_or_si128(_mm_and_si128(opaque, _mm_and_si128(_mm_srli_epi32(px, 16), ff)), inv);
+            _mm_storeu_si128((__m128i *)&c[h * 4], r);
+            _mm_storeu_si128((__m128i *)&c[8 + h * 4], g);
+            _mm_storeu_si128((__m128i *)&c[16 + h * 4], b);
+        }
+
+        // R'G' interleaved as 16 bit pairs for pmaddwd, B' separately
+        __m128i rg[2];
+        __m128i b_[2];
+        for (unsigned int h = 0; h != 2; ++h) {
+            const unsigned int *r = &c[h * 4];
+            const unsigned int *g = &c[8 + h * 4];
+            const unsigned int *b = &c[16 + h * 4];
+            rg[h] = _mm_set_epi32(
+                GAMMA_22[g[3]] << 16 | GAMMA_22[r[3]], GAMMA_22[g[2]] << 16 | GAMMA_22[r[2]],
+                GAMMA_22[g[1]] << 16 | GAMMA_22[r[1]], GAMMA_22[g[0]] << 16 | GAMMA_22[r[0]]);
+            b_[h] = _mm_set_epi32(GAMMA_22[b[3]], GAMMA_22[b[2]], GAMMA_22[b[1]], GAMMA_22[b[0]]);
+        }
+
+        const __m128i y0 = _mm_add_epi32(_mm_madd_epi16(rg[0], coef_rg), _mm_madd_epi16(b_[0], coef_b));
+        const __m128i y1 = _mm_add_epi32(_mm_madd_epi16(rg[1], coef_rg), _mm_madd_epi16(b_[1], coef_b));
+        // sums are <= 65025, pack as unsigned 16 bit via bias (SSE2 lacks packus_epi32)
+        const __m128i bias = _mm_set1_epi32(0x8000);
+        __m128i y = _mm_packs_epi32(_mm_sub_epi32(y0, bias), _mm_sub_epi32(y1, bias));
+        y = _mm_add_epi16(y, _mm_set1_epi16((short)0x8000));
+        y = _mm_srli_epi16(_mm_mulhi_epu16(y, div), 7);
+
+        unsigned short l[8];
+        _mm_storeu_si128((__m128i *)l, y);
+        for (unsigned int j = 0; j != 8; ++j) {
+            img_grey[i + j] = LIGHTNESS[l[j]];
+        }
+    }
+    grey_scalar(&img_grey[i], &img_rgba[i << 2], size - i);
+}
+
+// pixel <= threshold ⟺ min(pixel, threshold) == pixel, SSE2 has unsigned byte min only
+__attribute__((target("sse2")))
+static void grey_pack_sse2(unsigned char *img_bw, const unsigned char *img_grey, const unsigned int size, const unsigned int threshold) {
+    const __m128i t = _mm_set1_epi8((char)threshold);
+    unsigned int i = 0;
+    for (; i + 16 <= size; i += 16) {
+        const __m128i g = _mm_loadu_si128((const __m128i *)&img_grey[i]);
+        const unsigned int m = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(g, t), g));
+        // movemask puts first pixel into the lowest bit, bitmap wants it in MSB
+        img_bw[i >> 3] = BIT_REVERSE[m & 0xff];
+        img_bw[(i >> 3) + 1] = BIT_REVERSE[m >> 8];
+    }
+    grey_pack_scalar(&img_bw[i >> 3], &img_grey[i], size - i, threshold);
+}
+
+__attribute__((target("sse2")))
+static void grey_pack_map_sse2(unsigned char *img_bw, const unsigned char *img_grey, const unsigned char *thresholds, const unsigned int size) {
+    unsigned int i = 0;
+    for (; i + 16 <= size; i += 16) {
+        const __m128i g = _mm_loadu_si128((const __m128i *)&img_grey[i]);
+        const __m128i t = _mm_loadu_si128((const __m128i *)&thresholds[i]);
+        const unsigned int m = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(g, t), g));
+        img_bw[i >> 3] = BIT_REVERSE[m & 0xff];
+        img_bw[(i >> 3) + 1] = BIT_REVERSE[m >> 8];
+    }
+    grey_pack_map_scalar(&img_bw[i >> 3], &img_grey[i], &thresholds[i], size - i);
+}
+
+// 32 pixels per iteration, bytes of mask are reversed by a table as in SSE2
+__attribute__((target("avx2")))
+static void grey_pack_map_avx2(unsigned char *img_bw, const unsigned char *img_grey, const unsigned char *thresholds, const unsigned int size) {
+    unsigned int i = 0;
+    for (; i + 32 <= size; i += 32) {
+        const __m256i g = _mm256_loadu_si256((const __m256i *)&img_grey[i]);
+        const __m256i t = _mm256_loadu_si256((const __m256i *)&thresholds[i]);
+        const unsigned int m = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_min_epu8(g, t), g));
+        img_bw[i >> 3] = BIT_REVERSE[m & 0xff];
+        img_bw[(i >> 3) + 1] = BIT_REVERSE[m >> 8 & 0xff];
+        img_bw[(i >> 3) + 2] = BIT_REVERSE[m >> 16 & 0xff];
+        img_bw[(i >> 3) + 3] = BIT_REVERSE[m >> 24];
+    }
+    grey_pack_map_sse2(&img_bw[i >> 3], &img_grey[i], &thresholds[i], size - i);
+}
+
+// 8 taps of a pixel per pmaddwd, sums of 4 lanes are added at the end
+__attribute__((target("sse2")))
+static void grey_filter_line_sse2(short *dst, const unsigned char *src, const unsigned int *start, const short *weights, const unsigned int taps, const unsigned int w) {
+    const __m128i zero = _mm_setzero_si128();
+    for (unsigned int x = 0; x != w; ++x) {
+        const unsigned char *s = &src[start[x]];
+        const short *k = &weights[(size_t)x * taps];
+        __m128i sum = zero;
+        for (unsigned int i = 0; i != taps; i += 8) {
+            const __m128i v = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)&s[i]), zero);
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(v, _mm_loadu_si128((const __m128i *)&k[i])));
+        }
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4e));
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xb1));
+        dst[x] = filter_q7(_mm_cvtsi128_si32(sum));
+    }
+}
+
+// 8 pixels per iteration, pairs of rows are interleaved for pmaddwd with a pair of weights
+__attribute__((target("sse2")))
+static void grey_filter_rows_sse2(unsigned char *dst, const short *const *rows, const short *weights, const unsigned int taps, const unsigned int w) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi32(1 << 20);
+    unsigned int x = 0;
+    for (; x + 8 <= w; x += 8) {
+        __m128i lo = zero;
+        __m128i hi = zero;
+        unsigned int k = 0;
+        for (; k + 2 <= taps; k += 2) {
+            const __m128i a = _mm_loadu_si128((const __m128i *)&rows[k][x]);
+            const __m128i b = _mm_loadu_si128((const __m128i *)&rows[k + 1][x]);
+            const __m128i pair = _mm_set1_epi32((int)((unsigned int)(unsigned short)weights[k + 1] << 16 | (unsigned short)weights[k]));
+            lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), pair));
+            hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), pair));
+        }
+        if (k != taps) {
+            const __m128i a = _mm_loadu_si128((const __m128i *)&rows[k][x]);
+            const __m128i single = _mm_set1_epi32((unsigned short)weights[k]);
+            lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, zero), single));
+            hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, zero), single));
+        }
+        lo = _mm_srai_epi32(_mm_add_epi32(lo, round), 21);
+        hi = _mm_srai_epi32(_mm_add_epi32(hi, round), 21);
+        // saturation clamps to <0; 255>
+        const __m128i v = _mm_packs_epi32(lo, hi);
+        _mm_storel_epi64((__m128i *)&dst[x], _mm_packus_epi16(v, v));
+    }
+    for (; x != w; ++x) {
+        dst[x] = filter_rows_pixel(rows, weights, taps, x);
+    }
+}
+
+// 16 pixels per iteration, as in SSE2
+__attribute__((target("avx2")))
+static void grey_filter_rows_avx2(unsigned char *dst, const short *const *rows, const short *weights, const unsigned int taps, const unsigned int w) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i round = _mm256_set1_epi32(1 << 20);
+    unsigned int x = 0;
+    for (; x + 16 <= w; x += 16) {
+        __m256i lo = zero;
+        __m256i hi = zero;
+        unsigned int k = 0;
+        for (; k + 2 <= taps; k += 2) {
+            const __m256i a = _mm256_loadu_si256((const __m256i *)&rows[k][x]);
+            const __m256i b = _mm256_loadu_si256((const __m256i *)&rows[k + 1][x]);
+            const __m256i pair = _mm256_set1_epi32((int)((unsigned int)(unsigned short)weights[k + 1] << 16 | (unsigned short)weights[k]));
+            lo = _mm256_add_epi32(lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), pair));
+            hi = _mm256_add_epi32(hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), pair));
+        }
+        if (k != taps) {
+            const __m256i a = _mm256_loadu_si256((const __m256i *)&rows[k][x]);
+            const __m256i single = _mm256_set1_epi32((unsigned short)weights[k]);
+            lo = _mm256_add_epi32(lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, zero), single));
+            hi = _mm256_add_epi32(hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, zero), single));
+        }
+        lo = _mm256_srai_epi32(_mm256_add_epi32(lo, round), 21);
+        hi = _mm256_srai_epi32(_mm256_add_epi32(hi, round), 21);
+        // unpack and pack work within 128-bit lanes, so pixels come out in their order
+        const __m256i v = _mm256_packs_epi32(lo, hi);
+        const __m256i u = _mm256_packus_epi16(v, v);
+        _mm_storel_epi64((__m128i *)&dst[x], _mm256_castsi256_si128(u));
+        _mm_storel_epi64((__m128i *)&dst[x + 8], _mm256_extracti128_si256(u, 1));
+    }
+    for (; x != w; ++x) {
+        dst[x] = filter_rows_pixel(rows, weights, taps, x);
+    }
+}
+
+// 16 source bytes per iteration, in reversed order, so movemask of their top bits is an output row
+// of 2 bytes; bytes are shifted left for the next row
+__attribute__((target("sse2")))
+static void grey_transpose_sse2(unsigned char *dst, const long dst_step, const unsigned char *src, const long src_step, const unsigned int n) {
+    unsigned int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const unsigned char *s = &src[i * src_step];
+        __m128i v = _mm_set_epi8(
+            s[0], s[src_step], s[2 * src_step], s[3 * src_step],
+            s[4 * src_step], s[5 * src_step], s[6 * src_step], s[7 * src_step],
+            s[8 * src_step], s[9 * src_step], s[10 * src_step], s[11 * src_step],
+            s[12 * src_step], s[13 * src_step], s[14 * src_step], s[15 * src_step]);
+        for (unsigned int j = 0; j != 8; ++j) {
+            const unsigned int m = _mm_movemask_epi8(v);
+            dst[j * dst_step + (i >> 3)] = m >> 8;
+            dst[j * dst_step + (i >> 3) + 1] = m & 0xff;
+            v = _mm_add_epi8(v, v);
+        }
+    }
+    grey_transpose_scalar(&dst[i >> 3], dst_step, &src[i * src_step], src_step, n - i);
+}
+
+__attribute__((target("avx2")))
+static void grey_transpose_avx2(unsigned char *dst, const long dst_step, const unsigned char *src, const long src_step, const unsigned int n) {
+    unsigned int i = 0;
+    for (; i + 32 <= n; i += 32) {
+        const unsigned char *s = &src[i * src_step];
+        __m256i v = _mm256_set_epi8(
+            s[0], s[src_step], s[2 * src_step], s[3 * src_step],
+            s[4 * src_step], s[5 * src_step], s[6 * src_step], s[7 * src_step],
+            s[8 * src_step], s[9 * src_step], s[10 * src_step], s[11 * src_step],
+            s[12 * src_step], s[13 * src_step], s[14 * src_step], s[15 * src_step],
+            s[16 * src_step], s[17 * src_step], s[18 * src_step], s[19 * src_step],
+            s[20 * src_step], s[21 * src_step], s[22 * src_step], s[23 * src_step],
+            s[24 * src_step], s[25 * src_step], s[26 * src_step], s[27 * src_step],
+            s[28 * src_step], s[29 * src_step], s[30 * src_step], s[31 * src_step]);
+        for (unsigned int j = 0; j != 8; ++j) {
+            const unsigned int m = _mm256_movemask_epi8(v);
+            unsigned char *d = &dst[j * dst_step + (i >> 3)];
+            d[0] = m >> 24;
+            d[1] = m >> 16 & 0xff;
+            d[2] = m >> 8 & 0xff;
+            d[3] = m & 0xff;
+            v = _mm256_add_epi8(v, v);
+        }
+    }
+    grey_transpose_sse2(&dst[i >> 3], dst_step, &src[i * src_step], src_step, n - i);
+}
+
+__attribute__((target("avx2")))
+static void grey_avx2(unsigned char *img_grey, const unsigned char *img_rgba, const unsigned int size) {
+    const __m256i ff = _mm256_set1_epi32(0xff);
+    const __m256i coef_r = _mm256_set1_epi32(55);
+    const __m256i coef_g = _mm256_set1_epi32(182);
+    const __m256i coef_b = _mm256_set1_epi32(18);
+    const __m256i div = _mm256_set1_epi32(0x8081);
+
+    unsigned int i = 0;
+    for (; i + 8 <= size; i += 8) {
+        const __m256i px = _mm256_loadu_si256((const __m256i *)&img_rgba[i << 2]);
+        const __m256i a = _mm256_srli_epi32(px, 24);
+        const __m256i opaque = _mm256_cmpeq_epi32(a, ff);
+        const __m256i inv = _mm256_sub_epi32(ff, a);
+        const __m256i r = _mm256_blendv_epi8(inv, _mm256_and_si256(px, ff), opaque);
+        const __m256i g = _mm256_blendv_epi8(inv, _mm256_and_si256(_mm256_srli_epi32(px, 8), ff), opaque);
+        const __m256i b = _mm256_blendv_epi8(inv, _mm256_and_si256(_mm256_srli_epi32(px, 16), ff), opaque);
+
+        const __m256i r_ = _mm256_i32gather_epi32(GAMMA_22_32, r, 4);
+        const __m256i g_ = _mm256_i32gather_epi32(GAMMA_22_32, g, 4);
+        const __m256i b_ = _mm256_i32gather_epi32(GAMMA_22_32, b, 4);
+
+        __m256i y = _mm256_add_epi32(
+            _mm256_add_epi32(_mm256_mullo_epi32(r_, coef_r), _mm256_mullo_epi32(g_, coef_g)),
+            _mm256_mullo_epi32(b_, coef_b));
+        y = _mm256_srli_epi32(_mm256_mullo_epi32(y, div), 23);
+
+        const __m256i l = _mm256_i32gather_epi32(LIGHTNESS_32, y, 4);
+        // 8 × 32 bit → 8 bytes, packs work within 128 bit lanes
+        const __m256i l16 = _mm256_packus_epi32(l, l);
+        const __m256i l8 = _mm256_packus_epi16(l16, l16);
+        const int lo = _mm256_cvtsi256_si32(l8);
+        const int hi = _mm256_extract_epi32(l8, 4);
+        memcpy(&img_grey[i], &lo, 4);
+        memcpy(&img_grey[i + 4], &hi, 4);
+    }
+    grey_scalar(&img_grey[i], &img_rgba[i << 2], size - i);
+}
+#endif
+
+#ifdef GREY_NEON
+// 256 entries lookup as four chained 64 bytes table lookups
+static uint8x16_t lookup(const uint8x16x4_t *t, const uint8x16_t idx) {
+    const uint8x16_t step = vdupq_n_u8(64);
+    uint8x16_t i = idx;
+    uint8x16_t r = vqtbl4q_u8(t[0], i);
+    i = vsubq_u8(i, step);
+    r = vqtbx4q_u8(r, t[1], i);
+    i = vsubq_u8(i, step);
+    r = vqtbx4q_u8(r, t[2], i);
+    i = vsubq_u8(i, step);
+    return vqtbx4q_u8(r, t[3], i);
+}
+
+static uint8x16_t luma(const uint8x8_t r, const uint8x8_t g, const uint8x8_t b, const uint8x8_t r2, const uint8x8_t g2, const uint8x8_t b2) {
+    uint16x8_t y0 = vmull_u8(r, vdup_n_u8(55));
+    y0 = vmlal_u8(y0, g, vdup_n_u8(182));
+    y0 = vmlal_u8(y0, b, vdup_n_u8(18));
+    uint16x8_t y1 = vmull_u8(r2, vdup_n_u8(55));
+    y1 = vmlal_u8(y1, g2, vdup_n_u8(182));
+    y1 = vmlal_u8(y1, b2, vdup_n_u8(18));
+    // x / 255 == (x + 1 + (x >> 8)) >> 8 for x <= 65025
+    const uint16x8_t one = vdupq_n_u16(1);
+    y0 = vaddq_u16(vaddq_u16(y0, one), vshrq_n_u16(y0, 8));
+    y1 = vaddq_u16(vaddq_u16(y1, one), vshrq_n_u16(y1, 8));
+    return vcombine_u8(vshrn_n_u16(y0, 8), vshrn_n_u16(y1, 8));
+}
+
+static void grey_pack_neon(unsigned char *img_bw, const unsigned char *img_grey, const unsigned int size, const unsigned int threshold) {
+    static const unsigned char WEIGHTS[16] = {
+        0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01, 0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01
+    };
+    const uint8x16_t weights = vld1q_u8(WEIGHTS);
+    const uint8x16_t t = vdupq_n_u8(threshold);
+    unsigned int i = 0;
+    for (; i + 16 <= size; i += 16) {
+        const uint8x16_t m = vandq_u8(vcleq_u8(vld1q_u8(&img_grey[i]), t), weights);
+        img_bw[i >> 3] = vaddv_u8(vget_low_u8(m));
+        img_bw[(i >> 3) + 1] = vaddv_u8(vget_high_u8(m));
+    }
+    grey_pack_scalar(&img_bw[i >> 3], &img_grey[i], size - i, threshold);
+}
+
+static void grey_pack_map_neon(unsigned char *img_bw, const unsigned char *img_grey, const unsigned char *thresholds, const unsigned int size) {
+    static const unsigned char WEIGHTS[16] = {
+        0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01, 0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01
+    };
+    const uint8x16_t weights = vld1q_u8(WEIGHTS);
+    unsigned int i = 0;
+    for (; i + 16 <= size; i += 16) {
+        const uint8x16_t m = vandq_u8(vcleq_u8(vld1q_u8(&img_grey[i]), vld1q_u8(&thresholds[i])), weights);
+        img_bw[i >> 3] = vaddv_u8(vget_low_u8(m));
+        img_bw[(i >> 3) + 1] = vaddv_u8(vget_high_u8(m));
+    }
+    grey_pack_map_scalar(&img_bw[i >> 3], &img_grey[i], &thresholds[i], size - i);
+}
+
+// 16 source bytes per iteration, one bit of each is tested and weighted into 2 bytes of an output row
+static void grey_transpose_neon(unsigned char *dst, const long dst_step, const unsigned char *src, const long src_step, const unsigned int n) {
+    static const unsigned char WEIGHTS[16] = {
+        0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01, 0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01
+    };
+    const uint8x16_t weights = vld1q_u8(WEIGHTS);
+    unsigned int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        unsigned char column[16];
+        for (unsigned int k = 0; k != 16; ++k) {
+            column[k] = src[(i + k) * src_step];
+        }
+        const uint8x16_t v = vld1q_u8(column);
+        for (unsigned int j = 0; j != 8; ++j) {
+            const uint8x16_t m = vandq_u8(vtstq_u8(v, vdupq_n_u8(0x80 >> j)), weights);
+            dst[j * dst_step + (i >> 3)] = vaddv_u8(vget_low_u8(m));
+            dst[j * dst_step + (i >> 3) + 1] = vaddv_u8(vget_high_u8(m));
+        }
+    }
+    grey_transpose_scalar(&dst[i >> 3], dst_step, &src[i * src_step], src_step, n - i);
+}
+
+// 8 pixels per iteration, multiply-accumulate of each row by its weight
+static void grey_filter_rows_neon(unsigned char *dst, const short *const *rows, const short *weights, const unsigned int taps, const unsigned int w) {
+    unsigned int x = 0;
+    for (; x + 8 <= w; x += 8) {
+        int32x4_t lo = vdupq_n_s32(0);
+        int32x4_t hi = vdupq_n_s32(0);
+        for (unsigned int k = 0; k != taps; ++k) {
+            const int16x8_t v = vld1q_s16(&rows[k][x]);
+            lo = vmlal_n_s16(lo, vget_low_s16(v), weights[k]);
+            hi = vmlal_n_s16(hi, vget_high_s16(v), weights[k]);
+        }
+        // rounding shift, then saturation clamps to <0; 255>
+        const int16x8_t v = vcombine_s16(vqmovn_s32(vrshrq_n_s32(lo, 21)), vqmovn_s32(vrshrq_n_s32(hi, 21)));
+        vst1_u8(&dst[x], vqmovun_s16(v));
+    }
+    for (; x != w; ++x) {
+        dst[x] = filter_rows_pixel(rows, weights, taps, x);
+    }
+}
+
+static void grey_neon(unsigned char *img_grey, const unsigned char *img_rgba, const unsigned int size) {
+    uint8x16x4_t gamma[4];
+    uint8x16x4_t lightness[4];
+    for (unsigned int t = 0; t != 4; ++t) {
+        for (unsigned int j = 0; j != 4; ++j) {
+            gamma[t].val[j] = vld1q_u8(&GAMMA_22[t * 64 + j * 16]);
+            lightness[t].val[j] = vld1q_u8(&LIGHTNESS[t * 64 + j * 16]);
+        }
+    }
+
+    const uint8x16_t ff = vdupq_n_u8(0xff);
+    unsigned int i = 0;
+    for (; i + 16 <= size; i += 16) {
+        const uint8x16x4_t px = vld4q_u8(&img_rgba[i << 2]);
+        const uint8x16_t opaque = vceqq_u8(px.val[3], ff);
+        // 255 - A
+        const uint8x16_t inv = vmvnq_u8(px.val[3]);
+        const uint8x16_t r_ = lookup(gamma, vbslq_u8(opaque, px.val[0], inv));
+        const uint8x16_t g_ = lookup(gamma, vbslq_u8(opaque, px.val[1], inv));
+        const uint8x16_t b_ = lookup(gamma, vbslq_u8(opaque, px.val[2], inv));
+        const uint8x16_t y = luma(vget_low_u8(r_), vget_low_u8(g_), vget_low_u8(b_),
+            vget_high_u8(r_), vget_high_u8(g_), vget_high_u8(b_));
+        vst1q_u8(&img_grey[i], lookup(lightness, y));
+    }
+    grey_scalar(&img_grey[i], &img_rgba[i << 2], size - i);
+}
+#endif
+
+// ordered by preference, the last supported one wins
+const struct grey_kernel_info GREY_KERNELS[] = {
+    { "scalar", grey_scalar, grey_pack_scalar, grey_pack_map_scalar, grey_transpose_scalar,
+        grey_filter_line_scalar, grey_filter_rows_scalar, supported_always },
+#ifdef GREY_X86
+    { "sse2", grey_sse2, grey_pack_sse2, grey_pack_map_sse2, grey_transpose_sse2,
+        grey_filter_line_sse2, grey_filter_rows_sse2, supported_sse2 },
+    { "avx2", grey_avx2, grey_pack_sse2, grey_pack_map_avx2, grey_transpose_avx2,
+        grey_filter_line_sse2, grey_filter_rows_avx2, supported_avx2 },
+#endif
+#ifdef GREY_NEON
+    { "neon", grey_neon, grey_pack_neon, grey_pack_map_neon, grey_transpose_neon,
+        grey_filter_line_scalar, grey_filter_rows_neon, supported_always },
+#endif
+    { NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL }
+};
+
+const char* grey_init(void) {
+    for (unsigned int i = 0; i != 256; ++i) {
+        unsigned int r = 0;
+        for (unsigned int b = 0; b != 8; ++b) {
+            r |= ((i >> b) & 1) << (7 - b);
+        }
+        BIT_REVERSE[i] = r;
+    }
+
+    for (unsigned int i = 0; i != 256; ++i) {
+        const unsigned char rgba[4] = { i, i, i, 0xff };
+        grey_scalar(&LEVEL_LIGHTNESS[i], rgba, 1);
+    }
+
+#ifdef GREY_X86
+    for (unsigned int i = 0; i != 256; ++i) {
+        GAMMA_22_32[i] = GAMMA_22[i];
+        LIGHTNESS_32[i] = LIGHTNESS[i];
+    }
+#endif
+
+    const char *name = GREY_KERNELS[0].name;
+    grey_convert = GREY_KERNELS[0].convert;
+    grey_pack = GREY_KERNELS[0].pack;
+    grey_pack_map = GREY_KERNELS[0].pack_map;
+    grey_transpose = GREY_KERNELS[0].transpose;
+    grey_filter_line = GREY_KERNELS[0].filter_line;
+    grey_filter_rows = GREY_KERNELS[0].filter_rows;
+    for (unsigned int k = 1; GREY_KERNELS[k].name; ++k) {
+        if (GREY_KERNELS[k].supported()) {
+            name = GREY_KERNELS[k].name;
+            grey_convert = GREY_KERNELS[k].convert;
+            grey_pack = GREY_KERNELS[k].pack;
+            grey_pack_map = GREY_KERNELS[k].pack_map;
+            grey_transpose = GREY_KERNELS[k].transpose;
+            grey_filter_line = GREY_KERNELS[k].filter_line;
+            grey_filter_rows = GREY_KERNELS[k].filter_rows;
+        }
+    }
+    return name;
+}
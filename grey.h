@@ -0,0 +1,114 @@
+/*!
+(c) 2012 - 2015 Petr Kutalek: png2pos
+
+Licensed under the MIT License, see png2pos.c
+*/
+
+#ifndef GREY_H
+#define GREY_H
+
+#include <stddef.h>
+
+// RGBA → lightness L* conversion and B/W packing kernels
+// all kernels produce bit-exact results of grey_scalar, which is the reference implementation
+
+extern const unsigned char GAMMA_22[256];
+extern const unsigned char LIGHTNESS[256];
+
+typedef void (*grey_kernel)(unsigned char *img_grey, const unsigned char *img_rgba, unsigned int size);
+
+// packs size grey pixels into bitmap (MSB first), pixel is black if it is <= threshold,
+// unused bits of the last byte are cleared
+typedef void (*grey_pack_kernel)(unsigned char *img_bw, const unsigned char *img_grey, unsigned int size, unsigned int threshold);
+
+// packs size grey pixels into bitmap, pixel i is black if it is <= thresholds[i] (ordered dithering)
+typedef void (*grey_pack_map_kernel)(unsigned char *img_bw, const unsigned char *img_grey, const unsigned char *thresholds, unsigned int size);
+
+// transposes n bytes (n is a multiple of 8) of one column of bitmap, src_step apart, into 8 rows of n / 8 bytes,
+// dst_step apart: bit j of source byte i becomes bit i of output row j (bits MSB first)
+typedef void (*grey_transpose_kernel)(unsigned char *dst, long dst_step, const unsigned char *src, long src_step, unsigned int n);
+
+// resampling of --fit (see scale.h), in linear luminance:
+// filters a line, dst pixel x is the sum of taps src pixels from start[x] weighted by weights[x * taps ...] (Q14),
+// stored in Q7 and clamped to <0; 255 << 7>; taps is a multiple of 8, src must be readable up to start[x] + taps
+typedef void (*grey_filter_line_kernel)(short *dst, const unsigned char *src, const unsigned int *start, const short *weights, unsigned int taps, unsigned int w);
+
+// sums w pixels of taps filtered lines (Q7) weighted by weights (Q14) into luminance, rounded and clamped to <0; 255>
+typedef void (*grey_filter_rows_kernel)(unsigned char *dst, const short *const *rows, const short *weights, unsigned int taps, unsigned int w);
+
+struct grey_kernel_info {
+    const char *name;
+    grey_kernel convert;
+    grey_pack_kernel pack;
+    grey_pack_map_kernel pack_map;
+    grey_transpose_kernel transpose;
+    grey_filter_line_kernel filter_line;
+    grey_filter_rows_kernel filter_rows;
+    // non-zero if CPU supports the kernel
+    int (*supported)(void);
+};
+
+// available kernels, scalar reference is the first one, terminated by { NULL }
+extern const struct grey_kernel_info GREY_KERNELS[];
+
+// kernels selected by grey_init()
+extern grey_kernel grey_convert;
+extern grey_pack_kernel grey_pack;
+extern grey_pack_map_kernel grey_pack_map;
+extern grey_transpose_kernel grey_transpose;
+extern grey_filter_line_kernel grey_filter_line;
+extern grey_filter_rows_kernel grey_filter_rows;
+
+// selects the fastest kernel supported by CPU, returns its name
+const char* grey_init(void);
+
+void grey_scalar(unsigned char *img_grey, const unsigned char *img_rgba, unsigned int size);
+void grey_pack_scalar(unsigned char *img_bw, const unsigned char *img_grey, unsigned int size, unsigned int threshold);
+void grey_pack_map_scalar(unsigned char *img_bw, const unsigned char *img_grey, const unsigned char *thresholds, unsigned int size);
+void grey_transpose_scalar(unsigned char *dst, long dst_step, const unsigned char *src, long src_step, unsigned int n);
+void grey_filter_line_scalar(short *dst, const unsigned char *src, const unsigned int *start, const short *weights, unsigned int taps, unsigned int w);
+void grey_filter_rows_scalar(unsigned char *dst, const short *const *rows, const short *weights, unsigned int taps, unsigned int w);
+
+// RGBA → linear luminance Y (0..255, gamma expanded), the value grey_scalar looks lightness L* up by
+void grey_linear(unsigned char *img_y, const unsigned char *img_rgba, unsigned int size);
+
+// packs one line of w grey pixels, reverse mirrors the line (for upside down rotation)
+void grey_pack_line(unsigned char *img_bw, const unsigned char *img_grey, unsigned int w, unsigned int threshold, int reverse);
+
+// packs one line of w grey pixels against a line of w thresholds, reverse mirrors the grey line only
+void grey_pack_map_line(unsigned char *img_bw, const unsigned char *img_grey, const unsigned char *thresholds, unsigned int w, int reverse);
+
+// grey levels (of greyscale PNG or PGM) → lightness L*, the same values grey_scalar gives for opaque grey pixels;
+// img_grey may be levels
+void grey_levels(unsigned char *img_grey, const unsigned char *levels, unsigned int size);
+
+// unpacks one line of w pixels of bitmap into lightness of black and white
+void grey_unpack_line(unsigned char *img_grey, const unsigned char *img_bw, unsigned int w);
+
+// mirrors one line of w pixels of bitmap (for upside down rotation), unused bits of the last byte stay cleared;
+// dst and src must not overlap
+void grey_mirror_bw_line(unsigned char *dst, const unsigned char *src, unsigned int w);
+
+// PNG grey and palette images decoded at their native depth (1, 2, 4 or 8 bits, rows are not padded),
+// one sample is a grey level or a palette index:
+// builds a table of 8 / depth B/W pixels of each sample byte (MSB first) from B/W pixel of each sample value
+void grey_samples_lut(unsigned char *lut, const unsigned char *bits, unsigned int depth);
+
+// packs one line of w samples starting at given bit of samples (size bytes long) into bitmap by the table,
+// unused bits of the last byte are cleared
+void grey_pack_samples_line(unsigned char *img_bw, const unsigned char *samples, size_t size, size_t bit, unsigned int w, unsigned int depth, const unsigned char *lut);
+
+// converts one line of w samples starting at given bit into greyscale by lightness of each sample value
+void grey_unpack_samples_line(unsigned char *img_grey, const unsigned char *samples, size_t bit, unsigned int w, unsigned int depth, const unsigned char *map);
+
+// quarter turn of bitmap of w × h pixels (rows padded to whole bytes), clockwise or counterclockwise;
+// dst gets w rows of (h + 7) / 8 bytes, but it must have room for w rounded up to a multiple of 8 rows;
+// done by 8 × 8 bit transposes in tiles of GREY_TURN_TILE × GREY_TURN_TILE bytes
+#define GREY_TURN_TILE 32u
+void grey_turn_bw(unsigned char *dst, const unsigned char *src, unsigned int w, unsigned int h, int clockwise);
+
+// fused RGBA → B/W conversion of one line for non-photo mode, no greyscale copy of image is made;
+// reverse mirrors the line, histogram of lightness is collected for -p hints
+void grey_bw_line(unsigned char *img_bw, const unsigned char *img_rgba, unsigned int w, unsigned int threshold, int reverse, unsigned int *histogram);
+
+#endif
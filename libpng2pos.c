@@ -0,0 +1,587 @@
+/*!
+(c) 2012 - 2015 Petr Kutalek: png2pos
+
+Licensed under the MIT License, see png2pos.c
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "scale.h"
+#include "grey.h"
+#include "dither.h"
+#include "profile.h"
+#include "pool.h"
+#include "cache.h"
+#include "graphics.h"
+#include "report.h"
+#include "convert.h"
+#include "png2pos.h"
+
+struct png2pos {
+    struct config cfg;
+    struct output out;
+    // images of the job being composed
+    struct compose compose;
+    // caller's callback, or caller's buffer (png2pos_open_buffer)
+    png2pos_write write;
+    void *user;
+    unsigned char *buffer;
+    size_t capacity;
+    // bytes written
+    size_t length;
+    // diagnostics of conversion go to caller's callback, the last one is kept; workers of the context
+    // report one at a time
+    struct report report;
+    png2pos_diagnostic diagnostic;
+    void *diagnostic_user;
+    pthread_mutex_t lock;
+    char message[REPORT_MAX_LENGTH];
+    // stats of the job: buffers of all its files, clock of its start and of its first write (0.0 = none yet)
+    struct job_memory job_memory;
+    double start;
+    double written;
+    // png2pos_finish() ended the job, the next image starts a new one
+    unsigned int finished;
+};
+
+// engines and filters indexed by PNG2POS_* constants
+static const unsigned int DITHERS[] = { DITHER_ATKINSON, DITHER_BAYER4, DITHER_BAYER8, DITHER_BLUE_NOISE };
+static const unsigned int FITS[] = { SCALE_NONE, SCALE_AREA, SCALE_LANCZOS };
+
+static const char *STAGE_NAMES[STAGES] = { "decode", "grey", "equalize", "dither", "pack", "emit" };
+
+// conversion kernels are chosen once per process, by the first context
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+static const char *kernel = NULL;
+
+static void kernels_init(void) {
+    kernel = grey_init();
+}
+
+static int context_write(void *user, const unsigned char *data, const size_t length) {
+    struct png2pos *ctx = (struct png2pos *)user;
+    if (ctx->write) {
+        if (ctx->write(ctx->user, data, length) != 0) {
+            return 1;
+        }
+    } else {
+        if (length > ctx->capacity - ctx->length) {
+            return 1;
+        }
+        memcpy(&ctx->buffer[ctx->length], data, length);
+    }
+    ctx->length += length;
+    return 0;
+}
+
+static void context_message(void *user, const char *message) {
+    struct png2pos *ctx = (struct png2pos *)user;
+    pthread_mutex_lock(&ctx->lock);
+    strcpy(ctx->message, message);
+    if (ctx->diagnostic) {
+        ctx->diagnostic(ctx->diagnostic_user, message);
+    }
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+// a new job starts: its stats are cleared and the printer is initialized, with flush 'B' right away
+static void job_begin(struct png2pos *ctx, const unsigned int init) {
+    struct output *out = &ctx->out;
+    ctx->finished = 0;
+    ctx->start = clock_seconds();
+    ctx->written = 0.0;
+    ctx->job_memory.memory_peak = ctx->job_memory.memory;
+    out->bytes = 0;
+    out->bands = 0;
+    out->flushes = 0;
+    out->writes = 0;
+    out->saved = 0;
+    if (init) {
+        print(out, ESC_INIT, ESC_INIT_LENGTH);
+        if (out->policy == 'B') {
+            output_flush(out);
+        }
+    }
+}
+
+// the first image after png2pos_finish() starts a new job
+static void job_next(struct png2pos *ctx) {
+    if (ctx->finished) {
+        job_begin(ctx, 1);
+    }
+}
+
+// time to first byte of job is taken from the first file written while it was printed
+static void job_written(struct png2pos *ctx, const struct stats *stats) {
+    if (stats->written > 0.0 && (ctx->written <= 0.0 || stats->written < ctx->written)) {
+        ctx->written = stats->written;
+    }
+}
+
+static struct png2pos* context_open(const struct png2pos_options *options) {
+    const struct report diagnostics = { .message = options->diagnostic, .user = options->diagnostic_user };
+    if (options->align == '\0' || !strchr("LCR?", options->align) || options->rotate % 90 != 0 || options->rotate > 270
+        || options->threshold > 255 || options->dither >= sizeof(DITHERS) / sizeof(DITHERS[0]) || options->fit >= sizeof(FITS) / sizeof(FITS[0])
+        || options->flush == '\0' || !strchr("BFJ", options->flush) || (options->raw_width == 0 && options->raw_height != 0)) {
+        report(&diagnostics, "Invalid options");
+        return NULL;
+    }
+    // unknown printer, or a command it does not support
+    const struct profile *profile = options->printer ? profile_find(options->printer) : &PROFILES[0];
+    if (!profile) {
+        report(&diagnostics, "Unknown printer profile '%s'", options->printer);
+        return NULL;
+    }
+    if (options->cut != 0 && !(profile->commands & PROFILE_CUT)) {
+        report(&diagnostics, "Printer '%s' can not cut the paper", profile->name);
+        return NULL;
+    }
+    if (options->elide != 0 && !(profile->commands & PROFILE_FEED)) {
+        report(&diagnostics, "Printer '%s' can not feed paper, blank rows can not be elided", profile->name);
+        return NULL;
+    }
+    if (options->graphics != 0 && !(profile->commands & (graphics_memory() == 'D' ? PROFILE_DOWNLOAD : PROFILE_NV))) {
+        report(&diagnostics, "Printer '%s' has no %s graphics memory", profile->name, graphics_memory() == 'D' ? "download" : "NV");
+        return NULL;
+    }
+    pthread_once(&kernels_once, kernels_init);
+
+    struct png2pos *ctx = (struct png2pos *)calloc(1, sizeof(struct png2pos));
+    if (!ctx) {
+        report(&diagnostics, "Could not allocate enough memory");
+        return NULL;
+    }
+    // buffers kept by the pool are released when the last context is closed
+    pool_open();
+    pthread_mutex_init(&ctx->lock, NULL);
+    pthread_mutex_init(&ctx->job_memory.lock, NULL);
+    ctx->report.message = context_message;
+    ctx->report.user = ctx;
+    ctx->diagnostic = options->diagnostic;
+    ctx->diagnostic_user = options->diagnostic_user;
+
+    struct config *cfg = &ctx->cfg;
+    cfg->cut = options->cut != 0;
+    cfg->photo = options->photo != 0;
+    cfg->align = options->align;
+    cfg->rotate = options->rotate == 180;
+    cfg->turn = options->rotate == 180 ? 0 : options->rotate;
+    cfg->fit = FITS[options->fit];
+    cfg->threshold = options->threshold;
+    cfg->stream = options->stream != 0;
+    cfg->jobs = options->jobs != 0 ? options->jobs : 1;
+    cfg->dither_jobs = options->threads != 0 ? options->threads : 1;
+    cfg->dither = DITHERS[options->dither];
+    cfg->flush = options->flush;
+    cfg->cache = options->cache != 0;
+    cfg->graphics = options->graphics != 0;
+    cfg->memory = graphics_memory();
+    cfg->elide = options->elide != 0;
+    cfg->compose = options->compose != 0;
+    cfg->profile = profile;
+    cfg->stats = options->stats != 0;
+    cfg->job_memory = cfg->stats ? &ctx->job_memory : NULL;
+    cfg->raw_width = options->raw_width;
+    cfg->raw_height = options->raw_height;
+    cfg->report = &ctx->report;
+    // align rotated image to the right border
+    if (cfg->rotate == 1 && cfg->align == '?') {
+        cfg->align = 'R';
+    }
+
+    struct output *out = &ctx->out;
+    out->fd = -1;
+    out->write = context_write;
+    out->user = ctx;
+    out->policy = cfg->flush;
+    out->framed = options->frame != 0;
+    out->written = -1.0;
+    out->profile = profile;
+    out->elide = cfg->elide;
+    out->margin = ~0u;
+    out->report = cfg->report;
+    return ctx;
+}
+
+struct png2pos_options png2pos_defaults(void) {
+    struct png2pos_options options = {
+        .cut = 0,
+        .align = '?',
+        .rotate = 0,
+        .threshold = 0x80,
+        .photo = 0,
+        .dither = PNG2POS_DITHER_ATKINSON,
+        .elide = 0,
+        .fit = PNG2POS_FIT_NONE,
+        .threads = 1,
+        .compose = 0,
+        .printer = NULL,
+        .flush = 'F',
+        .jobs = 1,
+        .stream = 0,
+        .raw_width = 0,
+        .raw_height = 0,
+        .cache = 0,
+        .graphics = 0,
+        .stats = 0,
+        .noinit = 0,
+        .frame = 0,
+        .diagnostic = NULL,
+        .diagnostic_user = NULL
+    };
+    return options;
+}
+
+struct png2pos* png2pos_open(struct png2pos_options options, png2pos_write write, void *user) {
+    if (!write) {
+        return NULL;
+    }
+    struct png2pos *ctx = context_open(&options);
+    if (ctx) {
+        ctx->write = write;
+        ctx->user = user;
+        job_begin(ctx, options.noinit == 0);
+    }
+    return ctx;
+}
+
+struct png2pos* png2pos_open_buffer(struct png2pos_options options, unsigned char *buffer, size_t capacity) {
+    if (!buffer && capacity != 0) {
+        return NULL;
+    }
+    struct png2pos *ctx = context_open(&options);
+    if (ctx) {
+        ctx->buffer = buffer;
+        ctx->capacity = capacity;
+        job_begin(ctx, options.noinit == 0);
+    }
+    return ctx;
+}
+
+struct png2pos* png2pos_open_file(struct png2pos_options options, FILE *file) {
+    if (!file) {
+        return NULL;
+    }
+    struct png2pos *ctx = context_open(&options);
+    if (ctx) {
+        // output layer writes by writev(2), or by fwrite on Windows
+        ctx->out.write = NULL;
+        ctx->out.user = NULL;
+        ctx->out.fd = fileno(file);
+        ctx->out.stream = file;
+        job_begin(ctx, options.noinit == 0);
+    }
+    return ctx;
+}
+
+struct png2pos* png2pos_open_fd(struct png2pos_options options, int fd) {
+#ifdef _WIN32
+    (void)options;
+    (void)fd;
+    return NULL;
+#else
+    if (fd < 0) {
+        return NULL;
+    }
+    struct png2pos *ctx = context_open(&options);
+    if (ctx) {
+        ctx->out.write = NULL;
+        ctx->out.user = NULL;
+        ctx->out.fd = fd;
+        job_begin(ctx, options.noinit == 0);
+    }
+    return ctx;
+#endif
+}
+
+// image is printed as soon as it is converted (or added to the canvas); with stream, a file is decoded
+// band by band unless it has to be decoded as a whole
+static int convert(struct png2pos *ctx, const char *path, const unsigned char *png, const size_t size, struct stats *stats) {
+    struct config *cfg = &ctx->cfg;
+    struct output *out = &ctx->out;
+    if (out->failed != 0) {
+        return PNG2POS_E_WRITE;
+    }
+    job_next(ctx);
+    // stats of the file are kept for the job even if the caller does not want them
+    struct stats file = { .source = 0 };
+    if (!stats && cfg->stats) {
+        stats = &file;
+    }
+
+    // rotation needs the whole image, so does interlaced PNG and an image defined in printer memory
+    if (cfg->stream == 1 && cfg->rotate == 0 && cfg->turn == 0 && !(path && cfg->graphics && graphics_find(path))) {
+        const unsigned long bytes = out->bytes;
+        const unsigned long bands = out->bands;
+        const unsigned long flushes = out->flushes;
+        if (stats) {
+            out->written = 0.0;
+        }
+        const int error = convert_stream(cfg, out, path, png, size, stats);
+        if (stats) {
+            stats->written = out->written;
+            out->written = -1.0;
+        }
+        if (error >= 0) {
+            if (stats) {
+                stats->output = out->bytes - bytes;
+                stats->bands = out->bands - bands;
+                stats->flushes = out->flushes - flushes;
+                job_written(ctx, stats);
+            }
+            return out->failed != 0 ? PNG2POS_E_WRITE : error != 0 ? PNG2POS_E_CONVERT : 0;
+        }
+        if (stats) {
+            memset(stats, 0, sizeof(struct stats));
+        }
+    }
+
+    struct raster raster = { .img_bw = NULL };
+    if (rasterize(cfg, path, png, size, &raster, NULL, 0) != 0) {
+        if (stats) {
+            *stats = raster.stats;
+        }
+        return PNG2POS_E_CONVERT;
+    }
+    int ret = 0;
+    if (cfg->compose == 1) {
+        if (compose_file(out, &ctx->compose, &raster, cfg) != 0) {
+            stage_failed(&raster.stats, STAGE_EMIT);
+            ret = PNG2POS_E_CONVERT;
+        }
+    } else {
+        print_file(out, &raster, cfg);
+    }
+    if (stats) {
+        *stats = raster.stats;
+        job_written(ctx, stats);
+    }
+    return ret == 0 && out->failed != 0 ? PNG2POS_E_WRITE : ret;
+}
+
+int png2pos_convert(struct png2pos *ctx, const unsigned char *png, size_t size) {
+    if (!png) {
+        return PNG2POS_E_CONVERT;
+    }
+    return convert(ctx, NULL, png, size, NULL);
+}
+
+int png2pos_convert_file(struct png2pos *ctx, const char *path) {
+    return convert(ctx, path, NULL, 0, NULL);
+}
+
+static void file_stats(struct png2pos_file_stats *file, const struct stats *stats) {
+    file->source = stats->source;
+    file->failed = stats->failed;
+    file->width = stats->width;
+    file->height = stats->height;
+    file->input = stats->input;
+    file->output = stats->output;
+    file->bands = stats->bands;
+    file->flushes = stats->flushes;
+    file->memory_peak = stats->memory_peak;
+    for (unsigned int i = 0; i != STAGES; ++i) {
+        file->time[i] = stats->time[i];
+    }
+    file->ttfb = stats->written > 0.0 ? stats->written - stats->begin : -1.0;
+}
+
+int png2pos_convert_files(struct png2pos *ctx, const char *const *paths, unsigned int count, struct png2pos_file_stats *files) {
+    struct config *cfg = &ctx->cfg;
+    if (ctx->out.failed != 0) {
+        return PNG2POS_E_WRITE;
+    }
+    job_next(ctx);
+
+    struct stats *stats = NULL;
+    if (cfg->stats && count != 0) {
+        stats = (struct stats *)calloc(count, sizeof(struct stats));
+        if (!stats) {
+            report(cfg->report, "Could not allocate enough memory");
+            return PNG2POS_E_CONVERT;
+        }
+    }
+
+    int ret = 0;
+    const unsigned int jobs = cfg->jobs < count ? cfg->jobs : count;
+    // -s keeps only one band in memory, it is not combined with -j
+    if (jobs > 1 && cfg->stream == 0) {
+        if (convert_batch(cfg, &ctx->out, paths, count, jobs, stats, cfg->compose ? &ctx->compose : NULL) != 0) {
+            ret = PNG2POS_E_CONVERT;
+        }
+        for (unsigned int i = 0; stats && i != count; ++i) {
+            job_written(ctx, &stats[i]);
+        }
+    } else {
+        for (unsigned int i = 0; i != count && ret == 0; ++i) {
+            ret = convert(ctx, paths[i], NULL, 0, stats ? &stats[i] : NULL);
+        }
+    }
+    if (ctx->out.failed != 0) {
+        ret = PNG2POS_E_WRITE;
+    }
+
+    if (files && count != 0) {
+        memset(files, 0, count * sizeof(struct png2pos_file_stats));
+        for (unsigned int i = 0; stats && i != count; ++i) {
+            file_stats(&files[i], &stats[i]);
+        }
+    }
+    free(stats), stats = NULL;
+    return ret;
+}
+
+int png2pos_finish(struct png2pos *ctx) {
+    job_next(ctx);
+    if (ctx->cfg.stats) {
+        // with flush 'J' the whole job is written now, so is the canvas of compose
+        ctx->out.written = 0.0;
+    }
+    if (compose_print(&ctx->out, &ctx->compose) != 0) {
+        return PNG2POS_E_CONVERT;
+    }
+    if (ctx->cfg.cut == 1) {
+        // cut the paper
+        print(&ctx->out, ESC_CUT, ESC_CUT_LENGTH);
+    }
+    output_flush(&ctx->out);
+    if (ctx->out.failed != 0) {
+        return PNG2POS_E_WRITE;
+    }
+    ctx->finished = 1;
+    return 0;
+}
+
+int png2pos_flush(struct png2pos *ctx) {
+    const int error = compose_print(&ctx->out, &ctx->compose);
+    output_flush(&ctx->out);
+    return ctx->out.failed != 0 ? PNG2POS_E_WRITE : error != 0 ? PNG2POS_E_CONVERT : 0;
+}
+
+size_t png2pos_length(const struct png2pos *ctx) {
+    return ctx->length;
+}
+
+void png2pos_job_stats(const struct png2pos *ctx, struct png2pos_job_stats *stats) {
+    const struct output *out = &ctx->out;
+    stats->output = out->bytes;
+    stats->bands = out->bands;
+    stats->flushes = out->flushes;
+    stats->writes = out->writes;
+    stats->memory_peak = ctx->job_memory.memory_peak;
+    pool_counters(&stats->pool_peak, &stats->pool_reused);
+    stats->saved = out->saved;
+    double written = ctx->written;
+    if (out->written > 0.0 && (written <= 0.0 || out->written < written)) {
+        written = out->written;
+    }
+    stats->ttfb = written > 0.0 ? written - ctx->start : -1.0;
+    stats->wall = clock_seconds() - ctx->start;
+}
+
+const char* png2pos_message(const struct png2pos *ctx) {
+    return ctx->message;
+}
+
+void png2pos_close(struct png2pos *ctx) {
+    if (!ctx) {
+        return;
+    }
+    // pending buffers are not written; images composed since the last png2pos_finish() are thrown away
+    compose_release(&ctx->compose);
+    for (unsigned int i = 0; i != ctx->out.heldcnt; ++i) {
+        pool_free(ctx->out.held[i]), ctx->out.held[i] = NULL;
+    }
+    free(ctx->out.held), ctx->out.held = NULL;
+    pthread_mutex_destroy(&ctx->lock);
+    pthread_mutex_destroy(&ctx->job_memory.lock);
+    free(ctx), ctx = NULL;
+    pool_close();
+}
+
+const char* png2pos_error_text(const int error) {
+    switch (error) {
+        case PNG2POS_E_CONVERT:
+            return "image could not be converted";
+        case PNG2POS_E_WRITE:
+            return "output could not be written";
+    }
+    return "unknown error";
+}
+
+const char* png2pos_stage_name(const unsigned int stage) {
+    return stage < STAGES ? STAGE_NAMES[stage] : NULL;
+}
+
+int png2pos_dither(const char *name) {
+    const int engine = dither_engine(name);
+    for (unsigned int i = 0; i != sizeof(DITHERS) / sizeof(DITHERS[0]); ++i) {
+        if (engine >= 0 && DITHERS[i] == (unsigned int)engine) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int png2pos_fit(const char *name) {
+    const int filter = scale_filter(name);
+    for (unsigned int i = 0; i != sizeof(FITS) / sizeof(FITS[0]); ++i) {
+        if (filter >= 0 && FITS[i] == (unsigned int)filter) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int png2pos_printer(const char *printer) {
+    const struct profile *profile = printer ? profile_find(printer) : &PROFILES[0];
+    if (!profile) {
+        return -1;
+    }
+    return (profile->commands & PROFILE_FEED ? PNG2POS_PRINTER_FEED : 0) | (profile->commands & PROFILE_CUT ? PNG2POS_PRINTER_CUT : 0)
+        | (profile->commands & PROFILE_NV ? PNG2POS_PRINTER_NV : 0) | (profile->commands & PROFILE_DOWNLOAD ? PNG2POS_PRINTER_DOWNLOAD : 0);
+}
+
+int png2pos_cache_open(const char *dir, unsigned long max_size, png2pos_diagnostic diagnostic, void *user) {
+    const struct report diagnostics = { .message = diagnostic, .user = user };
+    if (cache_open(dir, max_size) != 0) {
+        report(&diagnostics, "Could not open cache directory '%s', %s", dir, strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+void png2pos_cache_stats(unsigned long *hits, unsigned long *misses, unsigned long *evictions) {
+    cache_stats(hits, misses, evictions);
+}
+
+int png2pos_graphics_key(const char *spec, png2pos_diagnostic diagnostic, void *user) {
+    const struct report diagnostics = { .message = diagnostic, .user = user };
+    return graphics_key(spec, &diagnostics);
+}
+
+int png2pos_graphics_open(const char *path, char memory, png2pos_diagnostic diagnostic, void *user) {
+    const struct report diagnostics = { .message = diagnostic, .user = user };
+    if (memory != 'N' && memory != 'D') {
+        report(&diagnostics, "Unknown graphics memory '%c'", memory);
+        return 1;
+    }
+    return graphics_open(path, memory, &diagnostics);
+}
+
+int png2pos_graphics_save(png2pos_diagnostic diagnostic, void *user) {
+    const struct report diagnostics = { .message = diagnostic, .user = user };
+    return graphics_save(&diagnostics);
+}
+
+const char* png2pos_version(void) {
+    return PNG2POS_VERSION;
+}
+
+const char* png2pos_kernel(void) {
+    pthread_once(&kernels_once, kernels_init);
+    return kernel;
+}
@@ -21,240 +21,1036 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SO
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <ctype.h>
+#include <errno.h>
+#include <limits.h>
 #include <unistd.h>
 #include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <signal.h>
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#endif
 #include "lodepng.h"
+#include "png2pos.h"
 
-const char *PNG2POS_VERSION = "1.6.4";
-const char *PNG2POS_BUILTON = __DATE__;
+FILE *fout = NULL;
 
-// modified lodepng allocators
-void* lodepng_malloc(size_t size) {
-    return calloc(size, sizeof(char));
+char* basename(const char *s) {
+    char *r = (char*)s;
+    while (*s) {
+        if (*s++ == '/') {
+            r = (char*)s;
+        }
+    }
+    return r;
 }
 
-void* lodepng_realloc(void *ptr, size_t new_size) {
-    return realloc(ptr, new_size);
+// diagnostics of libpng2pos, one line each on standard error
+void diagnostic_print(void *user, const char *message) {
+    (void)user;
+    fprintf(stderr, "%s\n", message);
 }
 
-void lodepng_free(void *ptr) {
-    free(ptr);
+// --raw WIDTH[xHEIGHT], height 0 if it is not given
+int raw_size(const char *s, unsigned int *width, unsigned int *height) {
+    char *end = NULL;
+    *width = strtoul(s, &end, 10);
+    *height = 0;
+    if (*end == 'x' && isdigit((unsigned char)end[1])) {
+        *height = strtoul(end + 1, &end, 10);
+    }
+    return *width == 0 || *end != '\0';
 }
 
-// ESC sequences
-#define ESC_INIT_LENGTH 2
-const unsigned char ESC_INIT[ESC_INIT_LENGTH] = {
-    // ESC @, Initialize printer, p. 412
-    0x1b, 0x40
+// -l, server mode, requests are accepted on unix sockets and local TCP ports and converted by
+// a pool of worker threads; a connection may carry any number of requests, all numbers are little endian:
+// request:  "P2P" 0x01, flags (1 = cut, 2 = photo, 4 = rotate, 8 = turn clockwise, 16 = turn counterclockwise,
+//           32 = continues a job, printer is not initialized), alignment ('L', 'C', 'R' or '?'),
+//           threshold, 0x00, PNG length (4 bytes), PNG data
+// response: chunks of ESC/POS data, each prefixed by its length (4 bytes), terminated by an empty chunk
+//           and a status byte (0 = success, 1 = input could not be converted)
+#define SERVER_HEADER_LENGTH 12
+#define SERVER_MAX_PNG (64u << 20)
+// connections held at once, idle or being served, more wait in the listen backlog
+#define SERVER_CONNECTIONS 256
+// seconds an idle connection is kept open, seconds a request may stall while it is read or its response written
+#define SERVER_IDLE 60
+#define SERVER_TIMEOUT 10
+
+#define SERVER_FLAG_CUT 1
+#define SERVER_FLAG_PHOTO 2
+#define SERVER_FLAG_ROTATE 4
+#define SERVER_FLAG_TURN_CW 8
+#define SERVER_FLAG_TURN_CCW 16
+#define SERVER_FLAG_CONTINUE 32
+
+#ifndef _WIN32
+const unsigned char SERVER_MAGIC[4] = { 'P', '2', 'P', 0x01 };
+
+// empty chunk + status
+const unsigned char SERVER_DONE[2][5] = {
+    { 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0x00, 0x00, 0x00, 0x00, 0x01 }
 };
 
-#define ESC_CUT_LENGTH 4
-const unsigned char ESC_CUT[ESC_CUT_LENGTH] = {
-    // GS V, Sub-Function B, p. 373
-    0x1d, 0x56, 0x41,
-    // Feeds paper to (cutting position + n × vertical motion unit)
-    // and executes a full cut (cuts the paper completely)
-    // The vertical motion unit is specified by GS P.
-    0x40
-};
+volatile sig_atomic_t server_stop = 0;
 
-#define ESC_OFFSET_LENGTH 4
-unsigned char ESC_OFFSET[ESC_OFFSET_LENGTH] = {
-    // GS L, Set left margin, p. 169
-    0x1d, 0x4c, 
-    // nl, nh
-    0x00, 0x00
-};
+void server_signal(int sig) {
+    (void)sig;
+    server_stop = 1;
+}
 
-#define ESC_STORE_LENGTH 17
-unsigned char ESC_STORE[ESC_STORE_LENGTH] = {
-    // GS 8 L, Store the graphics data in the print buffer (raster format), p. 252
-    0x1d, 0x38, 0x4c,
-    // p1 p2 p3 p4
-    0x0b, 0x00, 0x00, 0x00, 
-    // Function 112
-    0x30, 0x70, 0x30,
-    // bx by, zoom
-    0x01, 0x01, 
-    // c, single-color printing model
-    0x31, 
-    // xl, xh, number of dots in the horizontal direction
-    0x00, 0x00, 
-    // yl, yh, number of dots in the vertical direction
-    0x00, 0x00
+// connections with a request to be served, each is in the queue, in the poll set of serve() or with a worker,
+// so the queue never gets full; workers hand connections back through the pipe
+struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int fds[SERVER_CONNECTIONS];
+    unsigned int head;
+    unsigned int count;
+    unsigned int stop;
+    int returns[2];
+} server_queue = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+    .head = 0,
+    .count = 0,
+    .stop = 0,
+    .returns = { -1, -1 }
 };
 
-#define ESC_FLUSH_LENGTH 7
-const unsigned char ESC_FLUSH[ESC_FLUSH_LENGTH] = {
-    // GS ( L, Print the graphics data in the print buffer, p. 241
-    // Moves print position to the left side of the print area after 
-    // printing of graphics data is completed
-    0x1d, 0x28, 0x4c, 0x02, 0x00, 0x30,
-    // Fn 50
-    0x32 
-};
+void server_push(const int fd) {
+    pthread_mutex_lock(&server_queue.lock);
+    server_queue.fds[(server_queue.head + server_queue.count) % SERVER_CONNECTIONS] = fd;
+    ++server_queue.count;
+    pthread_cond_signal(&server_queue.cond);
+    pthread_mutex_unlock(&server_queue.lock);
+}
 
-// number of dots/lines in vertical direction in one F112 command
-// set to <= 128u for Epson TM-J2000/J2100
-#ifndef GS8L_MAX_Y
-#define GS8L_MAX_Y 256u
-#endif
+// returns -1 once the server stops
+int server_pop(void) {
+    int fd = -1;
+    pthread_mutex_lock(&server_queue.lock);
+    while (server_queue.count == 0 && server_queue.stop == 0) {
+        pthread_cond_wait(&server_queue.cond, &server_queue.lock);
+    }
+    if (server_queue.stop == 0) {
+        fd = server_queue.fds[server_queue.head];
+        server_queue.head = (server_queue.head + 1) % SERVER_CONNECTIONS;
+        --server_queue.count;
+    }
+    pthread_mutex_unlock(&server_queue.lock);
+    return fd;
+}
 
-// max image width printer is able to process
-#ifndef PRINTER_MAX_WIDTH
-#define PRINTER_MAX_WIDTH 512u
-#endif
+// connection goes back to the poll set, -1 if it was closed; a write of an int into a pipe is atomic
+void server_return(const int fd) {
+    while (write(server_queue.returns[1], &fd, sizeof(fd)) < 0 && errno == EINTR) {
+    }
+}
 
-// app configuration
-struct {
-    unsigned int cut;
-    unsigned int photo;
-    char align;
-    unsigned int rotate;
-    const char *output;
-    unsigned int threshold;
-} config = {
-    .cut = 0,
-    .photo = 0,
-    .align = '?',
-    .rotate = 0,
-    .output = NULL,
-    .threshold = 0x80
+// returns 0 if all n bytes were read
+int read_full(const int fd, void *buffer, size_t n) {
+    unsigned char *p = (unsigned char *)buffer;
+    while (n != 0) {
+        const ssize_t r = read(fd, p, n);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            return 1;
+        }
+        p += r;
+        n -= r;
+    }
+    return 0;
+}
+
+// returns 0 if all n bytes were written
+int write_full(const int fd, const void *buffer, size_t n) {
+    const unsigned char *p = (const unsigned char *)buffer;
+    while (n != 0) {
+        const ssize_t w = write(fd, p, n);
+        if (w < 0 && errno == EINTR) {
+            continue;
+        }
+        if (w <= 0) {
+            return 1;
+        }
+        p += w;
+        n -= w;
+    }
+    return 0;
+}
+
+double monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+unsigned long read_le32(const unsigned char *p) {
+    return (unsigned long)p[0] | (unsigned long)p[1] << 8 | (unsigned long)p[2] << 16 | (unsigned long)p[3] << 24;
+}
+
+// serves one request of a connection by a context of its own, bands are written to the connection as framed
+// chunks as soon as they are converted; the PNG buffer is kept for the next request.
+// Returns 0 if the connection stays open for the next request
+int server_request(const int fd, const struct png2pos_options *defaults, unsigned char **png, size_t *png_size) {
+    unsigned char header[SERVER_HEADER_LENGTH];
+    errno = 0;
+    if (read_full(fd, header, SERVER_HEADER_LENGTH) != 0) {
+        // closed by the client unless it stalled
+        goto fail;
+    }
+    const unsigned long length = read_le32(&header[8]);
+    if (memcmp(header, SERVER_MAGIC, 4) != 0 || length > SERVER_MAX_PNG) {
+        fprintf(stderr, "Invalid request, closing connection\n");
+        return 1;
+    }
+    if (length > *png_size) {
+        unsigned char *p = (unsigned char *)realloc(*png, length);
+        if (!p) {
+            fprintf(stderr, "Could not allocate enough memory\n");
+            return 1;
+        }
+        *png = p;
+        *png_size = length;
+    }
+    if (read_full(fd, *png, length) != 0) {
+        goto fail;
+    }
+
+    // request options replace those of command line; the image is decoded band by band unless the cache
+    // (which takes whole images) is used, each band is flushed to the client
+    struct png2pos_options options = *defaults;
+    options.cut = (header[4] & SERVER_FLAG_CUT) != 0;
+    options.photo = (header[4] & SERVER_FLAG_PHOTO) != 0;
+    options.rotate = header[4] & SERVER_FLAG_TURN_CW ? 90 : header[4] & SERVER_FLAG_TURN_CCW ? 270 : header[4] & SERVER_FLAG_ROTATE ? 180 : 0;
+    options.align = header[5] && strchr("LCR", header[5]) ? header[5] : '?';
+    options.threshold = header[6];
+    options.noinit = (header[4] & SERVER_FLAG_CONTINUE) != 0;
+    options.stream = !options.cache;
+    options.flush = 'B';
+    options.frame = 1;
+
+    struct png2pos *ctx = png2pos_open_fd(options, fd);
+    int error = ctx ? png2pos_convert(ctx, *png, length) : PNG2POS_E_CONVERT;
+    if (error == 0) {
+        error = png2pos_finish(ctx);
+    }
+    png2pos_close(ctx), ctx = NULL;
+    if (error == PNG2POS_E_WRITE || write_full(fd, SERVER_DONE[error != 0], sizeof(SERVER_DONE[0])) != 0) {
+        goto fail;
+    }
+    return 0;
+
+fail:
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        fprintf(stderr, "Request timed out, closing connection\n");
+    }
+    return 1;
+}
+
+// one request per turn, so a connection left idle by its client holds no worker
+void* server_worker(void *arg) {
+    const struct png2pos_options *options = (const struct png2pos_options *)arg;
+    unsigned char *png = NULL;
+    size_t png_size = 0;
+
+    int fd = -1;
+    while ((fd = server_pop()) != -1) {
+        if (server_request(fd, options, &png, &png_size) != 0) {
+            close(fd), fd = -1;
+        }
+        server_return(fd);
+    }
+
+    free(png), png = NULL;
+    return NULL;
+}
+
+// address is a TCP port on loopback if it is a number, path of unix socket otherwise
+int server_listen(const char *address) {
+    int fd = -1;
+    const char *p = address;
+    while (*p && isdigit((unsigned char)*p)) {
+        ++p;
+    }
+
+    if (*address && !*p) {
+        struct sockaddr_in sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sin_family = AF_INET;
+        sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        sa.sin_port = htons((unsigned short)strtoul(address, NULL, 10));
+        const int on = 1;
+        if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0
+            || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0
+            || bind(fd, (struct sockaddr *)&sa, sizeof(sa)) != 0) {
+            goto fail;
+        }
+    } else {
+        struct sockaddr_un sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sun_family = AF_UNIX;
+        if (strlen(address) >= sizeof(sa.sun_path)) {
+            errno = ENAMETOOLONG;
+            goto fail;
+        }
+        strcpy(sa.sun_path, address);
+        // socket left by a previous run
+        struct stat st;
+        if (stat(address, &st) == 0 && S_ISSOCK(st.st_mode)) {
+            unlink(address);
+        }
+        if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0
+            || bind(fd, (struct sockaddr *)&sa, sizeof(sa)) != 0) {
+            goto fail;
+        }
+    }
+
+    if (listen(fd, SOMAXCONN) != 0) {
+        goto fail;
+    }
+    return fd;
+
+fail:
+    fprintf(stderr, "Could not listen on '%s', %s\n", address, strerror(errno));
+    if (fd >= 0) {
+        close(fd);
+    }
+    return -1;
+}
+
+// a connection waiting for its next request
+struct server_idle {
+    int fd;
+    double since;
 };
 
-// Gamma 2.2 lookup table
-const unsigned char GAMMA_22[256] = {
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x02, 0x02, 0x02,
-    0x02, 0x02, 0x03, 0x03, 0x03, 0x03, 0x03, 0x04, 0x04, 0x04, 0x04, 0x05, 0x05, 0x05, 0x05, 0x06,
-    0x06, 0x06, 0x07, 0x07, 0x07, 0x08, 0x08, 0x08, 0x09, 0x09, 0x09, 0x0a, 0x0a, 0x0a, 0x0b, 0x0b,
-    0x0c, 0x0c, 0x0d, 0x0d, 0x0d, 0x0e, 0x0e, 0x0f, 0x0f, 0x10, 0x10, 0x11, 0x11, 0x12, 0x12, 0x13,
-    0x13, 0x14, 0x15, 0x15, 0x16, 0x16, 0x17, 0x17, 0x18, 0x19, 0x19, 0x1a, 0x1b, 0x1b, 0x1c, 0x1d,
-    0x1d, 0x1e, 0x1f, 0x1f, 0x20, 0x21, 0x21, 0x22, 0x23, 0x24, 0x24, 0x25, 0x26, 0x27, 0x28, 0x28,
-    0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2d, 0x2e, 0x2f, 0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37,
-    0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0x3e, 0x3f, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47,
-    0x48, 0x49, 0x4a, 0x4b, 0x4d, 0x4e, 0x4f, 0x50, 0x51, 0x52, 0x54, 0x55, 0x56, 0x57, 0x58, 0x5a,
-    0x5b, 0x5c, 0x5d, 0x5f, 0x60, 0x61, 0x63, 0x64, 0x65, 0x67, 0x68, 0x69, 0x6b, 0x6c, 0x6d, 0x6f,
-    0x70, 0x72, 0x73, 0x75, 0x76, 0x77, 0x79, 0x7a, 0x7c, 0x7d, 0x7f, 0x80, 0x82, 0x83, 0x85, 0x87,
-    0x88, 0x8a, 0x8b, 0x8d, 0x8e, 0x90, 0x92, 0x93, 0x95, 0x97, 0x98, 0x9a, 0x9c, 0x9d, 0x9f, 0xa1,
-    0xa2, 0xa4, 0xa6, 0xa8, 0xa9, 0xab, 0xad, 0xaf, 0xb0, 0xb2, 0xb4, 0xb6, 0xb8, 0xba, 0xbb, 0xbd, 
-    0xbf, 0xc1, 0xc3, 0xc5, 0xc7, 0xc9, 0xcb, 0xcd, 0xcf, 0xd1, 0xd3, 0xd5, 0xd7, 0xd9, 0xdb, 0xdd,
-    0xdf, 0xe1, 0xe3, 0xe5, 0xe7, 0xe9, 0xeb, 0xed, 0xef, 0xf1, 0xf4, 0xf6, 0xf8, 0xfa, 0xfc, 0xff
+// runs until SIGINT or SIGTERM, requests are converted with options of command line by jobs workers;
+// connections wait for requests in the poll set, each readable one is handed to a worker for one request
+int serve(const struct png2pos_options *options, const char *const *addresses, const unsigned int count) {
+    int ret = 1;
+    int fds[2] = { -1, -1 };
+    pthread_t *threads = NULL;
+    unsigned int started = 0;
+    const unsigned int jobs = options->jobs != 0 ? options->jobs : 1;
+    struct server_idle idle[SERVER_CONNECTIONS];
+    unsigned int idlecnt = 0;
+    // accepted and not closed yet: idle, queued and served ones
+    unsigned int connections = 0;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = server_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    // closed connections are reported by write errors
+    signal(SIGPIPE, SIG_IGN);
+
+    // buffers of the pool are kept between requests as long as a context is open
+    struct png2pos_options keep = *options;
+    keep.noinit = 1;
+    struct png2pos *keeper = png2pos_open_buffer(keep, NULL, 0);
+    if (!keeper) {
+        goto fail;
+    }
+
+    for (unsigned int i = 0; i != count; ++i) {
+        if ((fds[i] = server_listen(addresses[i])) < 0) {
+            goto fail;
+        }
+    }
+    if (pipe(server_queue.returns) != 0) {
+        fprintf(stderr, "Could not create pipe, %s\n", strerror(errno));
+        goto fail;
+    }
+
+    threads = (pthread_t *)calloc(jobs, sizeof(pthread_t));
+    if (!threads) {
+        fprintf(stderr, "Could not allocate enough memory\n");
+        goto fail;
+    }
+    for (; started != jobs; ++started) {
+        if (pthread_create(&threads[started], NULL, server_worker, (void *)options) != 0) {
+            break;
+        }
+    }
+    if (started == 0) {
+        fprintf(stderr, "Could not start worker threads\n");
+        goto fail;
+    }
+
+    // a stalled client fails its request instead of holding a worker
+    const struct timeval timeout = { .tv_sec = SERVER_TIMEOUT, .tv_usec = 0 };
+    // listening sockets (left out once connections are at the limit), returned connections, idle connections
+    struct pollfd pfds[2 + 1 + SERVER_CONNECTIONS];
+    while (server_stop == 0) {
+        unsigned int n = 0;
+        const unsigned int listening = connections < SERVER_CONNECTIONS ? count : 0;
+        for (; n != listening; ++n) {
+            pfds[n].fd = fds[n];
+            pfds[n].events = POLLIN;
+        }
+        pfds[n].fd = server_queue.returns[0];
+        pfds[n++].events = POLLIN;
+        for (unsigned int i = 0; i != idlecnt; ++i, ++n) {
+            pfds[n].fd = idle[i].fd;
+            pfds[n].events = POLLIN;
+        }
+        // signals may be delivered to workers, the flag is checked each second anyway
+        if (poll(pfds, n, 1000) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Could not wait for connections, %s\n", strerror(errno));
+            goto fail;
+        }
+        const double now = monotonic_seconds();
+
+        // idle connections with a request (or closed by their client) go to workers, expired ones are closed
+        unsigned int kept = 0;
+        for (unsigned int i = 0; i != idlecnt; ++i) {
+            const struct pollfd *pfd = &pfds[listening + 1 + i];
+            if (pfd->revents != 0) {
+                server_push(idle[i].fd);
+            } else if (now - idle[i].since > SERVER_IDLE) {
+                close(idle[i].fd);
+                --connections;
+            } else {
+                idle[kept++] = idle[i];
+            }
+        }
+        idlecnt = kept;
+
+        if (pfds[listening].revents & POLLIN) {
+            int returned[SERVER_CONNECTIONS];
+            const ssize_t r = read(server_queue.returns[0], returned, sizeof(returned));
+            for (ssize_t i = 0; i < r / (ssize_t)sizeof(int); ++i) {
+                if (returned[i] < 0) {
+                    --connections;
+                } else {
+                    idle[idlecnt].fd = returned[i];
+                    idle[idlecnt++].since = now;
+                }
+            }
+        }
+
+        for (unsigned int i = 0; i != listening; ++i) {
+            if (pfds[i].revents & POLLIN && connections < SERVER_CONNECTIONS) {
+                const int fd = accept(fds[i], NULL, NULL);
+                if (fd >= 0) {
+                    // responses are sent in chunks, do not wait for ACKs (no-op on unix sockets)
+                    const int on = 1;
+                    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+                    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+                    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+                    idle[idlecnt].fd = fd;
+                    idle[idlecnt++].since = now;
+                    ++connections;
+                }
+            }
+        }
+    }
+
+    ret = 0;
+
+fail:
+    // workers are stopped once they finish the request they serve, connections are closed on exit
+    pthread_mutex_lock(&server_queue.lock);
+    server_queue.stop = 1;
+    pthread_cond_broadcast(&server_queue.cond);
+    pthread_mutex_unlock(&server_queue.lock);
+    free(threads), threads = NULL;
+    for (unsigned int i = 0; i != idlecnt; ++i) {
+        close(idle[i].fd);
+    }
+    for (unsigned int i = 0; i != count; ++i) {
+        if (fds[i] >= 0) {
+            close(fds[i]);
+            if (!isdigit((unsigned char)addresses[i][0])) {
+                unlink(addresses[i]);
+            }
+        }
+    }
+    png2pos_close(keeper), keeper = NULL;
+    return ret;
+}
+
+int client_connect(const char *address) {
+    int fd = -1;
+    const char *p = address;
+    while (*p && isdigit((unsigned char)*p)) {
+        ++p;
+    }
+
+    if (*address && !*p) {
+        struct sockaddr_in sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sin_family = AF_INET;
+        sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        sa.sin_port = htons((unsigned short)strtoul(address, NULL, 10));
+        const int on = 1;
+        if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0
+            || setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) != 0
+            || connect(fd, (struct sockaddr *)&sa, sizeof(sa)) != 0) {
+            goto fail;
+        }
+    } else {
+        struct sockaddr_un sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sun_family = AF_UNIX;
+        strncpy(sa.sun_path, address, sizeof(sa.sun_path) - 1);
+        if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0
+            || connect(fd, (struct sockaddr *)&sa, sizeof(sa)) != 0) {
+            goto fail;
+        }
+    }
+    return fd;
+
+fail:
+    fprintf(stderr, "Could not connect to '%s', %s\n", address, strerror(errno));
+    if (fd >= 0) {
+        close(fd);
+    }
+    return -1;
+}
+
+// -C, client mode, input files are converted by server, responses are printed in order;
+// with -j JOBS, JOBS connections are used concurrently, so the client may serve as a load generator
+#define CLIENT_PENDING 0
+#define CLIENT_DONE 1
+#define CLIENT_FAILED 2
+
+struct client_item {
+    unsigned char *data;
+    size_t size;
+    unsigned int state;
+    double latency;
 };
 
-// Lightness lookup table
-const unsigned char LIGHTNESS[256] = {
-    0x00, 0x05, 0x11, 0x1a, 0x21, 0x26, 0x2b, 0x30, 0x34, 0x38, 0x3b, 0x3e, 0x41, 0x44, 0x47, 0x4a,
-    0x4c, 0x4f, 0x51, 0x53, 0x55, 0x57, 0x59, 0x5b, 0x5d, 0x5f, 0x61, 0x63, 0x64, 0x66, 0x68, 0x69,
-    0x6b, 0x6c, 0x6e, 0x6f, 0x71, 0x72, 0x74, 0x75, 0x76, 0x78, 0x79, 0x7a, 0x7b, 0x7d, 0x7e, 0x7f,
-    0x80, 0x81, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x8b, 0x8c, 0x8d, 0x8e, 0x8f, 0x90,
-    0x91, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0x9b, 0x9b, 0x9c, 0x9d, 0x9e, 0x9f,
-    0xa0, 0xa1, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xa9, 0xaa, 0xab, 0xac,
-    0xac, 0xad, 0xae, 0xae, 0xaf, 0xb0, 0xb1, 0xb1, 0xb2, 0xb3, 0xb3, 0xb4, 0xb5, 0xb6, 0xb6, 0xb7,
-    0xb8, 0xb8, 0xb9, 0xba, 0xba, 0xbb, 0xbb, 0xbc, 0xbd, 0xbd, 0xbe, 0xbf, 0xbf, 0xc0, 0xc1, 0xc1,
-    0xc2, 0xc2, 0xc3, 0xc4, 0xc4, 0xc5, 0xc5, 0xc6, 0xc7, 0xc7, 0xc8, 0xc8, 0xc9, 0xc9, 0xca, 0xcb,
-    0xcb, 0xcc, 0xcc, 0xcd, 0xcd, 0xce, 0xcf, 0xcf, 0xd0, 0xd0, 0xd1, 0xd1, 0xd2, 0xd2, 0xd3, 0xd3,
-    0xd4, 0xd4, 0xd5, 0xd6, 0xd6, 0xd7, 0xd7, 0xd8, 0xd8, 0xd9, 0xd9, 0xda, 0xda, 0xdb, 0xdb, 0xdc,
-    0xdc, 0xdd, 0xdd, 0xde, 0xde, 0xdf, 0xdf, 0xe0, 0xe0, 0xe0, 0xe1, 0xe1, 0xe2, 0xe2, 0xe3, 0xe3,
-    0xe4, 0xe4, 0xe5, 0xe5, 0xe6, 0xe6, 0xe7, 0xe7, 0xe7, 0xe8, 0xe8, 0xe9, 0xe9, 0xea, 0xea, 0xeb,
-    0xeb, 0xec, 0xec, 0xec, 0xed, 0xed, 0xee, 0xee, 0xef, 0xef, 0xef, 0xf0, 0xf0, 0xf1, 0xf1, 0xf2,
-    0xf2, 0xf2, 0xf3, 0xf3, 0xf4, 0xf4, 0xf4, 0xf5, 0xf5, 0xf6, 0xf6, 0xf7, 0xf7, 0xf7, 0xf8, 0xf8,
-    0xf9, 0xf9, 0xf9, 0xfa, 0xfa, 0xfb, 0xfb, 0xfb, 0xfc, 0xfc, 0xfd, 0xfd, 0xfd, 0xfe, 0xfe, 0xff
+struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    // server and options carried by requests
+    const char *address;
+    const struct png2pos_options *options;
+    char **inputs;
+    unsigned int count;
+    unsigned int next;
+    struct client_item *items;
+} client = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER
 };
 
-FILE *fout = NULL;
+// reads a whole file into a new buffer after room of offset bytes, returns 0 on success
+int client_load(const char *input, const size_t offset, unsigned char **data, size_t *size) {
+    int ret = 1;
+    FILE *fin = fopen(input, "rb");
+    if (!fin || fseek(fin, 0, SEEK_END) != 0) {
+        goto fail;
+    }
+    const long length = ftell(fin);
+    if (length < 0 || fseek(fin, 0, SEEK_SET) != 0) {
+        goto fail;
+    }
+    if (!(*data = (unsigned char *)malloc(offset + (size_t)length + 1))) {
+        goto fail;
+    }
+    if (fread(&(*data)[offset], 1, (size_t)length, fin) != (size_t)length) {
+        free(*data), *data = NULL;
+        goto fail;
+    }
+    *size = (size_t)length;
+    ret = 0;
 
-inline int rebound(const int value, const int min, const int max) {
-    int a = value;
-    if (a < min) {
-        a = min;
+fail:
+    if (fin) {
+        fclose(fin), fin = NULL;
     }
-    else if (a > max) {
-        a = max;
+    return ret;
+}
+
+// sends one file and collects the response, returns 0 on success; responses of files of the job are printed one after
+// another, so only the first file initializes the printer and only the last one cuts the paper
+int client_request(const int fd, const char *input, const unsigned int first, const unsigned int last, struct client_item *item) {
+    const struct png2pos_options *options = client.options;
+    int ret = 1;
+    unsigned char *request = NULL;
+    size_t png_size = 0;
+
+    // the header goes in front of PNG data, the request is sent by one write
+    if (client_load(input, SERVER_HEADER_LENGTH, &request, &png_size) != 0) {
+        fprintf(stderr, "Could not load input PNG file '%s'\n", input);
+        goto fail;
     }
-    return a;
+
+    unsigned char *header = request;
+    memcpy(header, SERVER_MAGIC, 4);
+    header[4] = (options->cut && last ? SERVER_FLAG_CUT : 0) | (options->photo ? SERVER_FLAG_PHOTO : 0) | (options->rotate == 180 ? SERVER_FLAG_ROTATE : 0)
+        | (options->rotate == 90 ? SERVER_FLAG_TURN_CW : 0) | (options->rotate == 270 ? SERVER_FLAG_TURN_CCW : 0) | (first ? 0 : SERVER_FLAG_CONTINUE);
+    header[5] = options->align;
+    header[6] = options->threshold;
+    header[7] = 0x00;
+    header[8] = png_size & 0xff;
+    header[9] = png_size >> 8 & 0xff;
+    header[10] = png_size >> 16 & 0xff;
+    header[11] = png_size >> 24 & 0xff;
+
+    if (write_full(fd, request, SERVER_HEADER_LENGTH + png_size) != 0) {
+        fprintf(stderr, "Could not send request, %s\n", strerror(errno));
+        goto fail;
+    }
+
+    for (;;) {
+        unsigned char length[4];
+        if (read_full(fd, length, 4) != 0) {
+            fprintf(stderr, "Connection closed by server\n");
+            goto fail;
+        }
+        const size_t n = read_le32(length);
+        if (n == 0) {
+            break;
+        }
+        unsigned char *data = (unsigned char *)realloc(item->data, item->size + n);
+        if (!data) {
+            fprintf(stderr, "Could not allocate enough memory\n");
+            goto fail;
+        }
+        item->data = data;
+        if (read_full(fd, &item->data[item->size], n) != 0) {
+            fprintf(stderr, "Connection closed by server\n");
+            goto fail;
+        }
+        item->size += n;
+    }
+
+    unsigned char status = 1;
+    if (read_full(fd, &status, 1) != 0 || status != 0) {
+        fprintf(stderr, "Server could not convert '%s'\n", input);
+        goto fail;
+    }
+
+    ret = 0;
+
+fail:
+    free(request), request = NULL;
+    return ret;
 }
 
-char* basename(const char *s) {
-    char *r = (char*)s;
-    while (*s) {
-        if (*s++ == '/') {
-            r = (char*)s;
+void* client_worker(void *arg) {
+    (void)arg;
+    const int fd = client_connect(client.address);
+
+    pthread_mutex_lock(&client.lock);
+    while (client.next != client.count) {
+        const unsigned int index = client.next++;
+        pthread_mutex_unlock(&client.lock);
+
+        struct client_item *item = &client.items[index];
+        const double start = monotonic_seconds();
+        const int error = fd < 0 || client_request(fd, client.inputs[index], index == 0, index + 1 == client.count, item) != 0;
+        const double latency = monotonic_seconds() - start;
+
+        pthread_mutex_lock(&client.lock);
+        item->latency = latency;
+        item->state = error ? CLIENT_FAILED : CLIENT_DONE;
+        pthread_cond_broadcast(&client.cond);
+        if (error) {
+            // remaining files are failed as well
+            client.next = client.count;
         }
     }
-    return r;
+    pthread_mutex_unlock(&client.lock);
+
+    if (fd >= 0) {
+        close(fd);
+    }
+    return NULL;
 }
 
-void print(FILE *stream, const unsigned char *buffer, const int length) {
-    for (unsigned int i = 0; i != length; ++i) {
-        fputc(buffer[i], stream);
+// responses are written to out as soon as all preceding ones are
+int client_run(const char *address, const struct png2pos_options *options, FILE *out, char **inputs, const unsigned int count) {
+    int ret = 1;
+    pthread_t *threads = NULL;
+    unsigned int started = 0;
+    const unsigned int jobs = options->jobs < count ? options->jobs : count;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    client.address = address;
+    client.options = options;
+    client.inputs = inputs;
+    client.count = count;
+    client.next = 0;
+    client.items = (struct client_item *)calloc(count, sizeof(struct client_item));
+    threads = (pthread_t *)calloc(jobs, sizeof(pthread_t));
+    if (!client.items || !threads) {
+        fprintf(stderr, "Could not allocate enough memory\n");
+        goto fail;
+    }
+
+    const double start = monotonic_seconds();
+    for (; started != jobs; ++started) {
+        if (pthread_create(&threads[started], NULL, client_worker, NULL) != 0) {
+            break;
+        }
+    }
+    if (started == 0) {
+        fprintf(stderr, "Could not start worker threads\n");
+        goto fail;
+    }
+
+    double latency_sum = 0;
+    double latency_max = 0;
+    unsigned int i = 0;
+    for (; i != count; ++i) {
+        pthread_mutex_lock(&client.lock);
+        while (client.items[i].state == CLIENT_PENDING) {
+            pthread_cond_wait(&client.cond, &client.lock);
+        }
+        pthread_mutex_unlock(&client.lock);
+
+        struct client_item *item = &client.items[i];
+        if (item->state == CLIENT_FAILED) {
+            break;
+        }
+        if (write_full(fileno(out), item->data, item->size) != 0) {
+            fprintf(stderr, "Could not write to output file\n");
+            // remaining requests are not sent
+            pthread_mutex_lock(&client.lock);
+            client.next = client.count;
+            pthread_mutex_unlock(&client.lock);
+            break;
+        }
+        free(item->data), item->data = NULL;
+
+        latency_sum += item->latency;
+        if (item->latency > latency_max) {
+            latency_max = item->latency;
+        }
+    }
+    const double elapsed = monotonic_seconds() - start;
+
+    if (i == count) {
+        fprintf(stderr, "%u requests in %.3f s, %.1f requests/s, latency avg %.2f ms, max %.2f ms\n",
+            count, elapsed, count / elapsed, 1e3 * latency_sum / count, 1e3 * latency_max);
+        ret = 0;
     }
+
+fail:
+    for (unsigned int t = 0; t != started; ++t) {
+        pthread_join(threads[t], NULL);
+    }
+    if (client.items) {
+        for (unsigned int j = 0; j != count; ++j) {
+            free(client.items[j].data), client.items[j].data = NULL;
+        }
+    }
+    free(client.items), client.items = NULL;
+    free(threads), threads = NULL;
+    return ret;
 }
+#endif
 
-int main(int argc, char *argv[]) {
-    {
-        // PRINTER_MAX_WIDTH must be divisible by 8!!
-        if (PRINTER_MAX_WIDTH % 8 != 0) {
-            fprintf(stderr, "FATAL ERROR: PRINTER_MAX_WIDTH MUST BE DIVISIBLE BY 8, PLEASE RECOMPILE\n");
-            return EXIT_FAILURE;
+// --stats, JSON string, control characters and quotes escaped
+void stats_string(const char *s) {
+    fputc('"', stderr);
+    for (; *s; ++s) {
+        const unsigned char c = *s;
+        if (c == '"' || c == '\\') {
+            fprintf(stderr, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(stderr, "\\u%04x", c);
+        } else {
+            fputc(c, stderr);
         }
     }
+    fputc('"', stderr);
+}
+
+void stats_times(const double *time, const double wall) {
+    double total = 0.0;
+    fprintf(stderr, "\"ms\":{");
+    for (unsigned int i = 0; i != PNG2POS_STAGES; ++i) {
+        fprintf(stderr, "\"%s\":%.3f,", png2pos_stage_name(i), time[i] * 1e3);
+        total += time[i];
+    }
+    fprintf(stderr, "\"total\":%.3f", total * 1e3);
+    if (wall >= 0.0) {
+        fprintf(stderr, ",\"wall\":%.3f", wall * 1e3);
+    }
+    fprintf(stderr, "}");
+}
+
+// --stats, time to first byte in milliseconds, null if nothing was written
+void stats_ttfb(const double ttfb) {
+    if (ttfb >= 0.0) {
+        fprintf(stderr, "\"ttfb_ms\":%.3f,", ttfb * 1e3);
+    } else {
+        fprintf(stderr, "\"ttfb_ms\":null,");
+    }
+}
 
-    unsigned char *img_rgba = NULL;
-    unsigned char *img_grey = NULL;
-    unsigned char *img_bw = NULL;
+// --stats, a single JSON line on stderr: input files (in order) and the whole job;
+// a file that failed names the stage it failed in, files after it were not converted (stage null);
+// stage times of job are summed over files, with -j they overlap, so wall time of job is given as well
+void stats_report(char **inputs, const struct png2pos_file_stats *files, const unsigned int count, const struct png2pos_job_stats *job, const int ok) {
+    static const char *SOURCES[] = { "decoded", "streamed", "cache", "printer" };
+    double time[PNG2POS_STAGES] = { 0.0 };
+    unsigned long pixels = 0;
+    unsigned long input = 0;
+    unsigned int printed = 0;
+
+    fprintf(stderr, "{\"files\":[");
+    for (unsigned int i = 0; i != count; ++i) {
+        const struct png2pos_file_stats *f = &files[i];
+        fprintf(stderr, "%s{\"file\":", i != 0 ? "," : "");
+        stats_string(inputs[i]);
+        if (f->failed != 0 || f->source == 0) {
+            // not printed
+            fprintf(stderr, ",\"ok\":false,\"stage\":");
+            if (f->failed != 0) {
+                fprintf(stderr, "\"%s\"}", png2pos_stage_name(f->failed - 1));
+            } else {
+                fprintf(stderr, "null}");
+            }
+            continue;
+        }
+        const unsigned long f_pixels = (unsigned long)f->width * f->height;
+        fprintf(stderr, ",\"ok\":true,\"source\":\"%s\",\"width\":%u,\"height\":%u,\"pixels\":%lu,"
+            "\"input_bytes\":%lu,\"output_bytes\":%lu,\"bands\":%lu,\"flushes\":%lu,\"peak_memory\":%lu,",
+            SOURCES[strchr("DSCG", f->source) - "DSCG"], f->width, f->height, f_pixels,
+            f->input, f->output, f->bands, f->flushes, f->memory_peak);
+        stats_ttfb(f->ttfb);
+        stats_times(f->time, -1.0);
+        fprintf(stderr, "}");
+
+        for (unsigned int j = 0; j != PNG2POS_STAGES; ++j) {
+            time[j] += f->time[j];
+        }
+        pixels += f_pixels;
+        input += f->input;
+        ++printed;
+    }
+    fprintf(stderr, "],\"job\":{\"files\":%u,\"pixels\":%lu,\"input_bytes\":%lu,\"output_bytes\":%lu,"
+        "\"bands\":%lu,\"flushes\":%lu,\"writes\":%lu,\"peak_memory\":%lu,\"pool_peak\":%lu,\"pool_reused\":%lu,",
+        printed, pixels, input, job->output, job->bands, job->flushes, job->writes, job->memory_peak, job->pool_peak, job->pool_reused);
+    stats_ttfb(job->ttfb);
+    stats_times(time, job->wall);
+    fprintf(stderr, ",\"ok\":%s}}\n", ok ? "true" : "false");
+}
 
+int main(int argc, char *argv[]) {
     const char *BINARY_NAME = basename(argv[0]);
 
     int ret = EXIT_FAILURE;
+    struct png2pos_options options = png2pos_defaults();
+    // bands are written as soon as they are printed
+    options.flush = 'B';
+    options.diagnostic = diagnostic_print;
+    const char *output = NULL;
+    // server mode, unix socket paths or local TCP ports; client mode, address of the server
+    const char *listen_on[2] = { NULL, NULL };
+    unsigned int listens = 0;
+    const char *server = NULL;
+    // cache of converted images, size in MiB
+    const char *cache = NULL;
+    unsigned long cache_size = 64;
+    // record of graphics kept in printer memory (N = NV, D = download)
+    const char *graphics = NULL;
+    char memory = 'N';
+    struct png2pos *ctx = NULL;
+    struct png2pos_file_stats *files = NULL;
+    int error = 0;
+
+    // options with no short form
+    enum { OPTION_STATS = 0x100, OPTION_RAW, OPTION_ROTATE, OPTION_FIT, OPTION_COMPOSE, OPTION_PRINTER };
+    static const struct option LONG_OPTIONS[] = {
+        { "stats", no_argument, NULL, OPTION_STATS },
+        { "raw", required_argument, NULL, OPTION_RAW },
+        { "rotate", required_argument, NULL, OPTION_ROTATE },
+        { "fit", optional_argument, NULL, OPTION_FIT },
+        { "compose", no_argument, NULL, OPTION_COMPOSE },
+        { "printer", required_argument, NULL, OPTION_PRINTER },
+        { NULL, 0, NULL, 0 }
+    };
 
     opterr = 0;
     int optc = -1;
-    while ((optc = getopt(argc, argv, ":Vhca:rt:po:")) != -1) {
+    while ((optc = getopt_long(argc, argv, ":Vhca:rt:pd:sej:f:l:C:k:K:g:n:m:o:", LONG_OPTIONS, NULL)) != -1) {
         switch (optc) {
             case 'o':
-                config.output = optarg;
+                output = optarg;
                 break;
 
             case 'c':
-                config.cut = 1;
+                options.cut = 1;
                 break;
 
             case 'a':
-                config.align = toupper(optarg[0]);
-                if (!strchr("LCR", config.align)) {
-                    fprintf(stderr, "Unknown horizontal alignment '%c'\n", config.align);
+                options.align = toupper(optarg[0]);
+                if (!strchr("LCR", options.align)) {
+                    fprintf(stderr, "Unknown horizontal alignment '%c'\n", options.align);
                     goto fail;
                 }
                 break;
 
             case 'r':
-                config.rotate = 1;
+                options.rotate = 180;
                 break;
 
             case 't':
-                config.threshold = strtoul(optarg, NULL, 0);
-                if (config.threshold > 255) {
-                    config.threshold = 0x80;
+                options.threshold = strtoul(optarg, NULL, 0);
+                if (options.threshold > 255) {
+                    options.threshold = 0x80;
                     fprintf(stderr, "B/W threshold must be in the interval <0; 255>. Falling back to the default value 0x80\n");
                 }
                 break;
 
             case 'p':
-                config.photo = 1;
+                options.photo = 1;
+                break;
+
+            case 'd':
+                if (png2pos_dither(optarg) < 0) {
+                    fprintf(stderr, "Unknown dithering engine '%s'\n", optarg);
+                    goto fail;
+                }
+                options.dither = png2pos_dither(optarg);
+                break;
+
+            case 's':
+                options.stream = 1;
+                break;
+
+            case 'e':
+                options.elide = 1;
+                break;
+
+            case OPTION_STATS:
+                options.stats = 1;
+                break;
+
+            case OPTION_RAW:
+                if (raw_size(optarg, &options.raw_width, &options.raw_height) != 0) {
+                    fprintf(stderr, "Raw image size must be WIDTH or WIDTHxHEIGHT\n");
+                    goto fail;
+                }
+                break;
+
+            case OPTION_ROTATE:
+                // the last of -r and --rotate applies
+                options.rotate = strtoul(optarg, NULL, 10);
+                if (!isdigit((unsigned char)optarg[0]) || options.rotate % 90 != 0 || options.rotate > 270) {
+                    fprintf(stderr, "Rotation must be 0, 90, 180 or 270 degrees clockwise\n");
+                    goto fail;
+                }
+                break;
+
+            case OPTION_FIT:
+                if (optarg && png2pos_fit(optarg) < 0) {
+                    fprintf(stderr, "Unknown scaling filter '%s'\n", optarg);
+                    goto fail;
+                }
+                options.fit = optarg ? png2pos_fit(optarg) : PNG2POS_FIT_AREA;
+                break;
+
+            case OPTION_COMPOSE:
+                options.compose = 1;
+                break;
+
+            case OPTION_PRINTER:
+                if (png2pos_printer(optarg) < 0) {
+                    fprintf(stderr, "Unknown printer profile '%s'\n", optarg);
+                    goto fail;
+                }
+                options.printer = optarg;
+                break;
+
+            case 'f':
+                options.flush = toupper(optarg[0]);
+                if (!strchr("BFJ", options.flush)) {
+                    fprintf(stderr, "Unknown flush policy '%c'\n", options.flush);
+                    goto fail;
+                }
+                break;
+
+            case 'l':
+                if (listens == 2) {
+                    fprintf(stderr, "At most two addresses can be listened on\n");
+                    goto fail;
+                }
+                listen_on[listens++] = optarg;
+                break;
+
+            case 'C':
+                server = optarg;
+                break;
+
+            case 'k':
+                cache = optarg;
+                break;
+
+            case 'K':
+                cache_size = strtoul(optarg, NULL, 0);
+                break;
+
+            case 'g':
+                graphics = optarg;
+                break;
+
+            case 'n':
+                if (png2pos_graphics_key(optarg, diagnostic_print, NULL) != 0) {
+                    goto fail;
+                }
+                break;
+
+            case 'm':
+                memory = toupper(optarg[0]);
+                if (!strchr("ND", memory)) {
+                    fprintf(stderr, "Unknown graphics memory '%c'\n", memory);
+                    goto fail;
+                }
+                break;
+
+            case 'j':
+                options.jobs = strtoul(optarg, NULL, 0);
+                if (options.jobs == 0) {
+#ifdef _SC_NPROCESSORS_ONLN
+                    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+                    options.jobs = cpus > 0 ? cpus : 1;
+#else
+                    options.jobs = 1;
+#endif
+                }
                 break;
 
             case 'V':
-                fprintf(stderr, "%s %s (%s)\n", BINARY_NAME, PNG2POS_VERSION, PNG2POS_BUILTON);
+                fprintf(stderr, "%s %s (%s)\n", BINARY_NAME, png2pos_version(), __DATE__);
                 fprintf(stderr, "%s %s\n", "LodePNG", LODEPNG_VERSION_STRING);
+                fprintf(stderr, "RGBA to grey kernel: %s\n", png2pos_kernel());
                 ret = EXIT_SUCCESS;
                 goto fail;
 
             case 'h':
                 fprintf(stderr,
                     "png2pos is a utility to convert PNG to ESC/POS\n"
-                    "Usage: %s [-V] [-h] [-c] [-a L|C|R] [-r] [-t THRESHOLD] [-p] [-o FILE] input files\n"
+                    "Usage: %s [-V] [-h] [-c] [-a L|C|R] [-r] [-t THRESHOLD] [-p] [-d ENGINE] [-s] [-e] [-j JOBS] [-f B|F|J] [-l ADDRESS] [-C ADDRESS] [-k DIR] [-K MIB] [-g FILE] [-n KEY:FILE] [-m N|D] [--stats] [--raw WIDTH[xHEIGHT]] [--rotate ANGLE] [--fit[=FILTER]] [--compose] [--printer PROFILE] [-o FILE] input files\n"
                     "\n"
                     "  -V           display the version number and exit\n"
                     "  -h           display this short help and exit\n"
@@ -263,9 +1059,33 @@ int main(int argc, char *argv[]) {
                     "  -r           rotate image upside down before it is printed\n"
                     "  -t THRESHOLD set the treshold value for conversion to B/W\n"
                     "  -p           switch to photo mode (pre-process input files)\n"
+                    "  -d ENGINE    dithering of photo mode: atkinson, bayer4, bayer8, bluenoise\n"
+                    "  -s           low memory mode, decode and print input files band by band\n"
+                    "  -e           feed paper instead of printing blank rows, trim blank columns\n"
+                    "  -j JOBS      convert JOBS input files (or lines of a single one) in parallel\n"
+                    "  -f B|F|J     write output after each band, file or at the end of job\n"
+                    "  -l ADDRESS   run as a server on unix socket or local TCP port, JOBS workers\n"
+                    "  -C ADDRESS   convert input files by a server, using JOBS connections\n"
+                    "               (-e, -d, -k, --fit, --printer and --raw are given to the server)\n"
+                    "  -k DIR       keep converted images in cache directory DIR\n"
+                    "  -K MIB       limit size of the cache to MIB megabytes (64)\n"
+                    "  -g FILE      record of graphics kept in printer memory\n"
+                    "  -n KEY:FILE  keep input FILE in printer memory under two character KEY\n"
+                    "  -m N|D       keep graphics in NV or download memory\n"
+                    "  --stats      report stage times, sizes and memory of files and job as JSON\n"
+                    "  --raw WIDTH[xHEIGHT]\n"
+                    "               input files are raw 1-bit rasters, rows packed MSB first, 1 = black\n"
+                    "  --rotate ANGLE\n"
+                    "               rotate image by 0, 90, 180 or 270 degrees clockwise (180 = -r)\n"
+                    "  --fit[=FILTER]\n"
+                    "               scale images too wide for the printer down to its width, FILTER: area, lanczos\n"
+                    "  --compose    stack input files into one image printed in full bands\n"
+                    "  --printer PROFILE\n"
+                    "               printer the output is for: 58mm, 80mm, 80mm-wide, tm-t88, tm-j2000 (default as built)\n"
                     "  -o FILE      output file\n"
                     "\n"
                     "With no FILE, or when FILE is -, write to standard output\n"
+                    "Input files may be PNG, binary PBM or PGM; input file - is standard input\n"
                     "\n"
                     "Please read the manual page (man %s)\n"
                     "Report bugs at https://github.com/petrkutalek/png2pos/issues\n"
@@ -283,6 +1103,11 @@ int main(int argc, char *argv[]) {
 
             default:
             case '?':
+                if (optopt == 0) {
+                    fprintf(stderr, "'%s' is an unknown option\n", argv[optind - 1]);
+                    fprintf(stderr, "For usage options run '%s -h'\n", BINARY_NAME);
+                    goto fail;
+                }
                 fprintf(stderr, "'%c' is an unknown option\n", optopt);
                 fprintf(stderr, "For usage options run '%s -h'\n", BINARY_NAME);
                 goto fail;
@@ -293,270 +1118,171 @@ int main(int argc, char *argv[]) {
     argv += optind;
     optind = 0;
 
-    // open output file and disable line buffering
-    if (!config.output || strcmp(config.output, "-") == 0) {
-        fout = stdout;
-    } else if (!(fout = fopen(config.output, "wb"))) {
-        fprintf(stderr, "Could not open output file '%s'\n", config.output);
-        goto fail;
+    // align rotated image to the right border
+    if (options.rotate == 180 && options.align == '?') {
+        options.align = 'R';
     }
 
-    if (isatty(fileno(fout))) {
-        fprintf(stderr, "This utility produces binary sequence printer commands. Output have to be redirected\n");
+    // commands the printer does not support
+    const int commands = png2pos_printer(options.printer);
+    const char *printer = options.printer ? options.printer : "default";
+    if (options.cut == 1 && !(commands & PNG2POS_PRINTER_CUT)) {
+        fprintf(stderr, "Printer '%s' can not cut the paper, -c is ignored\n", printer);
+        options.cut = 0;
+    }
+    if (options.elide == 1 && !(commands & PNG2POS_PRINTER_FEED)) {
+        fprintf(stderr, "Printer '%s' can not feed paper, blank rows can not be elided\n", printer);
         goto fail;
     }
-
-    if (setvbuf(fout, NULL, _IOFBF, 8192) != 0) {
-        fprintf(stderr, "Could not set new buffer policy on output stream\n");
+    if (graphics && !(commands & (memory == 'D' ? PNG2POS_PRINTER_DOWNLOAD : PNG2POS_PRINTER_NV))) {
+        fprintf(stderr, "Printer '%s' has no %s graphics memory\n", printer, memory == 'D' ? "download" : "NV");
+        goto fail;
     }
 
-    // init printer
-    print(fout, ESC_INIT, ESC_INIT_LENGTH);
-    fflush(fout);
-
-    // for each input file
-    while (optind != argc) {
-        const char *input = argv[optind++];
-
-        // load RGBA PNG
-        unsigned int img_w = 0;
-        unsigned int img_h = 0;
-        unsigned int lodepng_error = lodepng_decode32_file(&img_rgba, &img_w, &img_h, input);
-        if (lodepng_error) {
-            fprintf(stderr, "Could not load and process input PNG file, %s\n", lodepng_error_text(lodepng_error));
+    if (cache) {
+        if (png2pos_cache_open(cache, cache_size << 20, diagnostic_print, NULL) != 0) {
             goto fail;
         }
-
-        if (img_w > PRINTER_MAX_WIDTH) {
-            fprintf(stderr, "Image width %u px exceeds the printer's capability (%u px)\n", img_w, PRINTER_MAX_WIDTH);
-            goto fail;
+        options.cache = 1;
+        if (options.stream == 1) {
+            fprintf(stderr, "Files printed band by band (-s) are not looked up in the cache nor stored into it\n");
         }
+    }
 
-        unsigned int histogram[256] = { 0 };
+    if (options.stats == 1 && (listens != 0 || server)) {
+        fprintf(stderr, "Statistics can not be collected in server or client mode\n");
+        goto fail;
+    }
 
-        // convert RGBA to greyscale
-        const unsigned int img_grey_size = img_h * img_w;
-        img_grey = (unsigned char *)calloc(img_grey_size, 1);
-        if (!img_grey) {
-            fprintf(stderr, "Could not allocate enough memory\n");
+    if (options.compose == 1) {
+        if (listens != 0 || server) {
+            fprintf(stderr, "Images can not be composed in server or client mode\n");
             goto fail;
         }
-
-        // convert RGBA to greyscale
-        for (unsigned int i = 0; i != img_grey_size; ++i) {
-            // A
-            const unsigned int a = img_rgba[(i << 2) | 3];
-            // RGBA → RGB
-            const unsigned int r = (255 - a) + a / 255 * img_rgba[i << 2];
-            const unsigned int g = (255 - a) + a / 255 * img_rgba[(i << 2) | 1];
-            const unsigned int b = (255 - a) + a / 255 * img_rgba[(i << 2) | 2];
-            // RGB → R'G'B'
-            const unsigned int r_ = GAMMA_22[r];
-            const unsigned int g_ = GAMMA_22[g];
-            const unsigned int b_ = GAMMA_22[b];
-            // R'G'B' → luma Y' (!= luminance), CIE, BT.709
-            const unsigned int y_ = (55 * r_ + 182 * g_ + 18 * b_) / 255;
-            // Y' → lightness L*
-            img_grey[i] = LIGHTNESS[y_];
-
-            // prepare a histogram for HEA
-            ++histogram[img_grey[i]];
-        }
-
-        free(img_rgba), img_rgba = NULL;
-
-#ifdef DEBUG
-        lodepng_encode_file("debug/g.png", img_grey, img_w, img_h, LCT_GREY, 8);
-
-        // draw histogram via gnuplot, write dataset
-        FILE *fhist = fopen("debug/histogram.txt", "w");
-        if (fhist) {
-            fprintf(fhist, "#hue\tcount\n");
-            for (unsigned int i = 0; i != 256; ++i) {
-                fprintf(fhist, "%d\t%d\n", i, histogram[i]);
-            }
-            fprintf(fhist, "#EOF\n");
-        }
-        fclose(fhist), fhist = NULL;
-#endif
-
-        {
-            // -p hints
-            unsigned int colors = 0;
-            for (unsigned int i = 0; i != 256; ++i) {
-                if (histogram[i] > 0) {
-                    ++colors;
-                }
-            }
-            if (colors < 16 && config.photo == 1) {
-                fprintf(stderr, "Image seems to be B/W. -p is probably not good option this time\n");
-            }
-            if (colors >= 16 && config.photo == 0) {
-                fprintf(stderr, "Image seems to be greyscale or colored. Maybe you should use options -p and -t for better results\n");
-            }
-        }
-
-        // post-processing
-        // convert to B/W bitmap
-        if (config.photo == 1) {
-            // Histogram Equalization Algorithm
-            for (unsigned int i = 1; i != 256; ++i) {
-                histogram[i] += histogram[i - 1];
-            }
-            for (unsigned int i = 0; i != img_grey_size; ++i) {
-                img_grey[i] = 255 * histogram[img_grey[i]] / img_grey_size;
-            }
-            config.threshold = 255 * histogram[config.threshold] / img_grey_size;
-            fprintf(stderr, "Threshold shift, new value = %d\n", config.threshold);
-
-#ifdef DEBUG
-            lodepng_encode_file("debug/g_pp.png", img_grey, img_w, img_h, LCT_GREY, 8);
-
-            for (unsigned int i = 1; i != 256; ++i) {
-                histogram[i] = 0;
-            }
-           for (unsigned int i = 0; i != img_grey_size; ++i) {
-                ++histogram[img_grey[i]];
-            }
-
-            // draw histogram via gnuplot, write dataset
-            FILE *fhist = fopen("debug/histogram_pp.txt", "w");
-            if (fhist) {
-                fprintf(fhist, "#hue\tcount\n");
-                for (unsigned int i = 0; i != 256; ++i) {
-                    fprintf(fhist, "%d\t%d\n", i, histogram[i]);
-                }
-                fprintf(fhist, "#EOF\n");
-            }
-            fclose(fhist), fhist = NULL;
-#endif
-
-            // Atkinson Dithering Algorithm
-            const struct {
-                int dx;
-                int dy;
-            } matrix[6] = {
-                { .dx =  1, .dy = 0 },
-                { .dx =  2, .dy = 0 },
-                { .dx = -1, .dy = 1 },
-                { .dx =  0, .dy = 1 },
-                { .dx =  1, .dy = 1 },
-                { .dx =  0, .dy = 2 }
-            };
-            for (unsigned int i = 0; i != img_grey_size; ++i) {
-                const unsigned int o = img_grey[i];
-                const unsigned int n = o <= config.threshold ? 0x00 : 0xff;
-                const int d = (signed int)(o - n) / 8;
-                img_grey[i] = n;
-                const unsigned int x = i % img_w;
-                const unsigned int y = i / img_w;
-
-                for (unsigned int j = 0; j != 6; ++j) {
-                    const int x0 = x + matrix[j].dx;
-                    const int y0 = y + matrix[j].dy;
-                    if (x0 >= img_w || x0 < 0 || y0 >= img_h) {
-                        continue;
-                    }
-                    img_grey[x0 + img_w * y0] = rebound(img_grey[x0 + img_w * y0] + d, 0x00, 0xff);
-                }
-            }
+        // the canvas needs whole images, cache keeps finished bands of single ones
+        if (options.stream == 1 || cache) {
+            fprintf(stderr, "Images can not be composed with -s or -k\n");
+            goto fail;
         }
+    }
 
-        // canvas size is width of a picture rounded up to nearest multiple of 8
-        const unsigned int canvas_w = ((img_w + 7) >> 3) << 3;
+    // request carries just -c, -p, -a, -r, --rotate and -t, the rest is up to the server (its command line)
+    if (server && (options.elide == 1 || options.dither != PNG2POS_DITHER_ATKINSON || options.fit != PNG2POS_FIT_NONE
+        || options.printer || options.raw_width != 0 || cache)) {
+        fprintf(stderr, "Options -e, -d, -k, --fit, --printer and --raw are not sent to server, give them to the server instead\n");
+        goto fail;
+    }
 
-        const unsigned int img_bw_size = img_h * (canvas_w >> 3);
-        img_bw = (unsigned char *)calloc(img_bw_size, 1);
-        if (!img_bw) {
-            fprintf(stderr, "Could not allocate enough memory\n");
+    if (graphics) {
+        if (listens != 0 || server) {
+            fprintf(stderr, "Graphics kept in printer memory can not be used in server or client mode\n");
             goto fail;
         }
-
-        // align rotated image to the right border
-        if (config.rotate == 1 && config.align == '?') {
-            config.align = 'R';
+        if (png2pos_graphics_open(graphics, memory, diagnostic_print, NULL) != 0) {
+            goto fail;
         }
+        options.graphics = 1;
+    }
 
-        // compress bytes into bitmap
-        for (unsigned int i = 0; i != img_grey_size; ++i) {
-            const unsigned int idx = config.rotate == 1 ? img_grey_size - 1 - i: i;
-            if (img_grey[idx] <= config.threshold) {
-                const unsigned int x = i % img_w;
-                const unsigned int y = i / img_w;
-                img_bw[(y * canvas_w + x) >> 3] |= 0x80 >> (x & 0x07);
-            }
+    if (listens != 0) {
+#ifdef _WIN32
+        fprintf(stderr, "Server mode is not supported on this platform\n");
+#else
+        // lines of a request are dithered by its worker alone
+        options.threads = 1;
+        if (serve(&options, listen_on, listens) == 0) {
+            ret = EXIT_SUCCESS;
         }
-
-        free(img_grey), img_grey = NULL;
-
-#ifdef DEBUG
-        //for (unsigned int i = 0; i != img_bw_size; ++i) {
-        //    img_bw[i] = ~img_bw[i];
-        //}
-        lodepng_encode_file("debug/bw_inv.png", img_bw, canvas_w, img_h, LCT_GREY, 1);
 #endif
+        goto fail;
+    }
 
-        // left offset
-        unsigned int offset = 0;
-        switch (config.align) {
-            case 'C':
-                offset = (PRINTER_MAX_WIDTH - canvas_w) >> 1;
-                break;
+    // open output file and disable line buffering
+    if (!output || strcmp(output, "-") == 0) {
+        fout = stdout;
+    } else if (!(fout = fopen(output, "wb"))) {
+        fprintf(stderr, "Could not open output file '%s'\n", output);
+        goto fail;
+    }
 
-            case 'R':
-                offset = PRINTER_MAX_WIDTH - canvas_w;
-                break;
+    if (isatty(fileno(fout))) {
+        fprintf(stderr, "This utility produces binary sequence printer commands. Output have to be redirected\n");
+        goto fail;
+    }
 
-            case 'L':
-            case '?':
-            default:
-                offset = 0;
+    if (server) {
+#ifdef _WIN32
+        fprintf(stderr, "Client mode is not supported on this platform\n");
+#else
+        if (client_run(server, &options, fout, argv, argc) == 0) {
+            ret = EXIT_SUCCESS;
         }
+#endif
+        goto fail;
+    }
 
-        // offset have to be a multiple of 8
-        offset = (offset >> 3) << 3;
-
-        // chunking, l = lines already printed, currently processing a chunk of height k
-        for (unsigned int l = 0, k = GS8L_MAX_Y; l < img_h; l += k) {
-            if (k > img_h - l) {
-                k = img_h - l;
-            }
-
-            if (offset != 0) {
-                ESC_OFFSET[2] = offset & 0xff;
-                ESC_OFFSET[3] = offset >> 8 & 0xff;
-                print(fout, ESC_OFFSET, ESC_OFFSET_LENGTH);
-            }
-
-            const unsigned int f112_p = 10 + k * (canvas_w >> 3);
-            ESC_STORE[ 3] = f112_p & 0xff;
-            ESC_STORE[ 4] = f112_p >> 8 & 0xff;
-            ESC_STORE[13] = canvas_w & 0xff;
-            ESC_STORE[14] = canvas_w >> 8 & 0xff;
-            ESC_STORE[15] = k & 0xff;
-            ESC_STORE[16] = k >> 8 & 0xff;
-
-            print(fout, ESC_STORE, ESC_STORE_LENGTH);
-            print(fout, &img_bw[l * (canvas_w >> 3)], k * (canvas_w >> 3));
-            print(fout, ESC_FLUSH, ESC_FLUSH_LENGTH);
-            fflush(fout);
+    if (options.stats == 1) {
+        files = (struct png2pos_file_stats *)calloc(argc ? argc : 1, sizeof(struct png2pos_file_stats));
+        if (!files) {
+            fprintf(stderr, "Could not allocate enough memory\n");
+            goto fail;
         }
+    }
 
-        free(img_bw), img_bw = NULL;
-   }
+    // files are converted in parallel, with -s or a single input file lines of image are dithered in parallel
+    if (options.stream == 1 || argc == 1) {
+        options.threads = options.jobs;
+    }
 
-    if (config.cut == 1) {
-        // cut the paper
-        print(fout, ESC_CUT, ESC_CUT_LENGTH);
-        fflush(fout);
+    // printer is initialized by the context
+    if (!(ctx = png2pos_open_file(options, fout))) {
+        goto fail;
+    }
+    error = png2pos_convert_files(ctx, (const char *const *)argv, argc, files);
+    if (error == 0) {
+        error = png2pos_finish(ctx);
+    }
+    if (error == PNG2POS_E_WRITE) {
+        fprintf(stderr, "Could not write to output file\n");
+        goto fail;
+    }
+    if (error != 0) {
+        goto fail;
+    }
+    if (options.elide == 1) {
+        struct png2pos_job_stats job;
+        png2pos_job_stats(ctx, &job);
+        fprintf(stderr, "Blank rows and columns elided, %ld bytes saved\n", job.saved);
     }
 
     ret = EXIT_SUCCESS;
 
 fail:
-    free(img_rgba), img_rgba = NULL;
-    free(img_grey), img_grey = NULL;
-    free(img_bw), img_bw = NULL;
+    if (ctx) {
+        // files printed before an error are written out, so are files composed before it
+        if (error != 0 && png2pos_flush(ctx) == PNG2POS_E_WRITE) {
+            error = PNG2POS_E_WRITE;
+        }
+        if (files) {
+            struct png2pos_job_stats job;
+            png2pos_job_stats(ctx, &job);
+            stats_report(argv, files, argc, &job, ret == EXIT_SUCCESS);
+        }
+        // graphics written to the printer are recorded, even if a later file failed
+        if (error != PNG2POS_E_WRITE && png2pos_graphics_save(diagnostic_print, NULL) != 0) {
+            ret = EXIT_FAILURE;
+        }
+        png2pos_close(ctx), ctx = NULL;
+    }
+    free(files), files = NULL;
+
+    if (options.cache == 1) {
+        unsigned long hits = 0;
+        unsigned long misses = 0;
+        unsigned long evictions = 0;
+        png2pos_cache_stats(&hits, &misses, &evictions);
+        fprintf(stderr, "Cache: %lu hits, %lu misses, %lu evicted\n", hits, misses, evictions);
+    }
 
     if (fout != NULL && fout != stdout) {
         fclose(fout), fout = NULL;
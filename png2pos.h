@@ -0,0 +1,250 @@
+/*!
+(c) 2012 - 2015 Petr Kutalek: png2pos
+
+Licensed under the MIT License, see png2pos.c
+*/
+
+#ifndef PNG2POS_H
+#define PNG2POS_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+// libpng2pos, conversion of PNG images into ESC/POS commands
+//
+// A context converts images of one print job: printer initialization goes before its first image,
+// images follow in the order they were converted and png2pos_finish() ends the job (and cuts the paper,
+// if asked to). Output is written to a callback, into a buffer, to a file or to a file descriptor given
+// by the caller whenever it is flushed: after each band, after each image (default) or at the end of job;
+// with compose, images are written by png2pos_finish().
+// Any number of contexts may be used at once by different threads, a single context must not be used
+// by two threads at once. Contexts share only what is locked: the pool of image buffers, which keeps
+// released buffers (32 MiB at most) for images of all contexts and releases them when the last context
+// is closed, and the cache and the graphics record of the process, if a context asks for them.
+// Options are copied into the context, in photo mode the threshold shifted by an image applies to the next
+// image of the same context, as it does to the next file of the command line.
+// Nothing is written to standard error: diagnostics (hints of photo mode, threshold shifts, reasons an image
+// could not be converted) are passed to the diagnostic callback of the context, the last one is kept by it.
+
+#if defined(_WIN32) && defined(PNG2POS_BUILD)
+#define PNG2POS_API __declspec(dllexport)
+#elif defined(__GNUC__)
+#define PNG2POS_API __attribute__((visibility("default")))
+#else
+#define PNG2POS_API
+#endif
+
+#define PNG2POS_E_CONVERT 1
+#define PNG2POS_E_WRITE 2
+
+// dithering engines of photo mode (-d)
+#define PNG2POS_DITHER_ATKINSON 0
+#define PNG2POS_DITHER_BAYER4 1
+#define PNG2POS_DITHER_BAYER8 2
+#define PNG2POS_DITHER_BLUE_NOISE 3
+
+// scaling of images too wide for the printer (--fit)
+#define PNG2POS_FIT_NONE 0
+#define PNG2POS_FIT_AREA 1
+#define PNG2POS_FIT_LANCZOS 2
+
+// commands a printer takes besides bitmaps, see png2pos_printer()
+#define PNG2POS_PRINTER_FEED 0x01
+#define PNG2POS_PRINTER_CUT 0x02
+#define PNG2POS_PRINTER_NV 0x04
+#define PNG2POS_PRINTER_DOWNLOAD 0x08
+
+// stages of conversion, timed with stats
+#define PNG2POS_STAGES 6
+
+// receives a diagnostic message of a context (without trailing newline); it may be called by worker
+// threads of the context (jobs, threads), but never by two of them at once
+typedef void (*png2pos_diagnostic)(void *user, const char *message);
+
+struct png2pos_options {
+    // cut the paper at the end of job (-c)
+    unsigned int cut;
+    // horizontal alignment 'L', 'C' or 'R' (-a), '?' = left, right for images rotated by 180 degrees
+    char align;
+    // clockwise rotation by 0, 90, 180 or 270 degrees (-r, --rotate)
+    unsigned int rotate;
+    // B/W threshold <0; 255> (-t)
+    unsigned int threshold;
+    // photo mode (-p) and its dithering engine (-d), PNG2POS_DITHER_*
+    unsigned int photo;
+    unsigned int dither;
+    // feed paper instead of printing blank rows, trim blank columns (-e)
+    unsigned int elide;
+    // PNG2POS_FIT_* (--fit)
+    unsigned int fit;
+    // threads lines of an image are dithered by, 0 = 1
+    unsigned int threads;
+    // stack images of a job into one image printed in full bands (--compose)
+    unsigned int compose;
+    // printer profile (--printer), NULL = the printer libpng2pos was built for
+    const char *printer;
+    // flush output after each band 'B', each image 'F' or at the end of job 'J' (-f)
+    char flush;
+    // files of png2pos_convert_files() converted at once by as many threads (-j), 0 = 1
+    unsigned int jobs;
+    // decode and print files (and PNG in memory, except on Windows) band by band (-s); rotated images,
+    // interlaced PNG and images printed from printer memory are decoded as a whole, files are not converted at once
+    unsigned int stream;
+    // input files are raw 1-bit rasters of this size, rows packed MSB first, 1 = black (--raw);
+    // width 0 = PNG, PBM or PGM files, height 0 = up to the end of file
+    unsigned int raw_width;
+    unsigned int raw_height;
+    // look images up in the cache of png2pos_cache_open() and store them into it (-k)
+    unsigned int cache;
+    // print files mapped by png2pos_graphics_key() from printer memory of png2pos_graphics_open() (-g)
+    unsigned int graphics;
+    // collect stats of files and job, see png2pos_convert_files() and png2pos_job_stats() (--stats)
+    unsigned int stats;
+    // the first job continues output written before, the printer is not initialized
+    unsigned int noinit;
+    // each flush is written as a chunk prefixed by its length, 4 bytes little endian
+    unsigned int frame;
+    // diagnostics, called with diagnostic_user; NULL = they are just kept by the context
+    png2pos_diagnostic diagnostic;
+    void *diagnostic_user;
+};
+
+// stats of a file of png2pos_convert_files()
+struct png2pos_file_stats {
+    // 'D' decoded, 'S' decoded band by band, 'C' taken from cache, 'G' printed from printer memory,
+    // 0 = not printed
+    char source;
+    // stage + 1 the file failed in (see png2pos_stage_name()), 0 if it did not fail
+    unsigned int failed;
+    unsigned int width;
+    unsigned int height;
+    // bytes of input file and of ESC/POS output, bands and flushes of the output
+    unsigned long input;
+    unsigned long output;
+    unsigned long bands;
+    unsigned long flushes;
+    // peak of buffers held by its conversion, bytes
+    unsigned long memory_peak;
+    // wall time of stages, seconds
+    double time[PNG2POS_STAGES];
+    // seconds from the start of its conversion to its first write, negative if it was not written while it was printed
+    double ttfb;
+};
+
+// stats of the job of a context, from the first image after the last png2pos_finish() (or from its opening)
+struct png2pos_job_stats {
+    // bytes of ESC/POS output, bands, flushes and writes of the output
+    unsigned long output;
+    unsigned long bands;
+    unsigned long flushes;
+    unsigned long writes;
+    // peak of buffers held by all files of the job at once (collected with stats only)
+    unsigned long memory_peak;
+    // peak of bytes held by the pool of the process and bytes of requests served by kept buffers
+    unsigned long pool_peak;
+    unsigned long pool_reused;
+    // bytes saved by elide
+    long saved;
+    // seconds from the start of job to its first write (negative if nothing has been written, or without stats)
+    // and until now
+    double ttfb;
+    double wall;
+};
+
+// returns 0 if length bytes of output were written, anything else fails the context
+typedef int (*png2pos_write)(void *user, const unsigned char *data, size_t length);
+
+struct png2pos;
+
+// options of the command line without any option, except flush 'F' (the command line flushes each band)
+PNG2POS_API struct png2pos_options png2pos_defaults(void);
+
+// new context writing its output by write (called with user), NULL if options are invalid (or ask for a command
+// the printer does not support) or memory is short, the reason goes to the diagnostic callback of options;
+// with flush 'B' printer initialization is written right away
+PNG2POS_API struct png2pos* png2pos_open(struct png2pos_options options, png2pos_write write, void *user);
+
+// new context writing its output into buffer of capacity bytes, a conversion that does not fit fails
+// with PNG2POS_E_WRITE (and leaves the buffer with a part of its output)
+PNG2POS_API struct png2pos* png2pos_open_buffer(struct png2pos_options options, unsigned char *buffer, size_t capacity);
+
+// new context writing its output into file (by its descriptor, nothing may be left in its stdio buffer),
+// the file is not closed by the context
+PNG2POS_API struct png2pos* png2pos_open_file(struct png2pos_options options, FILE *file);
+
+// new context writing its output into file descriptor fd (a socket, a pipe) by writev(2), fd is not closed
+// by the context; not available on Windows (returns NULL)
+PNG2POS_API struct png2pos* png2pos_open_fd(struct png2pos_options options, int fd);
+
+// converts and writes an image, PNG of size bytes in memory; returns 0 on success or PNG2POS_E_*,
+// an image that could not be converted does not affect the rest of job
+PNG2POS_API int png2pos_convert(struct png2pos *ctx, const unsigned char *png, size_t size);
+
+// the same for a PNG, PBM or PGM file, "-" is standard input
+PNG2POS_API int png2pos_convert_file(struct png2pos *ctx, const char *path);
+
+// converts and writes count files in order, with jobs > 1 by jobs threads at once; stops at the first file that fails
+// and returns 0 on success or PNG2POS_E_*; with stats, stats of each file are stored into files (if not NULL),
+// files not converted (after the failed one) are left with source 0 and failed 0
+PNG2POS_API int png2pos_convert_files(struct png2pos *ctx, const char *const *paths, unsigned int count, struct png2pos_file_stats *files);
+
+// ends the job, writes composed images, the cut and everything pending; returns 0 on success or PNG2POS_E_*
+// (PNG2POS_E_CONVERT if composed images could not be printed); the next image starts a new job
+PNG2POS_API int png2pos_finish(struct png2pos *ctx);
+
+// writes images composed so far and everything pending, without the cut, the job is not ended
+// (output of a job that failed, up to its failure); returns 0 on success or PNG2POS_E_*
+PNG2POS_API int png2pos_flush(struct png2pos *ctx);
+
+// bytes of output written so far by the callback or into the buffer
+PNG2POS_API size_t png2pos_length(const struct png2pos *ctx);
+
+// stats of the job so far
+PNG2POS_API void png2pos_job_stats(const struct png2pos *ctx, struct png2pos_job_stats *stats);
+
+// the last diagnostic message of the context, "" if there was none
+PNG2POS_API const char* png2pos_message(const struct png2pos *ctx);
+
+// closes the context, images composed and output pending since the last png2pos_finish() are thrown away
+PNG2POS_API void png2pos_close(struct png2pos *ctx);
+
+PNG2POS_API const char* png2pos_error_text(int error);
+
+// name of a stage of png2pos_file_stats, e.g. "decode", "dither"; NULL if there is no such stage
+PNG2POS_API const char* png2pos_stage_name(unsigned int stage);
+
+// PNG2POS_DITHER_* of a dithering engine name ("atkinson", "bayer4", "bayer8", "bluenoise"), -1 if unknown
+PNG2POS_API int png2pos_dither(const char *name);
+
+// PNG2POS_FIT_* of a scaling filter name ("area", "lanczos"), -1 if unknown
+PNG2POS_API int png2pos_fit(const char *name);
+
+// PNG2POS_PRINTER_* commands of a printer profile (NULL = default), -1 if there is no such profile
+PNG2POS_API int png2pos_printer(const char *printer);
+
+// Process-wide state, set up before contexts use it (not while any context is converting);
+// the reason of failure goes to diagnostic (called with user, may be NULL)
+
+// opens (creates) the cache directory of contexts with cache, max_size in bytes; returns 0 on success
+PNG2POS_API int png2pos_cache_open(const char *dir, unsigned long max_size, png2pos_diagnostic diagnostic, void *user);
+
+// hits, misses and evictions of the cache so far
+PNG2POS_API void png2pos_cache_stats(unsigned long *hits, unsigned long *misses, unsigned long *evictions);
+
+// maps an input file onto a key of printer memory, spec is KEY:FILE (two characters, ':' and file name),
+// spec has to stay valid while graphics are used; returns 0 on success
+PNG2POS_API int png2pos_graphics_key(const char *spec, png2pos_diagnostic diagnostic, void *user);
+
+// loads the record of graphics kept in printer memory 'N' (NV) or 'D' (download), a missing file is an empty
+// record; returns 0 on success
+PNG2POS_API int png2pos_graphics_open(const char *path, char memory, png2pos_diagnostic diagnostic, void *user);
+
+// writes the record back if graphics have been sent to the printer since; returns 0 on success
+PNG2POS_API int png2pos_graphics_save(png2pos_diagnostic diagnostic, void *user);
+
+PNG2POS_API const char* png2pos_version(void);
+
+// conversion kernel chosen for this CPU
+PNG2POS_API const char* png2pos_kernel(void);
+
+#endif
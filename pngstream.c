@@ -0,0 +1,741 @@
+/*!
+(c) 2012 - 2015 Petr Kutalek: png2pos
+
+Licensed under the MIT License, see png2pos.c
+*/
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pngstream.h"
+
+// inflate modes
+#define MODE_HEADER 0
+#define MODE_STORED 1
+#define MODE_CODES 2
+#define MODE_DONE 3
+
+static const unsigned char PNG_SIGNATURE[8] = {
+    0x89, 0x50, 0x4e, 0x47, 0x0d, 0x0a, 0x1a, 0x0a
+};
+
+// RFC 1951, 3.2.5
+static const unsigned short LEN_BASE[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const unsigned char LEN_EXTRA[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const unsigned short DIST_BASE[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const unsigned char DIST_EXTRA[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+// RFC 1951, 3.2.7, order of code length code lengths
+static const unsigned char CL_ORDER[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+static unsigned long read32(const unsigned char *p) {
+    return (unsigned long)p[0] << 24 | (unsigned long)p[1] << 16 | (unsigned long)p[2] << 8 | p[3];
+}
+
+// next byte of zlib stream, chunk boundaries are crossed transparently
+static int next_byte(struct pngstream *s) {
+    if (s->inpos == s->inlen) {
+        while (s->chunk_left == 0) {
+            unsigned char hdr[12];
+            // CRC of previous chunk + length + type of the next one
+            if (s->idat_end || fread(hdr, 1, 12, s->in) != 12 || memcmp(&hdr[8], "IDAT", 4) != 0) {
+                s->idat_end = 1;
+                return -1;
+            }
+            s->chunk_left = read32(&hdr[4]);
+        }
+        const unsigned long n = s->chunk_left < sizeof(s->inbuf) ? s->chunk_left : sizeof(s->inbuf);
+        if (fread(s->inbuf, 1, n, s->in) != n) {
+            s->idat_end = 1;
+            return -1;
+        }
+        s->chunk_left -= n;
+        s->inpos = 0;
+        s->inlen = n;
+    }
+    return s->inbuf[s->inpos++];
+}
+
+// ensures there are at least n bits in the bit buffer, pads with zeroes past the end of data
+static void need(struct pngstream *s, const unsigned int n) {
+    while (s->bitcnt < n) {
+        int c = next_byte(s);
+        if (c < 0) {
+            c = 0;
+            ++s->overrun;
+        }
+        s->bitbuf |= (unsigned long)c << s->bitcnt;
+        s->bitcnt += 8;
+    }
+}
+
+static unsigned int bits(struct pngstream *s, const unsigned int n) {
+    need(s, n);
+    const unsigned int v = s->bitbuf & ((1ul << n) - 1);
+    s->bitbuf >>= n;
+    s->bitcnt -= n;
+    return v;
+}
+
+// builds canonical Huffman code from code lengths, returns non-zero for over-subscribed sets
+static int construct(struct pngstream_huffman *h, const unsigned char *length, const unsigned int n) {
+    short offs[16];
+
+    memset(h->count, 0, sizeof(h->count));
+    for (unsigned int i = 0; i != n; ++i) {
+        ++h->count[length[i]];
+    }
+    if (h->count[0] == n) {
+        // no codes at all, complete but decoding will fail
+        memset(h->fast, 0, sizeof(h->fast));
+        return 0;
+    }
+
+    int left = 1;
+    for (unsigned int len = 1; len != 16; ++len) {
+        left <<= 1;
+        left -= h->count[len];
+        if (left < 0) {
+            return 1;
+        }
+    }
+
+    offs[1] = 0;
+    for (unsigned int len = 1; len != 15; ++len) {
+        offs[len + 1] = offs[len] + h->count[len];
+    }
+    for (unsigned int i = 0; i != n; ++i) {
+        if (length[i] != 0) {
+            h->symbol[offs[length[i]]++] = i;
+        }
+    }
+
+    // lookup table indexed by next PNGSTREAM_FAST_BITS (bit-reversed) input bits
+    memset(h->fast, 0, sizeof(h->fast));
+    unsigned int code = 0;
+    unsigned int index = 0;
+    for (unsigned int len = 1; len <= PNGSTREAM_FAST_BITS; ++len) {
+        for (int k = 0; k != h->count[len]; ++k) {
+            unsigned int rev = 0;
+            for (unsigned int b = 0; b != len; ++b) {
+                rev |= ((code >> b) & 1) << (len - 1 - b);
+            }
+            for (unsigned int j = rev; j < (1u << PNGSTREAM_FAST_BITS); j += 1u << len) {
+                h->fast[j] = len << 9 | h->symbol[index];
+            }
+            ++code;
+            ++index;
+        }
+        code <<= 1;
+    }
+    return 0;
+}
+
+static int decode(struct pngstream *s, const struct pngstream_huffman *h) {
+    need(s, 15);
+    const unsigned int entry = h->fast[s->bitbuf & ((1u << PNGSTREAM_FAST_BITS) - 1)];
+    if (entry != 0) {
+        s->bitbuf >>= entry >> 9;
+        s->bitcnt -= entry >> 9;
+        return entry & 0x1ff;
+    }
+
+    // slow path, bit by bit
+    int code = 0;
+    int first = 0;
+    int index = 0;
+    for (unsigned int len = 1; len != 16; ++len) {
+        code |= s->bitbuf & 1;
+        s->bitbuf >>= 1;
+        --s->bitcnt;
+        const int count = h->count[len];
+        if (code - count < first) {
+            return h->symbol[index + (code - first)];
+        }
+        index += count;
+        first += count;
+        first <<= 1;
+        code <<= 1;
+    }
+    return -1;
+}
+
+static unsigned int fixed_tables(struct pngstream *s) {
+    unsigned char lengths[288];
+    unsigned int i = 0;
+    for (; i != 144; ++i) {
+        lengths[i] = 8;
+    }
+    for (; i != 256; ++i) {
+        lengths[i] = 9;
+    }
+    for (; i != 280; ++i) {
+        lengths[i] = 7;
+    }
+    for (; i != 288; ++i) {
+        lengths[i] = 8;
+    }
+    construct(&s->lencode, lengths, 288);
+    for (i = 0; i != 30; ++i) {
+        lengths[i] = 5;
+    }
+    construct(&s->distcode, lengths, 30);
+    return 0;
+}
+
+static unsigned int dynamic_tables(struct pngstream *s) {
+    unsigned char lengths[320];
+
+    const unsigned int nlen = bits(s, 5) + 257;
+    const unsigned int ndist = bits(s, 5) + 1;
+    const unsigned int ncode = bits(s, 4) + 4;
+    if (nlen > 286 || ndist > 30) {
+        return PNGSTREAM_E_DEFLATE;
+    }
+
+    memset(lengths, 0, 19);
+    for (unsigned int i = 0; i != ncode; ++i) {
+        lengths[CL_ORDER[i]] = bits(s, 3);
+    }
+    if (construct(&s->lencode, lengths, 19) != 0) {
+        return PNGSTREAM_E_DEFLATE;
+    }
+
+    for (unsigned int i = 0; i < nlen + ndist; ) {
+        int symbol = decode(s, &s->lencode);
+        if (symbol < 0) {
+            return PNGSTREAM_E_DEFLATE;
+        }
+        if (symbol < 16) {
+            lengths[i++] = symbol;
+            continue;
+        }
+        unsigned int len = 0;
+        unsigned int rep = 0;
+        if (symbol == 16) {
+            if (i == 0) {
+                return PNGSTREAM_E_DEFLATE;
+            }
+            len = lengths[i - 1];
+            rep = 3 + bits(s, 2);
+        } else if (symbol == 17) {
+            rep = 3 + bits(s, 3);
+        } else {
+            rep = 11 + bits(s, 7);
+        }
+        if (i + rep > nlen + ndist) {
+            return PNGSTREAM_E_DEFLATE;
+        }
+        while (rep--) {
+            lengths[i++] = len;
+        }
+    }
+
+    if (lengths[256] == 0
+            || construct(&s->lencode, lengths, nlen) != 0
+            || construct(&s->distcode, lengths + nlen, ndist) != 0) {
+        return PNGSTREAM_E_DEFLATE;
+    }
+    return 0;
+}
+
+// inflates exactly n bytes
+static unsigned int inflate_read(struct pngstream *s, unsigned char *out, const unsigned int n) {
+    const unsigned int WMASK = PNGSTREAM_WINDOW - 1;
+    unsigned int i = 0;
+
+    while (i != n) {
+        if (s->copy_len != 0) {
+            // pending match
+            unsigned int len = s->copy_len;
+            if (len > n - i) {
+                len = n - i;
+            }
+            s->copy_len -= len;
+            while (len--) {
+                const unsigned char c = s->window[(s->total - s->copy_dist) & WMASK];
+                s->window[s->total++ & WMASK] = c;
+                out[i++] = c;
+            }
+            continue;
+        }
+
+        switch (s->mode) {
+            case MODE_HEADER: {
+                s->last = bits(s, 1);
+                const unsigned int type = bits(s, 2);
+                if (type == 0) {
+                    // stored block, skip to byte boundary
+                    s->bitbuf >>= s->bitcnt & 7;
+                    s->bitcnt -= s->bitcnt & 7;
+                    const unsigned int len = bits(s, 16);
+                    const unsigned int nlen = bits(s, 16);
+                    if (len != (~nlen & 0xffff)) {
+                        return PNGSTREAM_E_DEFLATE;
+                    }
+                    s->stored_left = len;
+                    s->mode = MODE_STORED;
+                } else if (type == 1) {
+                    fixed_tables(s);
+                    s->mode = MODE_CODES;
+                } else if (type == 2) {
+                    const unsigned int error = dynamic_tables(s);
+                    if (error) {
+                        return error;
+                    }
+                    s->mode = MODE_CODES;
+                } else {
+                    return PNGSTREAM_E_DEFLATE;
+                }
+                break;
+            }
+
+            case MODE_STORED:
+                while (s->stored_left != 0 && i != n) {
+                    const unsigned char c = bits(s, 8);
+                    s->window[s->total++ & WMASK] = c;
+                    out[i++] = c;
+                    --s->stored_left;
+                }
+                if (s->stored_left == 0) {
+                    s->mode = s->last ? MODE_DONE : MODE_HEADER;
+                }
+                break;
+
+            case MODE_CODES:
+                while (i != n) {
+                    int symbol = decode(s, &s->lencode);
+                    if (symbol < 0) {
+                        return PNGSTREAM_E_DEFLATE;
+                    }
+                    if (symbol < 256) {
+                        s->window[s->total++ & WMASK] = symbol;
+                        out[i++] = symbol;
+                        continue;
+                    }
+                    if (symbol == 256) {
+                        s->mode = s->last ? MODE_DONE : MODE_HEADER;
+                        break;
+                    }
+                    symbol -= 257;
+                    if (symbol >= 29) {
+                        return PNGSTREAM_E_DEFLATE;
+                    }
+                    const unsigned int len = LEN_BASE[symbol] + bits(s, LEN_EXTRA[symbol]);
+                    const int dsymbol = decode(s, &s->distcode);
+                    if (dsymbol < 0 || dsymbol >= 30) {
+                        return PNGSTREAM_E_DEFLATE;
+                    }
+                    const unsigned int dist = DIST_BASE[dsymbol] + bits(s, DIST_EXTRA[dsymbol]);
+                    if (dist > s->total) {
+                        return PNGSTREAM_E_DEFLATE;
+                    }
+                    s->copy_len = len;
+                    s->copy_dist = dist;
+                    break;
+                }
+                break;
+
+            default:
+                // end of zlib stream reached prematurely
+                return PNGSTREAM_E_TRUNCATED;
+        }
+    }
+
+    if (s->overrun * 8 > s->bitcnt) {
+        return PNGSTREAM_E_TRUNCATED;
+    }
+    return 0;
+}
+
+// reads up to the end of the final block and verifies checksum of zlib stream
+static unsigned int finish(struct pngstream *s) {
+    if (s->mode != MODE_DONE) {
+        unsigned char c = 0;
+        const unsigned int error = inflate_read(s, &c, 1);
+        if (error == 0) {
+            // superfluous data after the last scanline are ignored
+            return 0;
+        }
+        if (s->mode != MODE_DONE) {
+            return error;
+        }
+    }
+
+    s->bitbuf >>= s->bitcnt & 7;
+    s->bitcnt -= s->bitcnt & 7;
+    unsigned long adler = 0;
+    for (unsigned int i = 0; i != 4; ++i) {
+        adler = adler << 8 | bits(s, 8);
+    }
+    if (s->overrun * 8 > s->bitcnt) {
+        return PNGSTREAM_E_TRUNCATED;
+    }
+    if (adler != (s->adler_b << 16 | s->adler_a)) {
+        return PNGSTREAM_E_ADLER32;
+    }
+    return 0;
+}
+
+static unsigned int paeth(const int a, const int b, const int c) {
+    const int p = a + b - c;
+    const int pa = abs(p - a);
+    const int pb = abs(p - b);
+    const int pc = abs(p - c);
+    if (pa <= pb && pa <= pc) {
+        return a;
+    }
+    return pb <= pc ? b : c;
+}
+
+static unsigned int unfilter(unsigned char *line, const unsigned char *prev, const unsigned int length, const unsigned int bpp) {
+    unsigned char *x = line + 1;
+    const unsigned char *b = prev + 1;
+    switch (line[0]) {
+        case 0:
+            break;
+
+        case 1:
+            for (unsigned int i = bpp; i < length; ++i) {
+                x[i] += x[i - bpp];
+            }
+            break;
+
+        case 2:
+            for (unsigned int i = 0; i != length; ++i) {
+                x[i] += b[i];
+            }
+            break;
+
+        case 3:
+            for (unsigned int i = 0; i != length; ++i) {
+                x[i] += ((i < bpp ? 0 : x[i - bpp]) + b[i]) >> 1;
+            }
+            break;
+
+        case 4:
+            for (unsigned int i = 0; i != length; ++i) {
+                x[i] += i < bpp ? b[i] : paeth(x[i - bpp], b[i], b[i - bpp]);
+            }
+            break;
+
+        default:
+            return PNGSTREAM_E_FILTER;
+    }
+    return 0;
+}
+
+// scanline → RGBA, mirrors lodepng's color conversion
+static void to_rgba(const struct pngstream *s, unsigned char *rgba, const unsigned char *x) {
+    const unsigned int w = s->width;
+    const unsigned int bd = s->bitdepth;
+
+    switch (s->colortype) {
+        case 0:
+            for (unsigned int i = 0; i != w; ++i, rgba += 4) {
+                unsigned int v = 0;
+                unsigned int key = 0;
+                if (bd == 16) {
+                    key = x[i << 1] << 8 | x[(i << 1) | 1];
+                    v = x[i << 1];
+                } else if (bd == 8) {
+                    v = key = x[i];
+                } else {
+                    const unsigned int bit = i * bd;
+                    key = (x[bit >> 3] >> (8 - bd - (bit & 7))) & ((1u << bd) - 1);
+                    v = key * 255 / ((1u << bd) - 1);
+                }
+                rgba[0] = rgba[1] = rgba[2] = v;
+                rgba[3] = s->key_defined && key == s->key_r ? 0 : 255;
+            }
+            break;
+
+        case 2:
+            for (unsigned int i = 0; i != w; ++i, rgba += 4) {
+                if (bd == 8) {
+                    rgba[0] = x[i * 3];
+                    rgba[1] = x[i * 3 + 1];
+                    rgba[2] = x[i * 3 + 2];
+                    rgba[3] = s->key_defined && rgba[0] == s->key_r && rgba[1] == s->key_g && rgba[2] == s->key_b ? 0 : 255;
+                } else {
+                    const unsigned char *p = &x[i * 6];
+                    rgba[0] = p[0];
+                    rgba[1] = p[2];
+                    rgba[2] = p[4];
+                    rgba[3] = s->key_defined
+                        && (unsigned int)(p[0] << 8 | p[1]) == s->key_r
+                        && (unsigned int)(p[2] << 8 | p[3]) == s->key_g
+                        && (unsigned int)(p[4] << 8 | p[5]) == s->key_b ? 0 : 255;
+                }
+            }
+            break;
+
+        case 3:
+            for (unsigned int i = 0; i != w; ++i, rgba += 4) {
+                unsigned int index = 0;
+                if (bd == 8) {
+                    index = x[i];
+                } else {
+                    const unsigned int bit = i * bd;
+                    index = (x[bit >> 3] >> (8 - bd - (bit & 7))) & ((1u << bd) - 1);
+                }
+                if (index >= s->palettesize) {
+                    // out of range index is black, as in lodepng
+                    rgba[0] = rgba[1] = rgba[2] = 0;
+                    rgba[3] = 255;
+                } else {
+                    memcpy(rgba, &s->palette[index << 2], 4);
+                }
+            }
+            break;
+
+        case 4:
+            for (unsigned int i = 0; i != w; ++i, rgba += 4) {
+                const unsigned int step = bd == 8 ? 2 : 4;
+                rgba[0] = rgba[1] = rgba[2] = x[i * step];
+                rgba[3] = x[i * step + step / 2];
+            }
+            break;
+
+        case 6:
+            if (bd == 8) {
+                memcpy(rgba, x, w << 2);
+            } else {
+                for (unsigned int i = 0; i != w << 2; ++i) {
+                    rgba[i] = x[i << 1];
+                }
+            }
+            break;
+    }
+}
+
+unsigned int pngstream_open(struct pngstream *s, FILE *in) {
+    unsigned char buffer[13];
+
+    memset(s, 0, offsetof(struct pngstream, window));
+    s->in = in;
+
+    if (fread(buffer, 1, 8, in) != 8) {
+        return PNGSTREAM_E_READ;
+    }
+    if (memcmp(buffer, PNG_SIGNATURE, 8) != 0) {
+        return PNGSTREAM_E_SIGNATURE;
+    }
+
+    unsigned int interlace = 0;
+    for (unsigned int first = 1; ; first = 0) {
+        unsigned char hdr[8];
+        if (fread(hdr, 1, 8, in) != 8) {
+            return PNGSTREAM_E_READ;
+        }
+        unsigned long length = read32(hdr);
+
+        if (first && (memcmp(&hdr[4], "IHDR", 4) != 0 || length != 13)) {
+            return PNGSTREAM_E_HEADER;
+        }
+
+        if (memcmp(&hdr[4], "IDAT", 4) == 0) {
+            s->chunk_left = length;
+            break;
+        }
+
+        if (memcmp(&hdr[4], "IHDR", 4) == 0 && length == 13) {
+            if (fread(buffer, 1, 13, in) != 13) {
+                return PNGSTREAM_E_READ;
+            }
+            s->width = read32(buffer);
+            s->height = read32(&buffer[4]);
+            s->bitdepth = buffer[8];
+            s->colortype = buffer[9];
+            interlace = buffer[12];
+            length = 0;
+        } else if (memcmp(&hdr[4], "PLTE", 4) == 0 && length <= 768 && length % 3 == 0) {
+            s->palettesize = length / 3;
+            for (unsigned int i = 0; i != s->palettesize; ++i) {
+                if (fread(&s->palette[i << 2], 1, 3, in) != 3) {
+                    return PNGSTREAM_E_READ;
+                }
+                s->palette[(i << 2) | 3] = 255;
+            }
+            length = 0;
+        } else if (memcmp(&hdr[4], "tRNS", 4) == 0) {
+            if (s->colortype == 3) {
+                if (length > s->palettesize) {
+                    return PNGSTREAM_E_PALETTE;
+                }
+                for (unsigned int i = 0; i != length; ++i) {
+                    const int c = fgetc(in);
+                    if (c == EOF) {
+                        return PNGSTREAM_E_READ;
+                    }
+                    s->palette[(i << 2) | 3] = c;
+                }
+                length = 0;
+            } else if ((s->colortype == 0 && length == 2) || (s->colortype == 2 && length == 6)) {
+                unsigned char key[6];
+                if (fread(key, 1, length, in) != length) {
+                    return PNGSTREAM_E_READ;
+                }
+                s->key_defined = 1;
+                s->key_r = s->key_g = s->key_b = key[0] << 8 | key[1];
+                if (length == 6) {
+                    s->key_g = key[2] << 8 | key[3];
+                    s->key_b = key[4] << 8 | key[5];
+                }
+                length = 0;
+            }
+        }
+
+        // skip rest of chunk and CRC, input may be a pipe
+        for (length += 4; length != 0; --length) {
+            if (fgetc(in) == EOF) {
+                return PNGSTREAM_E_READ;
+            }
+        }
+    }
+
+    const unsigned int bd = s->bitdepth;
+    unsigned int channels = 0;
+    switch (s->colortype) {
+        case 0:
+            channels = 1;
+            if (bd != 1 && bd != 2 && bd != 4 && bd != 8 && bd != 16) {
+                return PNGSTREAM_E_HEADER;
+            }
+            break;
+        case 3:
+            channels = 1;
+            if (bd != 1 && bd != 2 && bd != 4 && bd != 8) {
+                return PNGSTREAM_E_HEADER;
+            }
+            if (s->palettesize == 0) {
+                return PNGSTREAM_E_PALETTE;
+            }
+            break;
+        case 2:
+        case 4:
+        case 6:
+            channels = s->colortype == 2 ? 3 : s->colortype == 4 ? 2 : 4;
+            if (bd != 8 && bd != 16) {
+                return PNGSTREAM_E_HEADER;
+            }
+            break;
+        default:
+            return PNGSTREAM_E_HEADER;
+    }
+    if (s->width == 0 || s->height == 0) {
+        return PNGSTREAM_E_HEADER;
+    }
+    if (interlace != 0) {
+        return PNGSTREAM_E_INTERLACED;
+    }
+
+    s->linebytes = ((unsigned long)s->width * channels * bd + 7) >> 3;
+    s->bpp = (channels * bd + 7) >> 3;
+    s->line = (unsigned char *)calloc(s->linebytes + 1, 1);
+    s->prev = (unsigned char *)calloc(s->linebytes + 1, 1);
+    if (!s->line || !s->prev) {
+        return PNGSTREAM_E_MEMORY;
+    }
+
+    // zlib header, RFC 1950
+    const unsigned int cmf = bits(s, 8);
+    const unsigned int flg = bits(s, 8);
+    if ((cmf & 0x0f) != 8 || (cmf >> 4) > 7 || (cmf << 8 | flg) % 31 != 0 || (flg & 0x20) != 0) {
+        return PNGSTREAM_E_ZLIB;
+    }
+
+    s->mode = MODE_HEADER;
+    s->adler_a = 1;
+    s->adler_b = 0;
+    return 0;
+}
+
+unsigned int pngstream_read(struct pngstream *s, unsigned char *rgba, const unsigned int n) {
+    for (unsigned int r = 0; r != n; ++r) {
+        if (s->row == s->height) {
+            return PNGSTREAM_E_TRUNCATED;
+        }
+
+        unsigned int error = inflate_read(s, s->line, s->linebytes + 1);
+        if (error) {
+            return error;
+        }
+
+        // running Adler-32 of inflated data
+        for (unsigned int i = 0; i <= s->linebytes; i += 5552) {
+            const unsigned int end = i + 5552 < s->linebytes + 1 ? i + 5552 : s->linebytes + 1;
+            for (unsigned int j = i; j != end; ++j) {
+                s->adler_a += s->line[j];
+                s->adler_b += s->adler_a;
+            }
+            s->adler_a %= 65521;
+            s->adler_b %= 65521;
+        }
+
+        error = unfilter(s->line, s->prev, s->linebytes, s->bpp);
+        if (error) {
+            return error;
+        }
+        to_rgba(s, &rgba[(unsigned long)r * s->width * 4], s->line + 1);
+
+        unsigned char *t = s->prev;
+        s->prev = s->line;
+        s->line = t;
+
+        if (++s->row == s->height) {
+            error = finish(s);
+            if (error) {
+                return error;
+            }
+        }
+    }
+    return 0;
+}
+
+void pngstream_close(struct pngstream *s) {
+    free(s->line), s->line = NULL;
+    free(s->prev), s->prev = NULL;
+}
+
+const char* pngstream_error_text(const unsigned int error) {
+    switch (error) {
+        case PNGSTREAM_E_READ:
+            return "unexpected end of file";
+        case PNGSTREAM_E_SIGNATURE:
+            return "not a PNG file";
+        case PNGSTREAM_E_HEADER:
+            return "invalid IHDR chunk";
+        case PNGSTREAM_E_INTERLACED:
+            return "interlaced images can not be streamed";
+        case PNGSTREAM_E_PALETTE:
+            return "invalid or missing palette";
+        case PNGSTREAM_E_ZLIB:
+            return "invalid zlib header";
+        case PNGSTREAM_E_DEFLATE:
+            return "invalid deflate data";
+        case PNGSTREAM_E_FILTER:
+            return "invalid scanline filter type";
+        case PNGSTREAM_E_TRUNCATED:
+            return "image data are truncated";
+        case PNGSTREAM_E_MEMORY:
+            return "could not allocate enough memory";
+        case PNGSTREAM_E_ADLER32:
+            return "Adler-32 checksum mismatch";
+    }
+    return "unknown error";
+}
@@ -0,0 +1,102 @@
+/*!
+(c) 2012 - 2015 Petr Kutalek: png2pos
+
+Licensed under the MIT License, see png2pos.c
+*/
+
+#ifndef PNGSTREAM_H
+#define PNGSTREAM_H
+
+#include <stdio.h>
+
+// Incremental PNG decoder: inflates and unfilters IDAT data scanline by scanline,
+// so only a 32 KiB LZ77 window and two scanlines are held in memory.
+// Rows are returned as RGBA 8 bit, exactly as lodepng_decode32 would produce them.
+// Interlaced (Adam7) images cannot be streamed, PNGSTREAM_E_INTERLACED is returned
+// by pngstream_open and the caller has to fall back to a full decode.
+
+#define PNGSTREAM_WINDOW 32768u
+
+// error codes
+#define PNGSTREAM_E_READ 1
+#define PNGSTREAM_E_SIGNATURE 2
+#define PNGSTREAM_E_HEADER 3
+#define PNGSTREAM_E_INTERLACED 4
+#define PNGSTREAM_E_PALETTE 5
+#define PNGSTREAM_E_ZLIB 6
+#define PNGSTREAM_E_DEFLATE 7
+#define PNGSTREAM_E_FILTER 8
+#define PNGSTREAM_E_TRUNCATED 9
+#define PNGSTREAM_E_MEMORY 10
+#define PNGSTREAM_E_ADLER32 11
+
+// canonical Huffman code, with a lookup table for codes up to PNGSTREAM_FAST_BITS long
+#define PNGSTREAM_FAST_BITS 9
+struct pngstream_huffman {
+    short count[16];
+    short symbol[288];
+    unsigned short fast[1 << PNGSTREAM_FAST_BITS];
+};
+
+struct pngstream {
+    FILE *in;
+
+    // IHDR
+    unsigned int width;
+    unsigned int height;
+    unsigned int bitdepth;
+    unsigned int colortype;
+
+    // PLTE + tRNS
+    unsigned char palette[256 * 4];
+    unsigned int palettesize;
+    unsigned int key_defined;
+    unsigned int key_r;
+    unsigned int key_g;
+    unsigned int key_b;
+
+    // IDAT reader
+    unsigned char inbuf[4096];
+    unsigned int inpos;
+    unsigned int inlen;
+    unsigned long chunk_left;
+    unsigned int idat_end;
+    unsigned int overrun;
+    unsigned long bitbuf;
+    unsigned int bitcnt;
+
+    // inflate state
+    unsigned int mode;
+    unsigned int last;
+    unsigned long stored_left;
+    unsigned int copy_len;
+    unsigned int copy_dist;
+    unsigned long total;
+    unsigned long adler_a;
+    unsigned long adler_b;
+    struct pngstream_huffman lencode;
+    struct pngstream_huffman distcode;
+
+    // scanlines (filter type byte + data)
+    unsigned char *line;
+    unsigned char *prev;
+    unsigned int linebytes;
+    unsigned int bpp;
+    unsigned int row;
+
+    // LZ77 sliding window, has to be the last member (it is not cleared by pngstream_open)
+    unsigned char window[PNGSTREAM_WINDOW];
+};
+
+// reads PNG header and chunks up to the first IDAT
+unsigned int pngstream_open(struct pngstream *s, FILE *in);
+
+// decodes next n rows into RGBA buffer (4 × width × n bytes)
+unsigned int pngstream_read(struct pngstream *s, unsigned char *rgba, unsigned int n);
+
+// releases scanline buffers, input stream is left open
+void pngstream_close(struct pngstream *s);
+
+const char* pngstream_error_text(unsigned int error);
+
+#endif
@@ -0,0 +1,191 @@
+/*!
+(c) 2012 - 2015 Petr Kutalek: png2pos
+
+Licensed under the MIT License, see png2pos.c
+*/
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pnm.h"
+#include "pool.h"
+
+// images are held in memory as a whole, sizes are kept in unsigned int
+#define PNM_MAX_SIZE 0x7fffffffu
+
+// raw image of unknown height is read in chunks of about this size
+#define PNM_CHUNK 65536u
+
+unsigned int pnm_format(const unsigned char *magic) {
+    if (magic[0] != 'P') {
+        return 0;
+    }
+    switch (magic[1]) {
+        case '4':
+            return PNM_PBM;
+        case '5':
+            return PNM_PGM;
+    }
+    return 0;
+}
+
+// next header number, preceded by whitespace and comments
+static unsigned int header_number(FILE *in, unsigned long *value) {
+    int c = getc(in);
+    for (;;) {
+        if (c == '#') {
+            while (c != '\n' && c != '\r' && c != EOF) {
+                c = getc(in);
+            }
+        } else if (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f') {
+            c = getc(in);
+        } else {
+            break;
+        }
+    }
+    if (c < '0' || c > '9') {
+        return c == EOF ? PNM_E_READ : PNM_E_HEADER;
+    }
+
+    unsigned long n = 0;
+    for (; c >= '0' && c <= '9'; c = getc(in)) {
+        n = n * 10 + (c - '0');
+        if (n > PNM_MAX_SIZE) {
+            return PNM_E_SIZE;
+        }
+    }
+    // a single whitespace character ends the number, the last one of header is followed by raster
+    if (c != ' ' && c != '\t' && c != '\n' && c != '\r' && c != '\v' && c != '\f') {
+        return c == EOF ? PNM_E_READ : PNM_E_HEADER;
+    }
+    *value = n;
+    return 0;
+}
+
+unsigned int pnm_open(struct pnm *p, FILE *in, const unsigned int format, const unsigned int width, const unsigned int height) {
+    unsigned int error = 0;
+    unsigned long w = width;
+    unsigned long h = height;
+    unsigned long maxval = 1;
+
+    memset(p, 0, sizeof(struct pnm));
+    p->in = in;
+    p->format = format;
+
+    if (format != PNM_RAW) {
+        if ((error = header_number(in, &w)) != 0 || (error = header_number(in, &h)) != 0) {
+            return error;
+        }
+        if (format == PNM_PGM && (error = header_number(in, &maxval)) != 0) {
+            return error;
+        }
+        if (h == 0) {
+            return PNM_E_HEADER;
+        }
+    }
+    if (w == 0 || maxval == 0) {
+        return PNM_E_HEADER;
+    }
+    if (maxval > 255) {
+        return PNM_E_DEPTH;
+    }
+
+    p->width = w;
+    p->height = h;
+    p->maxval = maxval;
+    p->linebytes = format == PNM_PGM ? w : (w + 7) >> 3;
+    if (h > PNM_MAX_SIZE / p->linebytes) {
+        return PNM_E_SIZE;
+    }
+    return 0;
+}
+
+unsigned int pnm_load(struct pnm *p, unsigned char **rows) {
+    const size_t linebytes = p->linebytes;
+    size_t size = (size_t)linebytes * p->height;
+    unsigned char *buffer = NULL;
+
+    if (p->height != 0) {
+        buffer = (unsigned char *)pool_alloc(size);
+        if (!buffer) {
+            return PNM_E_MEMORY;
+        }
+        if (fread(buffer, 1, size, p->in) != size) {
+            pool_free(buffer);
+            return PNM_E_TRUNCATED;
+        }
+    } else {
+        // rows are read up to the end of input, buffer grows by whole rows
+        const size_t chunk = (PNM_CHUNK + linebytes - 1) / linebytes * linebytes;
+        size_t capacity = 0;
+        for (;;) {
+            if (size == capacity) {
+                if (capacity > PNM_MAX_SIZE - chunk) {
+                    pool_free(buffer);
+                    return PNM_E_SIZE;
+                }
+                capacity += capacity < chunk ? chunk : capacity;
+                unsigned char *b = (unsigned char *)pool_realloc(buffer, capacity);
+                if (!b) {
+                    pool_free(buffer);
+                    return PNM_E_MEMORY;
+                }
+                buffer = b;
+            }
+            const size_t n = fread(&buffer[size], 1, capacity - size, p->in);
+            size += n;
+            if (n == 0) {
+                break;
+            }
+        }
+        if (size == 0 || size % linebytes != 0) {
+            pool_free(buffer);
+            return PNM_E_TRUNCATED;
+        }
+        p->height = size / linebytes;
+    }
+    if (ferror(p->in)) {
+        pool_free(buffer);
+        return PNM_E_READ;
+    }
+
+    if (p->format == PNM_PGM && p->maxval != 255) {
+        unsigned char scale[256];
+        for (unsigned int i = 0; i != 256; ++i) {
+            scale[i] = i >= p->maxval ? 255 : (i * 255 + (p->maxval >> 1)) / p->maxval;
+        }
+        for (size_t i = 0; i != size; ++i) {
+            buffer[i] = scale[buffer[i]];
+        }
+    }
+
+    // bits beyond the width are not specified by PBM
+    const unsigned int pad = (linebytes << 3) - p->width;
+    if (p->format != PNM_PGM && pad != 0) {
+        const unsigned char mask = 0xff << pad;
+        for (size_t i = linebytes - 1; i < size; i += linebytes) {
+            buffer[i] &= mask;
+        }
+    }
+
+    *rows = buffer;
+    return 0;
+}
+
+const char* pnm_error_text(const unsigned int error) {
+    switch (error) {
+        case PNM_E_READ:
+            return "unexpected end of file";
+        case PNM_E_HEADER:
+            return "invalid PBM/PGM header";
+        case PNM_E_DEPTH:
+            return "only 8-bit PGM images are supported";
+        case PNM_E_SIZE:
+            return "image is too large";
+        case PNM_E_TRUNCATED:
+            return "image data are truncated";
+        case PNM_E_MEMORY:
+            return "could not allocate enough memory";
+    }
+    return "unknown error";
+}
@@ -0,0 +1,53 @@
+/*!
+(c) 2012 - 2015 Petr Kutalek: png2pos
+
+Licensed under the MIT License, see png2pos.c
+*/
+
+#ifndef PNM_H
+#define PNM_H
+
+#include <stdio.h>
+
+// Reader of binary PBM (P4) and PGM (P5) images and of raw 1-bit rasters of a given size.
+// PBM and raw rows are packed MSB first, 1 is black and every row is padded to a whole byte,
+// which is exactly the layout of png2pos bitmaps: they are read straight into it, nothing is decoded.
+// PGM rows are 8-bit grey levels scaled to 0..255, 16-bit PGM is not supported.
+
+// formats
+#define PNM_PBM 1
+#define PNM_PGM 2
+#define PNM_RAW 3
+
+// error codes
+#define PNM_E_READ 1
+#define PNM_E_HEADER 2
+#define PNM_E_DEPTH 3
+#define PNM_E_SIZE 4
+#define PNM_E_TRUNCATED 5
+#define PNM_E_MEMORY 6
+
+struct pnm {
+    FILE *in;
+    unsigned int format;
+    unsigned int width;
+    // raw image of height 0 is read up to the end of input
+    unsigned int height;
+    unsigned int maxval;
+    // bytes of one row
+    unsigned int linebytes;
+};
+
+// format of an image starting with the two given bytes, 0 if it is not a binary PBM or PGM
+unsigned int pnm_format(const unsigned char *magic);
+
+// reads the rest of PBM/PGM header, magic number has already been read;
+// raw images have no header, their width and height are given instead
+unsigned int pnm_open(struct pnm *p, FILE *in, unsigned int format, unsigned int width, unsigned int height);
+
+// reads all rows into a new buffer of height × linebytes bytes (pool.h), unused bits of PBM and raw rows are cleared
+unsigned int pnm_load(struct pnm *p, unsigned char **rows);
+
+const char* pnm_error_text(unsigned int error);
+
+#endif
@@ -0,0 +1,279 @@
+/*!
+(c) 2012 - 2015 Petr Kutalek: png2pos
+
+Licensed under the MIT License, see png2pos.c
+*/
+
+#ifndef _WIN32
+// MAP_ANONYMOUS
+#define _DEFAULT_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "pool.h"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+// header in front of each buffer, padded, so that buffers are aligned as malloc would align them
+#define POOL_HEADER 64u
+
+struct pool_block {
+    // bytes usable and bytes requested
+    size_t capacity;
+    size_t size;
+    // mapped by block_new, not allocated by malloc
+    unsigned int mapped;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    struct pool_block *kept[POOL_KEEP];
+    unsigned int keptcnt;
+    // bytes of kept buffers
+    unsigned long keptsize;
+    // users that opened the pool
+    unsigned int users;
+    // bytes of all buffers, in use and kept
+    unsigned long held;
+    unsigned long peak;
+    unsigned long reused;
+} pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .keptcnt = 0,
+    .keptsize = 0,
+    .users = 0,
+    .held = 0,
+    .peak = 0,
+    .reused = 0
+};
+
+static void* block_data(struct pool_block *b) {
+    return (unsigned char *)b + POOL_HEADER;
+}
+
+static struct pool_block* block_of(void *ptr) {
+    return (struct pool_block *)((unsigned char *)ptr - POOL_HEADER);
+}
+
+// buffers that may be kept are mapped on their own, so that their pages go back to the system once they are
+// released (malloc keeps freed memory in arenas of threads that used it)
+static struct pool_block* block_new(const size_t size) {
+    struct pool_block *b = NULL;
+#ifdef MAP_ANONYMOUS
+    if (size >= POOL_MIN_SIZE) {
+        void *p = mmap(NULL, POOL_HEADER + size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            return NULL;
+        }
+        b = (struct pool_block *)p;
+        b->mapped = 1;
+    }
+#endif
+    if (!b) {
+        if (!(b = (struct pool_block *)malloc(POOL_HEADER + size))) {
+            return NULL;
+        }
+        b->mapped = 0;
+    }
+    b->capacity = size;
+    return b;
+}
+
+static void block_delete(struct pool_block *b) {
+    if (!b) {
+        return;
+    }
+#ifdef MAP_ANONYMOUS
+    if (b->mapped) {
+        munmap(b, POOL_HEADER + b->capacity);
+        return;
+    }
+#endif
+    free(b);
+}
+
+// pool.lock is held
+static void held_add(const long size) {
+    pool.held += size;
+    if (pool.held > pool.peak) {
+        pool.peak = pool.held;
+    }
+}
+
+void* pool_alloc(const size_t size) {
+    struct pool_block *b = NULL;
+    struct pool_block *replaced = NULL;
+
+    pthread_mutex_lock(&pool.lock);
+    if (size >= POOL_MIN_SIZE) {
+        // the smallest kept buffer large enough, but not a much larger one, it is kept for larger images;
+        // otherwise the largest kept buffer that is too small is replaced
+        int best = -1;
+        int largest = -1;
+        for (unsigned int i = 0; i != pool.keptcnt; ++i) {
+            const size_t capacity = pool.kept[i]->capacity;
+            if (capacity >= size && capacity / POOL_FIT <= size && (best < 0 || capacity < pool.kept[best]->capacity)) {
+                best = i;
+            }
+            if (capacity < size && (largest < 0 || capacity > pool.kept[largest]->capacity)) {
+                largest = i;
+            }
+        }
+        if (best >= 0) {
+            b = pool.kept[best];
+            pool.kept[best] = pool.kept[--pool.keptcnt];
+            pool.keptsize -= b->capacity;
+            pool.reused += size;
+        } else if (largest >= 0) {
+            replaced = pool.kept[largest];
+            pool.kept[largest] = pool.kept[--pool.keptcnt];
+            pool.keptsize -= replaced->capacity;
+            pool.held -= replaced->capacity;
+        }
+    }
+    pthread_mutex_unlock(&pool.lock);
+    block_delete(replaced), replaced = NULL;
+
+    if (!b) {
+        if (!(b = block_new(size))) {
+            return NULL;
+        }
+        pthread_mutex_lock(&pool.lock);
+        held_add(size);
+        pthread_mutex_unlock(&pool.lock);
+    }
+    b->size = size;
+#ifdef DEBUG
+    // no buffer is zeroed, output must not depend on what was there before
+    memset(block_data(b), 0xa5, size);
+#endif
+    return block_data(b);
+}
+
+void* pool_realloc(void *ptr, const size_t size) {
+    if (!ptr) {
+        return pool_alloc(size);
+    }
+    struct pool_block *b = block_of(ptr);
+    if (size <= b->capacity) {
+        b->size = size;
+        return ptr;
+    }
+
+    if (b->capacity < POOL_MIN_SIZE) {
+        // small buffers are never kept (nor mapped), they may be grown in place
+        struct pool_block *grown = (struct pool_block *)realloc(b, POOL_HEADER + size);
+        if (!grown) {
+            return NULL;
+        }
+        pthread_mutex_lock(&pool.lock);
+        held_add((long)size - (long)grown->capacity);
+        pthread_mutex_unlock(&pool.lock);
+        grown->capacity = size;
+        grown->size = size;
+        return block_data(grown);
+    }
+
+    void *p = pool_alloc(size);
+    if (!p) {
+        return NULL;
+    }
+    memcpy(p, ptr, b->size);
+    pool_free(ptr);
+    return p;
+}
+
+void pool_free(void *ptr) {
+    if (!ptr) {
+        return;
+    }
+    struct pool_block *b = block_of(ptr);
+    struct pool_block *released[POOL_KEEP + 1];
+    unsigned int releasedcnt = 0;
+
+    pthread_mutex_lock(&pool.lock);
+    if (b->capacity >= POOL_MIN_SIZE && b->capacity <= POOL_KEEP_BYTES) {
+        // the smallest kept buffers make room for this one, unless they are larger
+        while (pool.keptcnt != 0 && (pool.keptcnt == POOL_KEEP || pool.keptsize + b->capacity > POOL_KEEP_BYTES)) {
+            unsigned int smallest = 0;
+            for (unsigned int i = 1; i != pool.keptcnt; ++i) {
+                if (pool.kept[i]->capacity < pool.kept[smallest]->capacity) {
+                    smallest = i;
+                }
+            }
+            if (pool.kept[smallest]->capacity >= b->capacity) {
+                break;
+            }
+            released[releasedcnt++] = pool.kept[smallest];
+            pool.keptsize -= pool.kept[smallest]->capacity;
+            pool.kept[smallest] = pool.kept[--pool.keptcnt];
+        }
+        if (pool.keptcnt != POOL_KEEP && pool.keptsize + b->capacity <= POOL_KEEP_BYTES) {
+            pool.kept[pool.keptcnt++] = b;
+            pool.keptsize += b->capacity;
+            b = NULL;
+        }
+    }
+    if (b) {
+        released[releasedcnt++] = b;
+    }
+    for (unsigned int i = 0; i != releasedcnt; ++i) {
+        pool.held -= released[i]->capacity;
+    }
+    pthread_mutex_unlock(&pool.lock);
+    for (unsigned int i = 0; i != releasedcnt; ++i) {
+        block_delete(released[i]), released[i] = NULL;
+    }
+}
+
+// pool.lock is held, kept buffers are moved into released (of POOL_KEEP), returns their count
+static unsigned int pool_take(struct pool_block **released) {
+    const unsigned int count = pool.keptcnt;
+    for (unsigned int i = 0; i != count; ++i) {
+        pool.held -= pool.kept[i]->capacity;
+        released[i] = pool.kept[i], pool.kept[i] = NULL;
+    }
+    pool.keptcnt = 0;
+    pool.keptsize = 0;
+    return count;
+}
+
+void pool_open(void) {
+    pthread_mutex_lock(&pool.lock);
+    ++pool.users;
+    pthread_mutex_unlock(&pool.lock);
+}
+
+void pool_close(void) {
+    struct pool_block *released[POOL_KEEP];
+    unsigned int count = 0;
+    pthread_mutex_lock(&pool.lock);
+    if (pool.users != 0 && --pool.users == 0) {
+        count = pool_take(released);
+    }
+    pthread_mutex_unlock(&pool.lock);
+    for (unsigned int i = 0; i != count; ++i) {
+        block_delete(released[i]), released[i] = NULL;
+    }
+}
+
+void pool_clear(void) {
+    struct pool_block *released[POOL_KEEP];
+    pthread_mutex_lock(&pool.lock);
+    const unsigned int count = pool_take(released);
+    pthread_mutex_unlock(&pool.lock);
+    for (unsigned int i = 0; i != count; ++i) {
+        block_delete(released[i]), released[i] = NULL;
+    }
+}
+
+void pool_counters(unsigned long *peak, unsigned long *reused) {
+    pthread_mutex_lock(&pool.lock);
+    *peak = pool.peak;
+    *reused = pool.reused;
+    pthread_mutex_unlock(&pool.lock);
+}
@@ -0,0 +1,57 @@
+/*!
+(c) 2012 - 2015 Petr Kutalek: png2pos
+
+Licensed under the MIT License, see png2pos.c
+*/
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+// Pool of image buffers of a job
+//
+// Input files, decoded images (lodepng allocators), greyscale images and bitmaps of one job
+// have about the same sizes, so released buffers are kept and handed out again instead of being
+// returned to the system: following files of a batch reuse pages that are already mapped, without
+// page faults and without zeroing them. A request takes the smallest kept buffer that is large enough,
+// but at most POOL_FIT times larger; if there is none, the largest kept buffer that is too small is replaced
+// by a new one of requested size, so kept buffers grow to the largest images seen. Buffers are not cleared,
+// all their users write every byte they read (DEBUG builds fill them with a pattern, so that a dependency
+// on zeroes shows in the output).
+// Buffers smaller than POOL_MIN_SIZE are not kept, neither are buffers beyond POOL_KEEP_BYTES. Thread-safe.
+// The pool is shared by everything converting in the process (jobs of the command line, library contexts);
+// each of them opens it and closes it when done, the last one to close it releases all kept buffers.
+
+#define POOL_MIN_SIZE 65536u
+
+// a kept buffer serves requests of at least 1 / POOL_FIT of its size
+#define POOL_FIT 2u
+
+// buffers kept at most, the smallest one is released when there are more
+#define POOL_KEEP 16u
+
+// bytes of kept buffers at most, the smallest ones are released to make room for a larger one
+#define POOL_KEEP_BYTES (32ul << 20)
+
+void* pool_alloc(size_t size);
+
+// keeps contents up to the smaller of both sizes
+void* pool_realloc(void *ptr, size_t size);
+
+// ptr has to come from pool_alloc or pool_realloc, NULL is ignored
+void pool_free(void *ptr);
+
+// a user of the pool comes
+void pool_open(void);
+
+// a user of the pool is done, kept buffers are released once there is none
+void pool_close(void);
+
+// releases all kept buffers
+void pool_clear(void);
+
+// peak of bytes held by pool (in use and kept) and bytes of requests served by kept buffers
+void pool_counters(unsigned long *peak, unsigned long *reused);
+
+#endif
@@ -0,0 +1,120 @@
+/*!
+(c) 2012 - 2015 Petr Kutalek: png2pos
+
+Licensed under the MIT License, see png2pos.c
+*/
+
+#include <string.h>
+#include "profile.h"
+
+// bitmap rows are whole bytes
+#if PRINTER_MAX_WIDTH % 8 != 0
+#error "PRINTER_MAX_WIDTH must be divisible by 8"
+#endif
+
+const struct profile PROFILES[] = {
+    // the printer png2pos was built for
+    { "default", PRINTER_MAX_WIDTH, GS8L_MAX_Y, (PRINTER_MAX_WIDTH >> 3) * GS8L_MAX_Y, GRAPHICS_MAX_Y, PRINTER_DOT_FEED,
+        PROFILE_FEED | PROFILE_CUT | PROFILE_NV | PROFILE_DOWNLOAD },
+    // 58 mm paper, 203 dpi
+    { "58mm", 384u, 256u, 48u * 256u, GRAPHICS_MAX_Y, 2u, PROFILE_FEED | PROFILE_CUT },
+    // 80 mm paper, 203 dpi, 72 mm print width
+    { "80mm", 576u, 256u, 72u * 256u, GRAPHICS_MAX_Y, 2u, PROFILE_FEED | PROFILE_CUT },
+    // 80 mm paper, 203 dpi, printed up to its edges
+    { "80mm-wide", 640u, 256u, 80u * 256u, GRAPHICS_MAX_Y, 2u, PROFILE_FEED | PROFILE_CUT },
+    // Epson TM-T88, 180 dpi
+    { "tm-t88", 512u, 256u, 64u * 256u, 2304u, 2u, PROFILE_FEED | PROFILE_CUT | PROFILE_NV | PROFILE_DOWNLOAD },
+    // Epson TM-J2000/J2100, bands of 128 rows at most
+    { "tm-j2000", 512u, 128u, 64u * 128u, 2304u, 2u, PROFILE_FEED | PROFILE_CUT | PROFILE_NV | PROFILE_DOWNLOAD },
+    { NULL, 0, 0, 0, 0, 0, 0 }
+};
+
+const struct profile* profile_find(const char *name) {
+    for (unsigned int i = 0; PROFILES[i].name; ++i) {
+        if (strcmp(PROFILES[i].name, name) == 0) {
+            return &PROFILES[i];
+        }
+    }
+    return NULL;
+}
+
+unsigned int profile_band(const struct profile *profile, const unsigned int canvas_w) {
+    const unsigned int rows = canvas_w >= 8 ? profile->buffer / (canvas_w >> 3) : profile->band_height;
+    if (rows == 0) {
+        return 1;
+    }
+    return rows < profile->band_height ? rows : profile->band_height;
+}
+
+// generic kernels, a row is scanned up to its first black byte
+static unsigned int rows_blank(const unsigned char *row, const unsigned int bytes) {
+    for (unsigned int i = 0; i != bytes; ++i) {
+        if (row[i] != 0x00) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void rows_columns(unsigned char *columns, const unsigned char *rows, const unsigned int count, const unsigned int bytes) {
+    memset(columns, 0x00, bytes);
+    for (unsigned int y = 0; y != count; ++y) {
+        const unsigned char *row = &rows[y * bytes];
+        for (unsigned int i = 0; i != bytes; ++i) {
+            columns[i] |= row[i];
+        }
+    }
+}
+
+// loops of constant trip count without early exit, the compiler unrolls and vectorizes them
+static inline unsigned int row_or(const unsigned char *row, const unsigned int bytes) {
+    unsigned char any = 0x00;
+    for (unsigned int i = 0; i != bytes; ++i) {
+        any |= row[i];
+    }
+    return any;
+}
+
+static inline void columns_or(unsigned char *columns, const unsigned char *rows, const unsigned int count, const unsigned int bytes) {
+    unsigned char acc[PROFILE_MAX_WIDTH >> 3];
+    memset(acc, 0x00, bytes);
+    for (unsigned int y = 0; y != count; ++y) {
+        const unsigned char *row = &rows[y * bytes];
+        for (unsigned int i = 0; i != bytes; ++i) {
+            acc[i] |= row[i];
+        }
+    }
+    memcpy(columns, acc, bytes);
+}
+
+#define PROFILE_ROWS(BYTES) \
+    static unsigned int rows_blank_##BYTES(const unsigned char *row, const unsigned int bytes) { \
+        (void)bytes; \
+        return row_or(row, BYTES) == 0x00; \
+    } \
+    static void rows_columns_##BYTES(unsigned char *columns, const unsigned char *rows, const unsigned int count, const unsigned int bytes) { \
+        (void)bytes; \
+        columns_or(columns, rows, count, BYTES); \
+    }
+
+// 384, 512, 576 and 640 dots
+PROFILE_ROWS(48)
+PROFILE_ROWS(64)
+PROFILE_ROWS(72)
+PROFILE_ROWS(80)
+
+static const struct profile_rows ROWS[] = {
+    { 48, rows_blank_48, rows_columns_48 },
+    { 64, rows_blank_64, rows_columns_64 },
+    { 72, rows_blank_72, rows_columns_72 },
+    { 80, rows_blank_80, rows_columns_80 },
+    { 0, rows_blank, rows_columns }
+};
+
+const struct profile_rows* profile_rows(const unsigned int bytes) {
+    unsigned int i = 0;
+    while (ROWS[i].bytes != 0 && ROWS[i].bytes != bytes) {
+        ++i;
+    }
+    return &ROWS[i];
+}
@@ -0,0 +1,90 @@
+/*!
+(c) 2012 - 2015 Petr Kutalek: png2pos
+
+Licensed under the MIT License, see png2pos.c
+*/
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+// Printer profiles (--printer)
+//
+// A profile describes what the printer can take: width of its print head, rows of one GS 8 L band,
+// size of the buffer a band is stored in, height of graphics kept in its memory, paper feed per row of dots
+// and commands it supports. The default profile is the printer png2pos was built for (the constants below),
+// others are picked at run time. Bitmap rows of the widths of built-in profiles are scanned by kernels
+// specialized for that width, with a constant trip count; other widths take the generic ones.
+
+// number of dots/lines in vertical direction in one F112 command
+// set to <= 128u for Epson TM-J2000/J2100 (or use --printer tm-j2000)
+#ifndef GS8L_MAX_Y
+#define GS8L_MAX_Y 256u
+#endif
+
+// vertical motion units (GS P) per row of dots, printer default is 1/360" for 180 dpi
+#ifndef PRINTER_DOT_FEED
+#define PRINTER_DOT_FEED 2u
+#endif
+
+// max height of NV and download graphics
+#ifndef GRAPHICS_MAX_Y
+#define GRAPHICS_MAX_Y 2304u
+#endif
+
+// max image width printer is able to process
+#ifndef PRINTER_MAX_WIDTH
+#define PRINTER_MAX_WIDTH 512u
+#endif
+
+// widest printer of all profiles, bounds buffers of one bitmap row
+#define PROFILE_MAX_WIDTH (PRINTER_MAX_WIDTH > 640u ? PRINTER_MAX_WIDTH : 640u)
+
+// commands supported besides GS 8 L bands
+// ESC J, paper feed (-e)
+#define PROFILE_FEED 0x01u
+// GS V, paper cut (-c)
+#define PROFILE_CUT 0x02u
+// NV graphics (-m N)
+#define PROFILE_NV 0x04u
+// download graphics (-m D)
+#define PROFILE_DOWNLOAD 0x08u
+
+struct profile {
+    const char *name;
+    // dots of print head, a multiple of 8
+    unsigned int width;
+    // rows of one band at most
+    unsigned int band_height;
+    // bytes of print buffer, raster data of one band never exceeds it
+    unsigned int buffer;
+    // max height of NV and download graphics
+    unsigned int graphics_height;
+    // vertical motion units per row of dots
+    unsigned int dot_feed;
+    // PROFILE_*
+    unsigned int commands;
+};
+
+// built-in profiles, the default one (as built) is the first, terminated by { NULL }
+extern const struct profile PROFILES[];
+
+// profile of given name, NULL if there is no such profile
+const struct profile* profile_find(const char *name);
+
+// rows of one band of bitmap canvas_w dots wide
+unsigned int profile_band(const struct profile *profile, unsigned int canvas_w);
+
+// kernels over rows of bitmap of one width
+struct profile_rows {
+    // bytes of a row, 0 = any
+    unsigned int bytes;
+    // non-zero if row of bytes is blank
+    unsigned int (*blank)(const unsigned char *row, unsigned int bytes);
+    // ORs count consecutive rows of bytes into columns (bytes long)
+    void (*columns)(unsigned char *columns, const unsigned char *rows, unsigned int count, unsigned int bytes);
+};
+
+// kernels specialized for rows of given bytes, the generic ones if there are none
+const struct profile_rows* profile_rows(unsigned int bytes);
+
+#endif
@@ -0,0 +1,89 @@
+/*!
+(c) 2012 - 2015 Petr Kutalek: png2pos
+
+Licensed under the MIT License, see png2pos.c
+*/
+
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include "queue.h"
+
+#if defined(__GNUC__)
+#define counter_load(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define counter_store(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#else
+static pthread_mutex_t counter_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned long counter_load(const unsigned long *p) {
+    pthread_mutex_lock(&counter_lock);
+    const unsigned long v = *p;
+    pthread_mutex_unlock(&counter_lock);
+    return v;
+}
+
+static void counter_store(unsigned long *p, const unsigned long v) {
+    pthread_mutex_lock(&counter_lock);
+    *p = v;
+    pthread_mutex_unlock(&counter_lock);
+}
+#endif
+
+// yields before the waiting side falls asleep, the other side is usually about to finish a slot;
+// a writer blocked by the printer may hold slots for seconds, so spinning all the time would burn a CPU
+#define QUEUE_SPINS 64u
+#define QUEUE_SLEEP_NS 100000L
+
+static void queue_wait(unsigned int *spins) {
+    if (*spins < QUEUE_SPINS) {
+        ++*spins;
+        sched_yield();
+        return;
+    }
+    const struct timespec pause = { 0, QUEUE_SLEEP_NS };
+    nanosleep(&pause, NULL);
+}
+
+void queue_init(struct queue *q, const unsigned int slots) {
+    q->slots = slots;
+    q->head.n = 0;
+    q->tail.n = 0;
+    q->closed = 0;
+}
+
+int queue_reserve(struct queue *q) {
+    const unsigned long head = q->head.n;
+    unsigned int spins = 0;
+    while (head - counter_load(&q->tail.n) == q->slots) {
+        if (counter_load(&q->closed)) {
+            return -1;
+        }
+        queue_wait(&spins);
+    }
+    return counter_load(&q->closed) ? -1 : (int)(head % q->slots);
+}
+
+void queue_push(struct queue *q) {
+    counter_store(&q->head.n, q->head.n + 1);
+}
+
+int queue_front(struct queue *q) {
+    const unsigned long tail = q->tail.n;
+    unsigned int spins = 0;
+    while (counter_load(&q->head.n) == tail) {
+        if (counter_load(&q->closed)) {
+            // slots pushed before the queue was closed are still taken
+            return counter_load(&q->head.n) == tail ? -1 : (int)(tail % q->slots);
+        }
+        queue_wait(&spins);
+    }
+    return (int)(tail % q->slots);
+}
+
+void queue_pop(struct queue *q) {
+    counter_store(&q->tail.n, q->tail.n + 1);
+}
+
+void queue_close(struct queue *q) {
+    counter_store(&q->closed, 1);
+}
@@ -0,0 +1,50 @@
+/*!
+(c) 2012 - 2015 Petr Kutalek: png2pos
+
+Licensed under the MIT License, see png2pos.c
+*/
+
+#ifndef QUEUE_H
+#define QUEUE_H
+
+// Bounded lock-free queue of one producer and one consumer thread (-s pipeline)
+//
+// Queue hands over indices of slots of a buffer owned by the caller: the producer fills
+// the slot returned by queue_reserve() and publishes it by queue_push(), the consumer reads
+// the slot returned by queue_front() and gives it back by queue_pop(). Each counter is written
+// by one side only, with release/acquire ordering, so data of a slot is visible to the other
+// side before its index is. A side waits for the other one by spinning a while, then by short sleeps.
+
+// padded to its own cache line, so the producer and the consumer do not share one
+struct queue_counter {
+    unsigned long n;
+    unsigned char pad[64 - sizeof(unsigned long)];
+};
+
+struct queue {
+    unsigned int slots;
+    // slots pushed by the producer and popped by the consumer so far
+    struct queue_counter head;
+    struct queue_counter tail;
+    // set by either side when it stops, the other one does not wait any more
+    unsigned long closed;
+};
+
+void queue_init(struct queue *q, unsigned int slots);
+
+// producer: slot to be filled, waits while all slots are taken; -1 if the consumer has stopped
+int queue_reserve(struct queue *q);
+
+// producer: the reserved slot is filled
+void queue_push(struct queue *q);
+
+// consumer: the oldest filled slot, waits while there is none; -1 if there is none and the producer has stopped
+int queue_front(struct queue *q);
+
+// consumer: the front slot may be reused
+void queue_pop(struct queue *q);
+
+// no more slots are pushed (producer: end of data or an error) or popped (consumer: an error)
+void queue_close(struct queue *q);
+
+#endif
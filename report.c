@@ -0,0 +1,21 @@
+/*!
+(c) 2012 - 2015 Petr Kutalek: png2pos
+
+Licensed under the MIT License, see png2pos.c
+*/
+
+#include <stdio.h>
+#include <stdarg.h>
+#include "report.h"
+
+void report(const struct report *to, const char *format, ...) {
+    if (!to || !to->message) {
+        return;
+    }
+    char message[REPORT_MAX_LENGTH];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    to->message(to->user, message);
+}
@@ -0,0 +1,27 @@
+/*!
+(c) 2012 - 2015 Petr Kutalek: png2pos
+
+Licensed under the MIT License, see png2pos.c
+*/
+
+#ifndef REPORT_H
+#define REPORT_H
+
+// Diagnostics of conversion (hints of photo mode, threshold shifts, reasons of failures)
+//
+// The library writes nothing to standard error: each message, formatted by printf rules and without
+// a trailing newline, is passed to the callback of whoever asked for the work, a library context
+// (png2pos.h) or the command line. A callback may be called by worker threads (-j, -s), it has to be thread-safe.
+
+struct report {
+    void (*message)(void *user, const char *message);
+    void *user;
+};
+
+// messages longer than this are truncated
+#define REPORT_MAX_LENGTH 512
+
+// formats a message and passes it on, a message to a NULL report (or one without callback) is dropped
+void report(const struct report *to, const char *format, ...);
+
+#endif
@@ -0,0 +1,164 @@
+/*!
+(c) 2012 - 2015 Petr Kutalek: png2pos
+
+Licensed under the MIT License, see png2pos.c
+*/
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "scale.h"
+#include "grey.h"
+
+// weights are fixed point numbers of this many fractional bits
+#define SCALE_BITS 14
+
+// horizontal taps are padded to a multiple of this, so the kernels need no tail
+#define SCALE_PAD 8u
+
+// lobes of Lanczos filter
+#define SCALE_LOBES 3
+
+// M_PI is not part of C99
+#define SCALE_PI 3.14159265358979323846
+
+const char *const SCALE_FILTERS[] = { "none", "area", "lanczos", NULL };
+
+int scale_filter(const char *name) {
+    for (unsigned int i = SCALE_AREA; SCALE_FILTERS[i]; ++i) {
+        if (strcmp(SCALE_FILTERS[i], name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static double sinc(const double x) {
+    if (x == 0.0) {
+        return 1.0;
+    }
+    return sin(SCALE_PI * x) / (SCALE_PI * x);
+}
+
+// weight of source pixel whose center is at distance d (in source pixels) from the center of output pixel,
+// ratio is source / output size, scale is the ratio, at least 1
+static double weight(const unsigned int filter, const double d, const double ratio, const double scale) {
+    if (filter == SCALE_LANCZOS) {
+        const double t = d / scale;
+        return fabs(t) < SCALE_LOBES ? sinc(t) * sinc(t / SCALE_LOBES) : 0.0;
+    }
+    // area covered by the output pixel, [-ratio / 2; ratio / 2] around its center
+    const double lo = fmax(d - 0.5, -0.5 * ratio);
+    const double hi = fmin(d + 0.5, 0.5 * ratio);
+    return hi > lo ? hi - lo : 0.0;
+}
+
+static unsigned int axis_open(struct scale_axis *a, const unsigned int filter, const unsigned int src, const unsigned int dst, const unsigned int pad) {
+    // filters get wider by the ratio, they are never narrower than for 1:1
+    const double ratio = (double)src / dst;
+    const double scale = ratio > 1.0 ? ratio : 1.0;
+    const double support = filter == SCALE_LANCZOS ? SCALE_LOBES * scale : 0.5 * scale + 0.5;
+    unsigned int n = (unsigned int)ceil(2.0 * support) + 1;
+    if (n > src) {
+        n = src;
+    }
+    a->taps = (n + pad - 1) / pad * pad;
+    a->start = (unsigned int *)malloc(dst * sizeof(unsigned int));
+    a->weights = (short *)calloc((size_t)dst * a->taps, sizeof(short));
+    double *w = (double *)malloc(n * sizeof(double));
+    if (!a->start || !a->weights || !w) {
+        free(w);
+        return SCALE_E_MEMORY;
+    }
+
+    for (unsigned int i = 0; i != dst; ++i) {
+        // n pixels around the center, shifted back inside the image at its edges
+        const double center = (i + 0.5) * ratio;
+        const double first = floor(center - support);
+        unsigned int start = first > 0.0 ? (unsigned int)first : 0;
+        if (start > src - n) {
+            start = src - n;
+        }
+        a->start[i] = start;
+
+        double sum = 0.0;
+        for (unsigned int k = 0; k != n; ++k) {
+            w[k] = weight(filter, start + k + 0.5 - center, ratio, scale);
+            sum += w[k];
+        }
+        // integer weights add up to exactly 1, rounding error goes to the largest one
+        short *q = &a->weights[(size_t)i * a->taps];
+        int total = 0;
+        unsigned int largest = 0;
+        for (unsigned int k = 0; k != n; ++k) {
+            q[k] = (short)lround(w[k] / sum * (1 << SCALE_BITS));
+            total += q[k];
+            if (q[k] > q[largest]) {
+                largest = k;
+            }
+        }
+        q[largest] += (1 << SCALE_BITS) - total;
+    }
+    free(w);
+    return 0;
+}
+
+unsigned int scale_open(struct scale *s, const unsigned int filter, const unsigned int src_w, const unsigned int src_h, const unsigned int dst_w, const unsigned int dst_h) {
+    memset(s, 0, sizeof(struct scale));
+    s->src_w = src_w;
+    s->src_h = src_h;
+    s->dst_w = dst_w;
+    s->dst_h = dst_h;
+    if (axis_open(&s->x, filter, src_w, dst_w, SCALE_PAD) != 0 || axis_open(&s->y, filter, src_h, dst_h, 1) != 0) {
+        scale_close(s);
+        return SCALE_E_MEMORY;
+    }
+
+    // kernels read whole groups of taps, beyond the last pixel of a line
+    s->line = (unsigned char *)calloc(src_w + SCALE_PAD, 1);
+    s->ring = (short *)malloc((size_t)s->y.taps * dst_w * sizeof(short));
+    s->rows = (const short **)malloc(s->y.taps * sizeof(short *));
+    if (!s->line || !s->ring || !s->rows) {
+        scale_close(s);
+        return SCALE_E_MEMORY;
+    }
+    s->memory = (size_t)dst_w * (sizeof(unsigned int) + s->x.taps * sizeof(short))
+        + (size_t)dst_h * (sizeof(unsigned int) + s->y.taps * sizeof(short))
+        + src_w + SCALE_PAD + (size_t)s->y.taps * (dst_w * sizeof(short) + sizeof(short *));
+    return 0;
+}
+
+unsigned char* scale_line(struct scale *s) {
+    return s->line;
+}
+
+unsigned int scale_push(struct scale *s, unsigned char *img_grey) {
+    const unsigned int taps = s->y.taps;
+    const unsigned int y = s->pushed++;
+    grey_filter_line(&s->ring[(size_t)(y % taps) * s->dst_w], s->line, s->x.start, s->x.weights, s->x.taps, s->dst_w);
+
+    // output lines whose last source line has just been filtered, their taps lines are all in the ring
+    while (s->done != s->dst_h && s->y.start[s->done] + taps - 1 == y) {
+        const unsigned int start = s->y.start[s->done];
+        for (unsigned int k = 0; k != taps; ++k) {
+            s->rows[k] = &s->ring[(size_t)((start + k) % taps) * s->dst_w];
+        }
+        unsigned char *out = &img_grey[(size_t)s->done * s->dst_w];
+        grey_filter_rows(out, s->rows, &s->y.weights[(size_t)s->done * taps], taps, s->dst_w);
+        for (unsigned int x = 0; x != s->dst_w; ++x) {
+            out[x] = LIGHTNESS[out[x]];
+        }
+        ++s->done;
+    }
+    return s->done;
+}
+
+void scale_close(struct scale *s) {
+    free(s->x.start), s->x.start = NULL;
+    free(s->x.weights), s->x.weights = NULL;
+    free(s->y.start), s->y.start = NULL;
+    free(s->y.weights), s->y.weights = NULL;
+    free(s->line), s->line = NULL;
+    free(s->ring), s->ring = NULL;
+    free(s->rows), s->rows = NULL;
+}
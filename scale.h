@@ -0,0 +1,75 @@
+/*!
+(c) 2012 - 2015 Petr Kutalek: png2pos
+
+Licensed under the MIT License, see png2pos.c
+*/
+
+#ifndef SCALE_H
+#define SCALE_H
+
+#include <stddef.h>
+
+// Downscaling of images wider than the printer (--fit)
+//
+// Images are scaled in linear light: lines of luminance Y (gamma expanded by GAMMA_22, before
+// the lightness lookup of grey.c) are pushed one by one, filtered horizontally into a small ring
+// of lines and combined vertically as soon as all lines of an output line are there; output lines
+// are looked up to lightness L*, so only the scaled greyscale image is held in memory.
+// Separable filters have integer weights (Q14) precomputed for each output pixel and line,
+// inner loops are SIMD kernels of grey.c and their results are bit-exact on every CPU.
+
+#define SCALE_E_MEMORY 1
+
+// filters, 0 = no scaling
+#define SCALE_NONE 0
+#define SCALE_AREA 1
+#define SCALE_LANCZOS 2
+
+// names indexed by SCALE_* constants, terminated by NULL
+extern const char *const SCALE_FILTERS[];
+
+// filter of given name, -1 if there is no such filter
+int scale_filter(const char *name);
+
+// source pixels of each output pixel along one axis
+struct scale_axis {
+    // number of weights of one output pixel
+    unsigned int taps;
+    // first source pixel of each output pixel
+    unsigned int *start;
+    // taps weights of each output pixel, Q14, their sum is 1 << 14
+    short *weights;
+};
+
+struct scale {
+    unsigned int src_w;
+    unsigned int src_h;
+    unsigned int dst_w;
+    unsigned int dst_h;
+    struct scale_axis x;
+    struct scale_axis y;
+    // next source line, src_w bytes of luminance followed by padding read by the kernels
+    unsigned char *line;
+    // horizontally filtered lines (Q7), y.taps lines of dst_w pixels
+    short *ring;
+    const short **rows;
+    // lines pushed and output lines done
+    unsigned int pushed;
+    unsigned int done;
+    // bytes allocated
+    size_t memory;
+};
+
+// prepares scaling of src_w × src_h image to dst_w × dst_h by filter
+unsigned int scale_open(struct scale *s, unsigned int filter, unsigned int src_w, unsigned int src_h, unsigned int dst_w, unsigned int dst_h);
+
+// buffer for the next source line of luminance, src_w bytes
+unsigned char* scale_line(struct scale *s);
+
+// filters the line filled in scale_line(), writes output lines finished by it into img_grey
+// (dst_w bytes of lightness each, at their row); returns the number of output lines done so far
+unsigned int scale_push(struct scale *s, unsigned char *img_grey);
+
+void scale_close(struct scale *s);
+
+#endif
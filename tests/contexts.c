@@ -0,0 +1,266 @@
+/*!
+(c) 2012 - 2015 Petr Kutalek: png2pos
+
+Licensed under the MIT License, see png2pos.c
+*/
+
+// make test, contexts of libpng2pos used at once by many threads
+//
+// usage: contexts [PNG files ...]
+//
+// Every thread opens contexts with its own options (line art, --fit, photo mode, ordered dithering, -e, --compose),
+// converts the same images by each of them and compares output byte by byte with the output of a context
+// of the same options used by a single thread before. Images are PBM and PGM files written into a temporary
+// directory and PNG files given as arguments, PNG files are converted from memory by every other thread.
+// Diagnostics of the library are kept by the contexts (none may reach standard error), photo mode has to leave
+// its threshold shift there; mismatches and failures are reported on standard output, exits with non-zero status
+// on any of them.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "png2pos.h"
+
+#define THREADS 8
+// contexts opened by each thread, one after another
+#define ROUNDS 4
+#define OPTION_SETS 5
+
+struct buffer {
+    unsigned char *data;
+    size_t length;
+    size_t size;
+};
+
+struct image {
+    const char *path;
+    // PNG file in memory, NULL for PBM and PGM
+    unsigned char *png;
+    size_t png_size;
+};
+
+static struct image images[64];
+static unsigned int imagecnt = 0;
+
+static struct png2pos_options option_sets[OPTION_SETS];
+static struct buffer references[OPTION_SETS];
+
+static int buffer_write(void *user, const unsigned char *data, const size_t length) {
+    struct buffer *buffer = (struct buffer *)user;
+    if (buffer->length + length > buffer->size) {
+        const size_t size = (buffer->length + length) * 2;
+        unsigned char *data_new = (unsigned char *)realloc(buffer->data, size);
+        if (!data_new) {
+            return 1;
+        }
+        buffer->data = data_new;
+        buffer->size = size;
+    }
+    memcpy(&buffer->data[buffer->length], data, length);
+    buffer->length += length;
+    return 0;
+}
+
+// one job of all images by a new context, png selects conversion from memory for PNG files;
+// the last diagnostic of the context is copied into message
+static int convert_job(const struct png2pos_options options, struct buffer *output, const int png, char *message, const size_t size) {
+    struct png2pos *ctx = png2pos_open(options, buffer_write, output);
+    if (!ctx) {
+        return 1;
+    }
+    int ret = 0;
+    for (unsigned int i = 0; i != imagecnt && ret == 0; ++i) {
+        if (png && images[i].png) {
+            ret = png2pos_convert(ctx, images[i].png, images[i].png_size);
+        } else {
+            ret = png2pos_convert_file(ctx, images[i].path);
+        }
+    }
+    if (ret == 0) {
+        ret = png2pos_finish(ctx);
+    }
+    snprintf(message, size, "%s", png2pos_message(ctx));
+    png2pos_close(ctx);
+    return ret;
+}
+
+static void* worker(void *arg) {
+    const unsigned int index = (unsigned int)(size_t)arg;
+    unsigned long failures = 0;
+    for (unsigned int round = 0; round != ROUNDS; ++round) {
+        const unsigned int set = (index + round) % OPTION_SETS;
+        struct buffer output = { .data = NULL };
+        char message[512];
+        const int ret = convert_job(option_sets[set], &output, index & 1, message, sizeof(message));
+        if (ret != 0) {
+            printf("Thread %u, options %u: job failed, %s (%s)\n", index, set, png2pos_error_text(ret), message);
+            ++failures;
+        } else if (option_sets[set].photo && strncmp(message, "Threshold shift", 15) != 0) {
+            printf("Thread %u, options %u: threshold shift was not kept by the context\n", index, set);
+            ++failures;
+        } else if (output.length != references[set].length || memcmp(output.data, references[set].data, output.length) != 0) {
+            printf("Thread %u, options %u: output differs from the single thread one\n", index, set);
+            ++failures;
+        }
+        free(output.data), output.data = NULL;
+    }
+    return (void *)(size_t)failures;
+}
+
+// PBM (P4) of text-like blocks separated by runs of blank rows, -e has something to elide
+static int write_pbm(const char *path, const unsigned int w, const unsigned int h) {
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        return 1;
+    }
+    fprintf(f, "P4\n%u %u\n", w, h);
+    const unsigned int bytes = (w + 7) >> 3;
+    for (unsigned int y = 0; y != h; ++y) {
+        for (unsigned int x = 0; x != bytes; ++x) {
+            unsigned char b = 0x00;
+            if ((y / 40) % 3 != 2 && x > bytes / 8 && x < bytes - bytes / 5) {
+                b = (unsigned char)((x * 37 + y * 11) ^ (y * x));
+            }
+            fputc(b, f);
+        }
+    }
+    return fclose(f) != 0;
+}
+
+// PGM (P5) of gradients and noise, a photo
+static int write_pgm(const char *path, const unsigned int w, const unsigned int h) {
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        return 1;
+    }
+    fprintf(f, "P5\n%u %u\n255\n", w, h);
+    unsigned int state = 12345u;
+    for (unsigned int y = 0; y != h; ++y) {
+        for (unsigned int x = 0; x != w; ++x) {
+            state = state * 1103515245u + 12345u;
+            const int v = (int)((x * 255) / w + (y * 64) / h) - 32 + (int)(state >> 27);
+            fputc(v < 0 ? 0 : v > 255 ? 255 : v, f);
+        }
+    }
+    return fclose(f) != 0;
+}
+
+static int load_png(struct image *image) {
+    FILE *f = fopen(image->path, "rb");
+    if (!f) {
+        return 1;
+    }
+    int ret = 1;
+    if (fseek(f, 0, SEEK_END) != 0) {
+        goto fail;
+    }
+    const long size = ftell(f);
+    if (size <= 0 || fseek(f, 0, SEEK_SET) != 0) {
+        goto fail;
+    }
+    image->png = (unsigned char *)malloc((size_t)size);
+    if (!image->png || fread(image->png, 1, (size_t)size, f) != (size_t)size) {
+        goto fail;
+    }
+    image->png_size = (size_t)size;
+    ret = 0;
+
+fail:
+    fclose(f);
+    return ret;
+}
+
+int main(int argc, char *argv[]) {
+    int ret = EXIT_FAILURE;
+    char dir[] = "/tmp/png2pos-test-XXXXXX";
+    char pbm[sizeof(dir) + 16];
+    char pgm[sizeof(dir) + 16];
+    char pgm_narrow[sizeof(dir) + 16];
+    pthread_t threads[THREADS];
+    unsigned int threadcnt = 0;
+    unsigned long failures = 0;
+
+    if (!mkdtemp(dir)) {
+        printf("Could not create temporary directory\n");
+        return EXIT_FAILURE;
+    }
+    snprintf(pbm, sizeof(pbm), "%s/line.pbm", dir);
+    snprintf(pgm, sizeof(pgm), "%s/photo.pgm", dir);
+    snprintf(pgm_narrow, sizeof(pgm_narrow), "%s/narrow.pgm", dir);
+    if (write_pbm(pbm, 512, 700) != 0 || write_pgm(pgm, 384, 300) != 0 || write_pgm(pgm_narrow, 200, 57) != 0) {
+        printf("Could not write test images into %s\n", dir);
+        goto fail;
+    }
+    images[imagecnt++].path = pbm;
+    images[imagecnt++].path = pgm;
+    images[imagecnt++].path = pgm_narrow;
+    for (int i = 1; i < argc && imagecnt != sizeof(images) / sizeof(images[0]); ++i) {
+        images[imagecnt].path = argv[i];
+        if (load_png(&images[imagecnt]) != 0) {
+            printf("Could not load input file %s\n", argv[i]);
+            goto fail;
+        }
+        ++imagecnt;
+    }
+
+    for (unsigned int set = 0; set != OPTION_SETS; ++set) {
+        option_sets[set] = png2pos_defaults();
+        option_sets[set].printer = "80mm-wide";
+    }
+    // line art scaled down to the default printer; photo mode dithered by 2 threads; ordered dithering with -e;
+    // --compose with -e; photo mode composed
+    option_sets[0].printer = NULL;
+    option_sets[0].fit = PNG2POS_FIT_AREA;
+    option_sets[1].photo = 1;
+    option_sets[1].threads = 2;
+    option_sets[1].cut = 1;
+    option_sets[2].photo = 1;
+    option_sets[2].dither = PNG2POS_DITHER_BAYER8;
+    option_sets[2].elide = 1;
+    option_sets[2].align = 'C';
+    option_sets[3].compose = 1;
+    option_sets[3].elide = 1;
+    option_sets[3].align = 'R';
+    option_sets[4].compose = 1;
+    option_sets[4].photo = 1;
+    option_sets[4].rotate = 180;
+
+    for (unsigned int set = 0; set != OPTION_SETS; ++set) {
+        char message[512];
+        const int error = convert_job(option_sets[set], &references[set], 0, message, sizeof(message));
+        if (error != 0) {
+            printf("Options %u: reference job failed, %s (%s)\n", set, png2pos_error_text(error), message);
+            goto fail;
+        }
+    }
+
+    for (; threadcnt != THREADS; ++threadcnt) {
+        if (pthread_create(&threads[threadcnt], NULL, worker, (void *)(size_t)threadcnt) != 0) {
+            printf("Could not start thread\n");
+            ++failures;
+            break;
+        }
+    }
+    for (unsigned int i = 0; i != threadcnt; ++i) {
+        void *result = NULL;
+        pthread_join(threads[i], &result);
+        failures += (unsigned long)(size_t)result;
+    }
+    printf("%u threads x %u contexts, %u images: %s\n", threadcnt, ROUNDS, imagecnt, failures == 0 ? "OK" : "FAILED");
+    ret = failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+
+fail:
+    for (unsigned int set = 0; set != OPTION_SETS; ++set) {
+        free(references[set].data), references[set].data = NULL;
+    }
+    for (unsigned int i = 0; i != imagecnt; ++i) {
+        free(images[i].png), images[i].png = NULL;
+    }
+    unlink(pbm);
+    unlink(pgm);
+    unlink(pgm_narrow);
+    rmdir(dir);
+    return ret;
+}
@@ -0,0 +1,185 @@
+/*!
+(c) 2012 - 2015 Petr Kutalek: png2pos
+
+Licensed under the MIT License, see png2pos.c
+*/
+
+// make test, every conversion kernel supported by CPU has to produce bit-exact results of the scalar one
+//
+// Kernels are run over pseudo-random data of sizes around their vector widths (odd sizes and tails of less
+// than a vector included); output buffers are prefilled with a guard pattern, so writes past the end differ too.
+// Exits with non-zero status on any mismatch.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "grey.h"
+
+// guard bytes after every output
+#define GUARD 64u
+#define MAX_SIZE 1100u
+
+static unsigned int failures = 0;
+
+static unsigned int random_state = 2463534242u;
+
+// xorshift32, the same data on every run
+static unsigned int random_next(void) {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+static void random_fill(unsigned char *buffer, const size_t length) {
+    for (size_t i = 0; i != length; ++i) {
+        buffer[i] = random_next() >> 24;
+    }
+}
+
+static void check(const char *kernel, const char *what, const unsigned int size, const void *expected, const void *got, const size_t length) {
+    if (memcmp(expected, got, length) != 0) {
+        fprintf(stderr, "Kernel '%s' differs from the scalar one: %s, size %u\n", kernel, what, size);
+        ++failures;
+    }
+}
+
+static void test_convert(const struct grey_kernel_info *kernel) {
+    static unsigned char rgba[MAX_SIZE * 4];
+    static unsigned char expected[MAX_SIZE + GUARD];
+    static unsigned char got[MAX_SIZE + GUARD];
+    random_fill(rgba, sizeof(rgba));
+    // opaque, transparent and half transparent pixels
+    for (unsigned int i = 0; i != MAX_SIZE; ++i) {
+        switch (i % 3) {
+            case 0:
+                rgba[(i << 2) | 3] = 0xff;
+                break;
+            case 1:
+                rgba[(i << 2) | 3] = i & 4 ? 0x00 : rgba[(i << 2) | 3];
+                break;
+        }
+    }
+    for (unsigned int size = 0; size != MAX_SIZE; size = size < 80 ? size + 1 : size * 2 + 7 > MAX_SIZE ? MAX_SIZE : size * 2 + 7) {
+        memset(expected, 0xa5, sizeof(expected));
+        memset(got, 0xa5, sizeof(got));
+        grey_scalar(expected, rgba, size);
+        kernel->convert(got, rgba, size);
+        check(kernel->name, "convert", size, expected, got, sizeof(got));
+    }
+}
+
+static void test_pack(const struct grey_kernel_info *kernel) {
+    static unsigned char grey[MAX_SIZE];
+    static unsigned char thresholds[MAX_SIZE];
+    static unsigned char expected[(MAX_SIZE >> 3) + 1 + GUARD];
+    static unsigned char got[(MAX_SIZE >> 3) + 1 + GUARD];
+    random_fill(grey, sizeof(grey));
+    random_fill(thresholds, sizeof(thresholds));
+    // values next to the threshold, pixels equal to it are black
+    for (unsigned int i = 0; i < MAX_SIZE; i += 5) {
+        grey[i] = 0x80 - 1 + i % 3;
+        thresholds[i] = grey[i];
+    }
+    static const unsigned int THRESHOLDS[] = { 0x00, 0x7f, 0x80, 0xfe, 0xff };
+    for (unsigned int size = 0; size != MAX_SIZE; size = size < 80 ? size + 1 : size * 2 + 7 > MAX_SIZE ? MAX_SIZE : size * 2 + 7) {
+        for (unsigned int t = 0; t != sizeof(THRESHOLDS) / sizeof(THRESHOLDS[0]); ++t) {
+            memset(expected, 0xa5, sizeof(expected));
+            memset(got, 0xa5, sizeof(got));
+            grey_pack_scalar(expected, grey, size, THRESHOLDS[t]);
+            kernel->pack(got, grey, size, THRESHOLDS[t]);
+            check(kernel->name, "pack", size, expected, got, sizeof(got));
+        }
+        memset(expected, 0xa5, sizeof(expected));
+        memset(got, 0xa5, sizeof(got));
+        grey_pack_map_scalar(expected, grey, thresholds, size);
+        kernel->pack_map(got, grey, thresholds, size);
+        check(kernel->name, "pack_map", size, expected, got, sizeof(got));
+    }
+}
+
+static void test_transpose(const struct grey_kernel_info *kernel) {
+    // columns of up to 200 bytes, 9 bytes apart, read downwards and upwards
+    static unsigned char bitmap[200 * 9];
+    static unsigned char expected[8 * 32 + GUARD];
+    static unsigned char got[8 * 32 + GUARD];
+    random_fill(bitmap, sizeof(bitmap));
+    for (unsigned int n = 0; n <= 200; n += 8) {
+        for (unsigned int up = 0; up != 2; ++up) {
+            const unsigned char *src = up ? &bitmap[(n != 0 ? n - 1 : 0) * 9 + 4] : &bitmap[3];
+            const long src_step = up ? -9 : 9;
+            // rows of output are 32 bytes apart, they are n / 8 bytes long
+            memset(expected, 0xa5, sizeof(expected));
+            memset(got, 0xa5, sizeof(got));
+            grey_transpose_scalar(expected, 32, src, src_step, n);
+            kernel->transpose(got, 32, src, src_step, n);
+            check(kernel->name, up ? "transpose upwards" : "transpose", n, expected, got, sizeof(got));
+        }
+    }
+}
+
+static void test_filter(const struct grey_kernel_info *kernel) {
+    // filtered line of w pixels of src, taps weights of each pixel
+    static unsigned char src[MAX_SIZE * 2 + 32];
+    static unsigned int start[MAX_SIZE];
+    static short weights[MAX_SIZE * 24];
+    static short line_expected[MAX_SIZE + GUARD];
+    static short line_got[MAX_SIZE + GUARD];
+    random_fill(src, sizeof(src));
+    // negative weights and sums out of range are clamped
+    for (unsigned int i = 0; i != sizeof(weights) / sizeof(weights[0]); ++i) {
+        weights[i] = (short)((int)(random_next() >> 19) - 0x800);
+    }
+    for (unsigned int i = 0; i != MAX_SIZE; ++i) {
+        start[i] = i * 2 - i % 3;
+    }
+    start[0] = 0;
+    for (unsigned int taps = 8; taps <= 24; taps += 8) {
+        for (unsigned int w = 0; w != MAX_SIZE; w = w < 40 ? w + 1 : w * 2 + 3 > MAX_SIZE ? MAX_SIZE : w * 2 + 3) {
+            memset(line_expected, 0x5a, sizeof(line_expected));
+            memset(line_got, 0x5a, sizeof(line_got));
+            grey_filter_line_scalar(line_expected, src, start, weights, taps, w);
+            kernel->filter_line(line_got, src, start, weights, taps, w);
+            check(kernel->name, "filter_line", w, line_expected, line_got, sizeof(line_got));
+        }
+    }
+
+    // sums of taps filtered lines (Q7), of any number of taps
+    static short lines[9][MAX_SIZE];
+    static unsigned char rows_expected[MAX_SIZE + GUARD];
+    static unsigned char rows_got[MAX_SIZE + GUARD];
+    const short *rows[9];
+    for (unsigned int k = 0; k != 9; ++k) {
+        for (unsigned int x = 0; x != MAX_SIZE; ++x) {
+            lines[k][x] = (short)(random_next() % ((255u << 7) + 1));
+        }
+        rows[k] = lines[k];
+    }
+    for (unsigned int taps = 1; taps <= 9; ++taps) {
+        for (unsigned int w = 0; w != MAX_SIZE; w = w < 40 ? w + 1 : w * 2 + 3 > MAX_SIZE ? MAX_SIZE : w * 2 + 3) {
+            memset(rows_expected, 0xa5, sizeof(rows_expected));
+            memset(rows_got, 0xa5, sizeof(rows_got));
+            grey_filter_rows_scalar(rows_expected, rows, weights, taps, w);
+            kernel->filter_rows(rows_got, rows, weights, taps, w);
+            check(kernel->name, "filter_rows", w, rows_expected, rows_got, sizeof(rows_got));
+        }
+    }
+}
+
+int main(void) {
+    // tables of the kernels are built by grey_init()
+    grey_init();
+    for (unsigned int k = 1; GREY_KERNELS[k].name; ++k) {
+        if (!GREY_KERNELS[k].supported()) {
+            printf("%s: not supported by CPU, skipped\n", GREY_KERNELS[k].name);
+            continue;
+        }
+        const unsigned int before = failures;
+        test_convert(&GREY_KERNELS[k]);
+        test_pack(&GREY_KERNELS[k]);
+        test_transpose(&GREY_KERNELS[k]);
+        test_filter(&GREY_KERNELS[k]);
+        printf("%s: %s\n", GREY_KERNELS[k].name, failures == before ? "OK" : "FAILED");
+    }
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}